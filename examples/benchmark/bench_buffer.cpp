@@ -0,0 +1,82 @@
+#include "benchmark.hpp"
+
+#include "../../src/stream_buffer.hpp"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace Benchmark
+{
+#	define SMALL_MESSAGES 256
+#	define SMALL_MESSAGE_SIZE 8
+#	define CHUNK_SIZE 2048
+
+  // Stream of small messages followed by single RAW update, 32 bits per pixel.
+  static std::vector<char> make_stream(int width, int height)
+  {
+    std::vector<char> stream(SMALL_MESSAGES * SMALL_MESSAGE_SIZE + 16 + width * height * 4);
+
+    for (size_t i = 0; i < stream.size(); ++i)
+      stream[i] = (char)(i * 31);
+
+    return stream;
+  }
+
+  // Queue everything in receive sized chunks, then consume small messages one by one
+  // and RAW payload one row at a time.
+  template <typename Append, typename Consume>
+  static double run(const std::vector<char>& stream, int width, Append append, Consume consume)
+  {
+    double start = now();
+
+    for (size_t offset = 0; offset < stream.size(); offset += CHUNK_SIZE)
+      append(&stream[offset], std::min((size_t)CHUNK_SIZE, stream.size() - offset));
+
+    for (int i = 0; i < SMALL_MESSAGES; ++i)
+      consume(SMALL_MESSAGE_SIZE);
+
+    consume(16);
+
+    for (size_t left = stream.size() - SMALL_MESSAGES * SMALL_MESSAGE_SIZE - 16; left > 0; )
+    {
+      size_t row = std::min(left, (size_t)width * 4);
+      consume(row);
+      left -= row;
+    }
+
+    return now() - start;
+  }
+
+  static void compare(const char* label, int width, int height)
+  {
+    std::vector<char> stream = make_stream(width, height);
+
+    std::string s;
+    double string_time = run(stream, width,
+      [&](const char* data, size_t length) { s.insert(s.end(), data, data + length); },
+      [&](size_t bytes) { s.erase(s.begin(), s.begin() + std::min(bytes, s.length())); });
+
+    Network::ReceiveBuffer r;
+    double ring_time = run(stream, width,
+      [&](const char* data, size_t length) { r.append(data, length); },
+      [&](size_t bytes) { r.consume(bytes); });
+
+    char name[64];
+
+    sprintf(name, "%s std::string erase", label);
+    report(name, string_time, (double)stream.size());
+
+    sprintf(name, "%s ring buffer consume", label);
+    report(name, ring_time, (double)stream.size());
+  }
+
+  int run_buffer(int /*argc*/, char** /*argv*/)
+  {
+    compare("1080p RAW", 1920, 1080);
+    compare("4K RAW", 3840, 2160);
+
+    return 0;
+  }
+}
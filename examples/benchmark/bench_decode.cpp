@@ -0,0 +1,1104 @@
+#include "benchmark.hpp"
+
+#include "../../src/hextile_decoder.hpp"
+#include "../../src/pixel_fill.hpp"
+#include "../../src/vnc_client.hpp"
+#include "../../src/worker_pool.hpp"
+
+#include "../../src/cryptoppmin/filters.h"
+#include "../../src/cryptoppmin/zlib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Benchmark
+{
+#	define DECODE_WIDTH 1920
+#	define DECODE_HEIGHT 1080
+#	define DECODE_CHUNK 65536
+
+  struct EncodedRect
+  {
+    Network::RectHeader header;
+    std::string data;
+  };
+
+  static void put_pixel(std::string& s, unsigned int pixel, int bpp)
+  {
+    s.append((const char*)&pixel, bpp);
+  }
+
+  static void put16(std::string& s, int value)
+  {
+    s += (char)(value >> 8);
+    s += (char)value;
+  }
+
+  static Network::PixelFormat pixel_format(int bpp)
+  {
+    Network::PixelFormat format;
+    memset(&format, 0, sizeof(format));
+
+    format.bits_per_pixel = bpp * 8;
+    format.depth = bpp == 4 ? 24 : bpp * 8;
+    format.true_colour = true;
+
+    // 4 bytes per pixel with colours in low 3 bytes, as usual, so that ZRLE sends them in 3 bytes.
+    if (bpp == 4)
+    {
+      format.red_max = format.green_max = format.blue_max = 255;
+      format.red_shift = 16;
+      format.green_shift = 8;
+    }
+
+    return format;
+  }
+
+  // Stands for the kernel receiving RAW payload straight into framebuffer rows.
+  static void copy_direct(const Network::DirectRead& direct, const char* payload)
+  {
+    for (size_t row = 0; row < direct.stored_rows; ++row)
+      memcpy(direct.destination + row * direct.stride, payload + row * direct.row_length, direct.copy_length);
+  }
+
+  // Feeds rectangles to decoder in receive sized chunks, as client does, and repeats for given time.
+  // Decoded framebuffer is compared to expected one when given.
+  static void measure_decoder(const char* name, const std::vector<EncodedRect>& rects, int bpp, double seconds,
+    const std::vector<char>* expected = 0)
+  {
+    std::vector<char> framebuffer((size_t)DECODE_WIDTH * DECODE_HEIGHT * bpp);
+    Network::ReceiveBuffer input;
+
+    Network::DecodeContext context;
+    memset(&context, 0, sizeof(context));
+
+    context.input = &input;
+    context.format = pixel_format(bpp);
+    context.framebuffer = &framebuffer[0];
+    context.width = DECODE_WIDTH;
+    context.height = DECODE_HEIGHT;
+    context.stride = (size_t)DECODE_WIDTH * bpp;
+
+    double bytes = 0;
+    double pixels = 0;
+    int frames = 0;
+    double start = now();
+    double elapsed = 0;
+
+    do
+    {
+      // Decoder state, such as zlib stream, starts over with every pass, as with new connection.
+      std::unique_ptr<Network::RectDecoder> decoder(Network::RectDecoder::create(rects[0].header.encoding));
+      if (!decoder)
+        return;
+
+      for (size_t i = 0; i < rects.size(); ++i)
+      {
+        const std::string& data = rects[i].data;
+
+        Network::RectDecoder::Result result = Network::RectDecoder::decode_incomplete;
+        size_t appended = 0;
+
+        while (result == Network::RectDecoder::decode_incomplete && appended < data.size())
+        {
+          size_t length = std::min((size_t)DECODE_CHUNK, data.size() - appended);
+
+          input.append(data.data() + appended, length);
+          appended += length;
+
+          context.read_direct = false;
+          result = decoder->decode(context, rects[i].header);
+        }
+
+        if (result == Network::RectDecoder::decode_done && context.read_direct)
+        {
+          copy_direct(context.direct, data.data() + appended - input.length());
+          input.clear();
+        }
+
+        if (result != Network::RectDecoder::decode_done || !input.empty())
+        {
+          printf("%-40s decoding failed\n", name);
+          return;
+        }
+
+        bytes += data.size();
+        pixels += (double)rects[i].header.width * rects[i].header.height;
+      }
+
+      ++frames;
+      elapsed = now() - start;
+    }
+    while (elapsed < seconds);
+
+    printf("%-40s %8.1f KB/frame %7.2f ms/frame %8.1f Mpixels/s %s\n", name, bytes / frames / 1024.0,
+      elapsed / frames * 1000.0, pixels / elapsed / 1e6, expected && *expected != framebuffer ? "framebuffer mismatch" : "");
+  }
+
+  // Full screen RRE rectangle with many small solid subrectangles, as flat desktop with text.
+  static std::vector<EncodedRect> rre_rects(int bpp, int subrects)
+  {
+    EncodedRect rect = { { 0, 0, DECODE_WIDTH, DECODE_HEIGHT, Network::VncClient::encoding_rre }, std::string() };
+
+    rect.data.append(4, 0);
+    rect.data[2] = (char)(subrects >> 8);
+    rect.data[3] = (char)subrects;
+    put_pixel(rect.data, 0x00c0c0c0, bpp);
+
+    srand(1);
+
+    for (int i = 0; i < subrects; ++i)
+    {
+      int width = 1 + rand() % 32;
+      int height = 1 + rand() % 16;
+
+      put_pixel(rect.data, rand(), bpp);
+      put16(rect.data, rand() % (DECODE_WIDTH - width));
+      put16(rect.data, rand() % (DECODE_HEIGHT - height));
+      put16(rect.data, width);
+      put16(rect.data, height);
+    }
+
+    return std::vector<EncodedRect>(1, rect);
+  }
+
+  // Screen in 120 x 120 CoRRE tiles, each with own subrectangles.
+  static std::vector<EncodedRect> corre_rects(int bpp, int subrects)
+  {
+    std::vector<EncodedRect> rects;
+
+    srand(1);
+
+    for (int y = 0; y < DECODE_HEIGHT; y += 120)
+    {
+      for (int x = 0; x < DECODE_WIDTH; x += 120)
+      {
+        EncodedRect rect = { { x, y, 120, 120, Network::VncClient::encoding_corre }, std::string() };
+
+        rect.data.append(4, 0);
+        rect.data[3] = (char)subrects;
+        put_pixel(rect.data, 0x00c0c0c0, bpp);
+
+        for (int i = 0; i < subrects; ++i)
+        {
+          int width = 1 + rand() % 32;
+          int height = 1 + rand() % 16;
+
+          put_pixel(rect.data, rand(), bpp);
+          rect.data += (char)(rand() % (120 - width));
+          rect.data += (char)(rand() % (120 - height));
+          rect.data += (char)width;
+          rect.data += (char)height;
+        }
+
+        rects.push_back(rect);
+      }
+    }
+
+    return rects;
+  }
+
+  static void set_pixel(std::vector<char>& pixels, int x, int y, unsigned int pixel, int bpp)
+  {
+    pixel &= 0x00ffffff;
+
+    memcpy(&pixels[((size_t)y * DECODE_WIDTH + x) * bpp], &pixel, bpp);
+  }
+
+  static unsigned int get_pixel(const std::vector<char>& pixels, int x, int y, int bpp)
+  {
+    unsigned int pixel = 0;
+    memcpy(&pixel, &pixels[((size_t)y * DECODE_WIDTH + x) * bpp], bpp);
+
+    return pixel;
+  }
+
+  // Desktop with flat background, windows with text, and a photo, as typical full screen update.
+  static std::vector<char> desktop_scene(int bpp)
+  {
+    std::vector<char> pixels((size_t)DECODE_WIDTH * DECODE_HEIGHT * bpp);
+
+    srand(2);
+
+    for (int y = 0; y < DECODE_HEIGHT; ++y)
+    {
+      for (int x = 0; x < DECODE_WIDTH; ++x)
+        set_pixel(pixels, x, y, 0x003a6ea5, bpp);
+    }
+
+    static const int windows[][4] = { { 60, 40, 900, 700 }, { 700, 300, 1100, 720 }, { 1400, 80, 460, 500 } };
+
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w)
+    {
+      const int* r = windows[w];
+
+      for (int y = r[1]; y < r[1] + r[3]; ++y)
+      {
+        for (int x = r[0]; x < r[0] + r[2]; ++x)
+        {
+          bool title = y < r[1] + 24;
+          bool text = !title && (y - r[1]) % 18 < 12 && x > r[0] + 8 && x < r[0] + r[2] - 8 && rand() % 3 == 0;
+
+          set_pixel(pixels, x, y, title ? 0x00204080 : text ? 0x00101010 : 0x00ffffff, bpp);
+        }
+      }
+    }
+
+    for (int y = 500; y < 800; ++y)
+    {
+      for (int x = 100; x < 500; ++x)
+        set_pixel(pixels, x, y, (x * 7 + y * 3 + rand() % 16) * 0x00010305, bpp);
+    }
+
+    return pixels;
+  }
+
+  static std::vector<EncodedRect> raw_rects(const std::vector<char>& pixels)
+  {
+    EncodedRect rect = { { 0, 0, DECODE_WIDTH, DECODE_HEIGHT, Network::VncClient::encoding_raw }, std::string(pixels.begin(), pixels.end()) };
+
+    return std::vector<EncodedRect>(1, rect);
+  }
+
+  static void text_line(std::vector<char>& pixels, int x, int y, int width, int height, int bpp)
+  {
+    for (int row = y; row < y + height; ++row)
+    {
+      for (int column = x; column < x + width; ++column)
+        set_pixel(pixels, column, row, rand() % 3 == 0 ? 0x00101010 : 0x00ffffff, bpp);
+    }
+  }
+
+  // Session as seen by client: full desktop first, then typing into a window, line by line, and a video
+  // playing in the photo area. Rectangles are RAW, final framebuffer is left in pixels.
+  static std::vector<EncodedRect> desktop_session(int bpp, std::vector<char>& pixels)
+  {
+    pixels = desktop_scene(bpp);
+
+    std::vector<EncodedRect> rects = raw_rects(pixels);
+
+    for (int i = 0; i < 300; ++i)
+    {
+      EncodedRect rect = { { 68, 64 + (i % 36) * 18, 600, 12, Network::VncClient::encoding_raw }, std::string() };
+
+      if (i % 30 == 29)
+      {
+        Network::RectHeader video = { 100, 500, 400, 300, Network::VncClient::encoding_raw };
+        rect.header = video;
+
+        for (int y = 500; y < 800; ++y)
+        {
+          for (int x = 100; x < 500; ++x)
+            set_pixel(pixels, x, y, (x * 7 + y * 3 + i + rand() % 16) * 0x00010305, bpp);
+        }
+      }
+      else
+        text_line(pixels, rect.header.x, rect.header.y, rect.header.width, rect.header.height, bpp);
+
+      for (int y = rect.header.y; y < rect.header.y + rect.header.height; ++y)
+        rect.data.append(&pixels[((size_t)y * DECODE_WIDTH + rect.header.x) * bpp], rect.header.width * bpp);
+
+      rects.push_back(rect);
+    }
+
+    return rects;
+  }
+
+  // RAW rectangles compressed by one zlib stream, flushed after every rectangle as servers do.
+  static std::vector<EncodedRect> zlib_rects(std::vector<EncodedRect> rects)
+  {
+    std::string compressed;
+    CryptoPP::ZlibCompressor compressor(new CryptoPP::StringSink(compressed));
+
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+      compressor.Put((const byte*)rects[i].data.data(), rects[i].data.size());
+      compressor.Flush(true);
+
+      rects[i].header.encoding = Network::VncClient::encoding_zlib;
+      rects[i].data.assign(4, 0);
+
+      for (int b = 0; b < 4; ++b)
+        rects[i].data[b] = (char)(compressed.size() >> (24 - b * 8));
+
+      rects[i].data += compressed;
+      compressed.clear();
+    }
+
+    return rects;
+  }
+
+  static size_t run_length_bytes(int run)
+  {
+    return (run - 1) / 255 + 1;
+  }
+
+  static void put_run_length(std::string& s, int run)
+  {
+    for (run -= 1; run >= 255; run -= 255)
+      s += (char)255;
+
+    s += (char)run;
+  }
+
+  // ZRLE or TRLE tile in the smallest of raw, solid, packed palette, plain RLE and palette RLE forms, as
+  // servers do. TRLE passes palette of previous tile, which is reused when it is the same.
+  static void encode_tile(std::string& s, const std::vector<unsigned int>& pixels, int width, int height, int cpixel,
+    std::vector<unsigned int>* previous)
+  {
+    std::vector<unsigned int> palette;
+    std::vector<std::pair<unsigned int, int> > runs;
+
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+      if (palette.size() <= 127 && std::find(palette.begin(), palette.end(), pixels[i]) == palette.end())
+        palette.push_back(pixels[i]);
+
+      if (!runs.empty() && runs.back().first == pixels[i])
+        ++runs.back().second;
+      else
+        runs.push_back(std::make_pair(pixels[i], 1));
+    }
+
+    bool reuse = previous && *previous == palette;
+    size_t palette_bytes = reuse ? 0 : palette.size() * cpixel;
+
+    size_t raw = pixels.size() * cpixel;
+    size_t plain = 0;
+    size_t palette_rle = palette_bytes;
+
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+      plain += cpixel + run_length_bytes(runs[i].second);
+      palette_rle += 1 + (runs[i].second > 1 ? run_length_bytes(runs[i].second) : 0);
+    }
+
+    int bits = palette.size() <= 2 ? 1 : palette.size() <= 4 ? 2 : 4;
+    size_t packed = palette_bytes + height * ((width * bits + 7) / 8);
+
+    if (palette.size() == 1)
+    {
+      s += (char)1;
+      put_pixel(s, palette[0], cpixel);
+    }
+    else if (palette.size() <= 16 && packed <= std::min(raw, std::min(plain, palette_rle)))
+    {
+      s += (char)(reuse ? 127 : palette.size());
+
+      for (size_t i = 0; i < palette.size() && !reuse; ++i)
+        put_pixel(s, palette[i], cpixel);
+
+      if (previous)
+        *previous = palette;
+
+      for (int y = 0; y < height; ++y)
+      {
+        int byte = 0;
+        int used = 0;
+
+        for (int x = 0; x < width; ++x)
+        {
+          int index = (int)(std::find(palette.begin(), palette.end(), pixels[y * width + x]) - palette.begin());
+
+          byte |= index << (8 - bits - used);
+          used += bits;
+
+          if (used == 8 || x == width - 1)
+          {
+            s += (char)byte;
+            byte = 0;
+            used = 0;
+          }
+        }
+      }
+    }
+    else if (palette.size() <= 127 && palette_rle <= std::min(raw, plain))
+    {
+      s += (char)(reuse ? 129 : 128 + palette.size());
+
+      for (size_t i = 0; i < palette.size() && !reuse; ++i)
+        put_pixel(s, palette[i], cpixel);
+
+      if (previous)
+        *previous = palette;
+
+      for (size_t i = 0; i < runs.size(); ++i)
+      {
+        int index = (int)(std::find(palette.begin(), palette.end(), runs[i].first) - palette.begin());
+
+        if (runs[i].second > 1)
+        {
+          s += (char)(index | 128);
+          put_run_length(s, runs[i].second);
+        }
+        else
+          s += (char)index;
+      }
+    }
+    else if (plain < raw)
+    {
+      s += (char)128;
+
+      for (size_t i = 0; i < runs.size(); ++i)
+      {
+        put_pixel(s, runs[i].first, cpixel);
+        put_run_length(s, runs[i].second);
+      }
+    }
+    else
+    {
+      s += (char)0;
+
+      for (size_t i = 0; i < pixels.size(); ++i)
+        put_pixel(s, pixels[i], cpixel);
+    }
+  }
+
+  // RAW rectangles as tiles of ZRLE or TRLE, without zlib layer.
+  static std::vector<EncodedRect> tile_rects(std::vector<EncodedRect> rects, int bpp, int size, int encoding)
+  {
+    int cpixel = pixel_format(bpp).compact_pixel_size();
+
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+      const Network::RectHeader& r = rects[i].header;
+      std::string tiles;
+      std::vector<unsigned int> previous;
+
+      for (int top = 0; top < r.height; top += size)
+      {
+        for (int left = 0; left < r.width; left += size)
+        {
+          int width = std::min(size, r.width - left);
+          int height = std::min(size, r.height - top);
+
+          std::vector<unsigned int> pixels;
+
+          for (int y = top; y < top + height; ++y)
+          {
+            for (int x = left; x < left + width; ++x)
+            {
+              unsigned int pixel = 0;
+              memcpy(&pixel, &rects[i].data[((size_t)y * r.width + x) * bpp], bpp);
+              pixels.push_back(pixel);
+            }
+          }
+
+          encode_tile(tiles, pixels, width, height, cpixel, encoding == Network::VncClient::encoding_trle ? &previous : 0);
+        }
+      }
+
+      rects[i].header.encoding = encoding;
+      rects[i].data = tiles;
+    }
+
+    return rects;
+  }
+
+  // RAW rectangles as ZRLE, tiles compressed by one zlib stream flushed after every rectangle.
+  static std::vector<EncodedRect> zrle_rects(const std::vector<EncodedRect>& rects, int bpp)
+  {
+    std::vector<EncodedRect> zrle = zlib_rects(tile_rects(rects, bpp, 64, Network::VncClient::encoding_zrle));
+
+    for (size_t i = 0; i < zrle.size(); ++i)
+      zrle[i].header.encoding = Network::VncClient::encoding_zrle;
+
+    return zrle;
+  }
+
+  static void put_compact_length(std::string& s, size_t length)
+  {
+    s += (char)((length & 0x7f) | (length > 0x7f ? 0x80 : 0));
+
+    if (length > 0x7f)
+    {
+      s += (char)(((length >> 7) & 0x7f) | (length > 0x3fff ? 0x80 : 0));
+
+      if (length > 0x3fff)
+        s += (char)(length >> 14);
+    }
+  }
+
+  // Tight pixel, colours of 4 byte pixel as 3 bytes of red, green and blue.
+  static void put_tight_pixel(std::string& s, unsigned int pixel, int bpp)
+  {
+    if (bpp == 4)
+    {
+      s += (char)(pixel >> 16);
+      s += (char)(pixel >> 8);
+      s += (char)pixel;
+    }
+    else
+      put_pixel(s, pixel, bpp);
+  }
+
+  // RAW rectangles as Tight, split into bands of up to 64K pixels as servers do. Bands are solid fills, palette
+  // filtered on stream 1 when they have up to 256 colours, otherwise gradient filtered on stream 2 with 4 bytes
+  // per pixel, or copied on stream 0. Every stream is flushed after every band.
+  static std::vector<EncodedRect> tight_rects(const std::vector<EncodedRect>& rects, int bpp)
+  {
+    std::string compressed[4];
+    std::unique_ptr<CryptoPP::ZlibCompressor> compressors[4];
+
+    for (int i = 0; i < 4; ++i)
+      compressors[i].reset(new CryptoPP::ZlibCompressor(new CryptoPP::StringSink(compressed[i])));
+
+    std::vector<EncodedRect> tight;
+
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+      const Network::RectHeader& r = rects[i].header;
+      int band = std::max(1, 65536 / r.width);
+
+      for (int top = 0; top < r.height; top += band)
+      {
+        EncodedRect rect = { { r.x, r.y + top, r.width, std::min(band, r.height - top), Network::VncClient::encoding_tight }, std::string() };
+
+        int width = rect.header.width;
+        int height = rect.header.height;
+
+        std::vector<unsigned int> pixels(width * height);
+
+        for (size_t p = 0; p < pixels.size(); ++p)
+          memcpy(&pixels[p], &rects[i].data[((top + p / width) * width + p % width) * bpp], bpp);
+
+        std::vector<unsigned int> palette;
+
+        for (size_t p = 0; p < pixels.size() && palette.size() <= 256; ++p)
+        {
+          if (std::find(palette.begin(), palette.end(), pixels[p]) == palette.end())
+            palette.push_back(pixels[p]);
+        }
+
+        // First band asks for all streams to start over, as they do anyway with the new encoder.
+        int reset = tight.empty() ? 0x0f : 0;
+        int stream;
+        std::string data;
+
+        if (palette.size() == 1)
+        {
+          rect.data += (char)(0x80 | reset);
+          put_tight_pixel(rect.data, palette[0], bpp);
+
+          tight.push_back(rect);
+          continue;
+        }
+        else if (palette.size() <= 256)
+        {
+          stream = 1;
+
+          rect.data += (char)(0x50 | reset);
+          rect.data += (char)1;
+          rect.data += (char)(palette.size() - 1);
+
+          for (size_t c = 0; c < palette.size(); ++c)
+            put_tight_pixel(rect.data, palette[c], bpp);
+
+          for (int y = 0; y < height; ++y)
+          {
+            int byte = 0;
+
+            for (int x = 0; x < width; ++x)
+            {
+              int index = (int)(std::find(palette.begin(), palette.end(), pixels[y * width + x]) - palette.begin());
+
+              if (palette.size() > 2)
+                data += (char)index;
+              else
+              {
+                byte |= index << (7 - (x & 7));
+
+                if ((x & 7) == 7 || x == width - 1)
+                {
+                  data += (char)byte;
+                  byte = 0;
+                }
+              }
+            }
+          }
+        }
+        else if (bpp == 4)
+        {
+          stream = 2;
+
+          rect.data += (char)(0x60 | reset);
+          rect.data += (char)2;
+
+          for (int y = 0; y < height; ++y)
+          {
+            for (int x = 0; x < width; ++x)
+            {
+              for (int shift = 16; shift >= 0; shift -= 8)
+              {
+                int left = x ? (pixels[y * width + x - 1] >> shift) & 255 : 0;
+                int above = y ? (pixels[(y - 1) * width + x] >> shift) & 255 : 0;
+                int above_left = x && y ? (pixels[(y - 1) * width + x - 1] >> shift) & 255 : 0;
+                int prediction = std::min(std::max(left + above - above_left, 0), 255);
+
+                data += (char)(((pixels[y * width + x] >> shift) & 255) - prediction);
+              }
+            }
+          }
+        }
+        else
+        {
+          stream = 0;
+
+          rect.data += (char)reset;
+
+          for (size_t p = 0; p < pixels.size(); ++p)
+            put_tight_pixel(data, pixels[p], bpp);
+        }
+
+        if (data.size() < 12)
+          rect.data += data;
+        else
+        {
+          compressors[stream]->Put((const byte*)data.data(), data.size());
+          compressors[stream]->Flush(true);
+
+          put_compact_length(rect.data, compressed[stream].size());
+
+          rect.data += compressed[stream];
+          compressed[stream].clear();
+        }
+
+        tight.push_back(rect);
+      }
+    }
+
+    return tight;
+  }
+
+  static void put32(std::string& s, unsigned int value)
+  {
+    put16(s, value >> 16);
+    put16(s, value & 0xffff);
+  }
+
+  static void put_png_chunk(std::string& s, const char* type, const std::string& data)
+  {
+    put32(s, (unsigned int)data.size());
+
+    std::string chunk = std::string(type, 4) + data;
+    unsigned int crc = 0xffffffff;
+
+    for (size_t i = 0; i < chunk.size(); ++i)
+    {
+      crc ^= (unsigned char)chunk[i];
+
+      for (int bit = 0; bit < 8; ++bit)
+        crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+    }
+
+    s += chunk;
+    put32(s, crc ^ 0xffffffff);
+  }
+
+  // PNG of 4 byte pixels, palette one when they have up to 256 colours, otherwise RGB with every row filtered
+  // by the filter giving the smallest sum of absolute values, as libpng does.
+  static std::string png_image(const std::vector<unsigned int>& pixels, int width, int height,
+    const std::vector<unsigned int>& palette)
+  {
+    bool indexed = palette.size() <= 256;
+    int channels = indexed ? 1 : 3;
+    size_t length = (size_t)width * channels;
+
+    std::vector<unsigned char> rows(length * height);
+
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < width; ++x)
+      {
+        unsigned int pixel = pixels[y * width + x];
+        unsigned char* p = &rows[y * length + x * channels];
+
+        if (indexed)
+          *p = (unsigned char)(std::find(palette.begin(), palette.end(), pixel) - palette.begin());
+        else
+        {
+          p[0] = (unsigned char)(pixel >> 16);
+          p[1] = (unsigned char)(pixel >> 8);
+          p[2] = (unsigned char)pixel;
+        }
+      }
+    }
+
+    std::string filtered;
+    std::vector<unsigned char> zero(length);
+    std::string candidate;
+
+    for (int y = 0; y < height; ++y)
+    {
+      const unsigned char* row = &rows[y * length];
+      const unsigned char* previous = y ? row - length : &zero[0];
+
+      std::string best;
+      long best_sum = -1;
+
+      for (int filter = 0; filter < (indexed ? 1 : 5); ++filter)
+      {
+        candidate.assign(1, (char)filter);
+        long sum = 0;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+          int a = i >= (size_t)channels ? row[i - channels] : 0;
+          int b = previous[i];
+          int c = i >= (size_t)channels ? previous[i - channels] : 0;
+          int p = a + b - c;
+          int prediction = 0;
+
+          if (filter == 1)
+            prediction = a;
+          else if (filter == 2)
+            prediction = b;
+          else if (filter == 3)
+            prediction = (a + b) / 2;
+          else if (filter == 4)
+            prediction = abs(p - a) <= abs(p - b) && abs(p - a) <= abs(p - c) ? a : abs(p - b) <= abs(p - c) ? b : c;
+
+          signed char value = (signed char)(row[i] - prediction);
+
+          candidate += (char)value;
+          sum += abs(value);
+        }
+
+        if (best_sum < 0 || sum < best_sum)
+        {
+          best.swap(candidate);
+          best_sum = sum;
+        }
+      }
+
+      filtered += best;
+    }
+
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    std::string header;
+
+    put32(header, width);
+    put32(header, height);
+    header += (char)8;
+    header += (char)(indexed ? 3 : 2);
+    header.append(3, 0);
+
+    put_png_chunk(png, "IHDR", header);
+
+    if (indexed)
+    {
+      std::string colours;
+
+      for (size_t c = 0; c < palette.size(); ++c)
+        put_tight_pixel(colours, palette[c], 4);
+
+      put_png_chunk(png, "PLTE", colours);
+    }
+
+    std::string compressed;
+    CryptoPP::StringSource(filtered, true, new CryptoPP::ZlibCompressor(new CryptoPP::StringSink(compressed)));
+
+    put_png_chunk(png, "IDAT", compressed);
+    put_png_chunk(png, "IEND", std::string());
+
+    return png;
+  }
+
+  // RAW rectangles of 4 byte pixels as TightPNG, in the same bands as Tight. Bands are solid fills or PNG images.
+  static std::vector<EncodedRect> tight_png_rects(const std::vector<EncodedRect>& rects)
+  {
+    std::vector<EncodedRect> tight;
+
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+      const Network::RectHeader& r = rects[i].header;
+      int band = std::max(1, 65536 / r.width);
+
+      for (int top = 0; top < r.height; top += band)
+      {
+        EncodedRect rect = { { r.x, r.y + top, r.width, std::min(band, r.height - top), Network::VncClient::encoding_tight_png }, std::string() };
+
+        int width = rect.header.width;
+        int height = rect.header.height;
+
+        std::vector<unsigned int> pixels(width * height);
+
+        for (size_t p = 0; p < pixels.size(); ++p)
+          memcpy(&pixels[p], &rects[i].data[((top + p / width) * width + p % width) * 4], 4);
+
+        std::vector<unsigned int> palette;
+
+        for (size_t p = 0; p < pixels.size() && palette.size() <= 256; ++p)
+        {
+          if (std::find(palette.begin(), palette.end(), pixels[p]) == palette.end())
+            palette.push_back(pixels[p]);
+        }
+
+        if (palette.size() == 1)
+        {
+          rect.data += (char)0x80;
+          put_tight_pixel(rect.data, palette[0], 4);
+        }
+        else
+        {
+          std::string png = png_image(pixels, width, height, palette);
+
+          rect.data += (char)0xa0;
+          put_compact_length(rect.data, png.size());
+          rect.data += png;
+        }
+
+        tight.push_back(rect);
+      }
+    }
+
+    return tight;
+  }
+
+  // Simple Hextile encoder: solid tiles, two colour tiles with foreground runs, coloured runs when they are
+  // smaller than RAW tile.
+  static std::vector<EncodedRect> hextile_rects(const std::vector<char>& pixels, int bpp)
+  {
+    EncodedRect rect = { { 0, 0, DECODE_WIDTH, DECODE_HEIGHT, Network::VncClient::encoding_hextile }, std::string() };
+
+    bool known_background = false;
+    bool known_foreground = false;
+    unsigned int background = 0;
+    unsigned int foreground = 0;
+
+    for (int top = 0; top < DECODE_HEIGHT; top += 16)
+    {
+      for (int left = 0; left < DECODE_WIDTH; left += 16)
+      {
+        int width = std::min(16, DECODE_WIDTH - left);
+        int height = std::min(16, DECODE_HEIGHT - top);
+
+        unsigned int colours[2] = { get_pixel(pixels, left, top, bpp), 0 };
+        int count = 1;
+
+        for (int y = top; y < top + height && count < 3; ++y)
+        {
+          for (int x = left; x < left + width && count < 3; ++x)
+          {
+            unsigned int pixel = get_pixel(pixels, x, y, bpp);
+
+            if (pixel != colours[0] && (count == 1 || pixel != colours[1]))
+            {
+              if (count < 2)
+                colours[1] = pixel;
+
+              ++count;
+            }
+          }
+        }
+
+        std::string runs;
+        int subrects = 0;
+
+        for (int y = 0; y < height; ++y)
+        {
+          for (int x = 0; x < width; )
+          {
+            unsigned int pixel = get_pixel(pixels, left + x, top + y, bpp);
+            int end = x + 1;
+
+            while (end < width && get_pixel(pixels, left + end, top + y, bpp) == pixel)
+              ++end;
+
+            if (pixel != colours[0])
+            {
+              if (count > 2)
+                put_pixel(runs, pixel, bpp);
+
+              runs += (char)((x << 4) | y);
+              runs += (char)((end - x - 1) << 4);
+              ++subrects;
+            }
+
+            x = end;
+          }
+        }
+
+        int flags = 0;
+        std::string tile;
+
+        if (!known_background || background != colours[0])
+        {
+          flags |= Network::HextileDecoder::hextile_background;
+          put_pixel(tile, colours[0], bpp);
+        }
+
+        if (count == 2 && (!known_foreground || foreground != colours[1]))
+        {
+          flags |= Network::HextileDecoder::hextile_foreground;
+          put_pixel(tile, colours[1], bpp);
+        }
+
+        if (subrects)
+        {
+          flags |= Network::HextileDecoder::hextile_any_subrects | (count > 2 ? Network::HextileDecoder::hextile_subrects_coloured : 0);
+          tile += (char)subrects;
+          tile += runs;
+        }
+
+        if (subrects > 255 || tile.size() >= (size_t)width * height * bpp)
+        {
+          rect.data += (char)Network::HextileDecoder::hextile_raw;
+
+          for (int y = top; y < top + height; ++y)
+            rect.data.append(&pixels[((size_t)y * DECODE_WIDTH + left) * bpp], width * bpp);
+
+          known_background = false;
+          known_foreground = false;
+          continue;
+        }
+
+        rect.data += (char)flags;
+        rect.data += tile;
+
+        background = colours[0];
+        known_background = true;
+
+        if (count > 1)
+        {
+          foreground = colours[1];
+          known_foreground = count == 2;
+        }
+      }
+    }
+
+    return std::vector<EncodedRect>(1, rect);
+  }
+
+  // Fill kernel against pixel by pixel copy, on subrectangle sized areas.
+  static void measure_fill(int bpp, int width, int height, double seconds)
+  {
+    std::vector<char> framebuffer((size_t)DECODE_WIDTH * DECODE_HEIGHT * bpp);
+    size_t stride = (size_t)DECODE_WIDTH * bpp;
+    unsigned int pixel = 0x11223344;
+
+    double rate[2];
+
+    for (int kernel = 0; kernel < 2; ++kernel)
+    {
+      double pixels = 0;
+      double start = now();
+      double elapsed = 0;
+
+      do
+      {
+        for (int y = 0; y + height <= DECODE_HEIGHT; y += height)
+        {
+          for (int x = 0; x + width <= DECODE_WIDTH; x += width)
+          {
+            char* destination = &framebuffer[y * stride + x * bpp];
+
+            if (kernel)
+            {
+              Network::fill_rect(destination, stride, width, height, bpp, (const char*)&pixel);
+              continue;
+            }
+
+            for (int row = 0; row < height; ++row, destination += stride)
+            {
+              for (int column = 0; column < width; ++column)
+                memcpy(destination + column * bpp, &pixel, bpp);
+            }
+          }
+        }
+
+        pixels += (double)(DECODE_WIDTH / width * width) * (DECODE_HEIGHT / height * height);
+        elapsed = now() - start;
+      }
+      while (elapsed < seconds);
+
+      rate[kernel] = pixels / elapsed / 1e6;
+    }
+
+    printf("fill %d bpp %3dx%-3d %28.1f Mpixels/s per pixel %8.1f Mpixels/s kernel\n", bpp, width, height, rate[0], rate[1]);
+  }
+
+  int run_decode(int argc, char** argv)
+  {
+    double seconds = argc > 0 ? atof(argv[0]) : 1.0;
+
+    static const int sizes[][2] = { { 4, 4 }, { 16, 16 }, { 64, 64 } };
+    static const int bpps[] = { 1, 2, 4 };
+
+    for (size_t b = 0; b < sizeof(bpps) / sizeof(bpps[0]); ++b)
+    {
+      for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        measure_fill(bpps[b], sizes[i][0], sizes[i][1], seconds / 4);
+    }
+
+    char name[64];
+
+    for (size_t b = 0; b < sizeof(bpps) / sizeof(bpps[0]); ++b)
+    {
+      std::vector<char> scene = desktop_scene(bpps[b]);
+
+      sprintf(name, "desktop RAW %d bpp", bpps[b]);
+      measure_decoder(name, raw_rects(scene), bpps[b], seconds, &scene);
+
+      sprintf(name, "desktop Hextile %d bpp", bpps[b]);
+      measure_decoder(name, hextile_rects(scene, bpps[b]), bpps[b], seconds, &scene);
+
+      std::vector<char> final;
+      std::vector<EncodedRect> session = desktop_session(bpps[b], final);
+
+      sprintf(name, "session RAW %d bpp", bpps[b]);
+      measure_decoder(name, session, bpps[b], seconds, &final);
+
+      sprintf(name, "session Zlib %d bpp", bpps[b]);
+      measure_decoder(name, zlib_rects(session), bpps[b], seconds, &final);
+
+      sprintf(name, "session ZRLE %d bpp", bpps[b]);
+      measure_decoder(name, zrle_rects(session, bpps[b]), bpps[b], seconds, &final);
+
+      sprintf(name, "session TRLE %d bpp", bpps[b]);
+      measure_decoder(name, tile_rects(session, bpps[b], 16, Network::VncClient::encoding_trle), bpps[b], seconds, &final);
+
+      sprintf(name, "session Tight %d bpp", bpps[b]);
+      measure_decoder(name, tight_rects(session, bpps[b]), bpps[b], seconds, &final);
+
+      // PNG colours are 8 bits, as those of 4 byte pixels.
+      if (bpps[b] == 4)
+      {
+        sprintf(name, "session TightPNG %d bpp", bpps[b]);
+        measure_decoder(name, tight_png_rects(session), bpps[b], seconds, &final);
+      }
+
+      sprintf(name, "RRE 20000 subrects %d bpp", bpps[b]);
+      measure_decoder(name, rre_rects(bpps[b], 20000), bpps[b], seconds);
+
+      sprintf(name, "CoRRE 144 tiles x 100 subrects %d bpp", bpps[b]);
+      measure_decoder(name, corre_rects(bpps[b], 100), bpps[b], seconds);
+    }
+
+    // ZRLE tiles of full screen updates are decoded on worker pool.
+    std::vector<char> scene = desktop_scene(4);
+    std::vector<EncodedRect> desktop = zrle_rects(raw_rects(scene), 4);
+
+    int threads = argc > 1 ? atoi(argv[1]) : Network::WorkerPool::instance().threads();
+
+    for (int t = 0; t <= threads; t = t ? t * 2 : 1)
+    {
+      Network::WorkerPool::instance().set_threads(std::min(t, threads));
+
+      sprintf(name, "desktop ZRLE 4 bpp, %d workers", std::min(t, threads));
+      measure_decoder(name, desktop, 4, seconds, &scene);
+
+      if (t >= threads)
+        break;
+    }
+
+    Network::WorkerPool::instance().set_threads(threads);
+
+    return 0;
+  }
+}
@@ -0,0 +1,94 @@
+#include "benchmark.hpp"
+#include "stand_in_server.hpp"
+
+#include "../../src/vnc_client.hpp"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace Benchmark
+{
+  // Keys are sent from main thread while network thread runs update(), as in keypad app. Latency is
+  // time from send_key() call until stand-in server receives the event.
+  static void measure(bool direct, int samples)
+  {
+    StandInServer server(64, 64);
+    if (!server.start())
+      return;
+
+    std::atomic<int> received(0);
+    std::atomic<double> arrival(0.0);
+
+    server.set_handler([&](int, const char* message, size_t)
+    {
+      if (message[0] == 4 && message[1])
+      {
+        arrival = now();
+        ++received;
+      }
+    });
+
+    Network::VncClient client("127.0.0.1", server.port(), Network::RawStream::transport_poll, Network::SocketOptions::low_latency());
+    client.set_direct_send(direct);
+
+    double start = now();
+    while (!client.connected() && now() - start < 10.0 && client.update(0.1f))
+      ;
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> wakeups(0);
+
+    std::thread network([&]()
+    {
+      while (!stop && client.update(1.0f))
+        ++wakeups;
+    });
+
+    std::vector<double> latency;
+
+    for (int i = 0; i < samples && client.connected(); ++i)
+    {
+      int count = received;
+      double sent = now();
+
+      client.send_key('a', true);
+
+      while (received == count && now() - sent < 5.0)
+        std::this_thread::yield();
+
+      latency.push_back(arrival - sent);
+
+      client.send_key('a', false);
+    }
+
+    stop = true;
+    client.wakeup();
+    network.join();
+
+    if (!latency.empty())
+    {
+      std::sort(latency.begin(), latency.end());
+
+      printf("%-8s keystroke to server: median %7.1f us, p99 %7.1f us, network thread wakeups per key %.2f\n", direct ? "direct" : "queued",
+        latency[latency.size() / 2] * 1e6, latency[latency.size() * 99 / 100] * 1e6, wakeups / (double)latency.size());
+    }
+
+    server.stop();
+  }
+
+  int run_input(int argc, char** argv)
+  {
+    int samples = argc > 0 ? atoi(argv[0]) : 2000;
+
+    Network::initialize();
+
+    measure(false, samples);
+    measure(true, samples);
+
+    return 0;
+  }
+}
@@ -0,0 +1,690 @@
+#include "benchmark.hpp"
+
+#include "../../src/jpeg_decoder.hpp"
+#include "../../src/vnc_client.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(BENCHMARK_LIBJPEG)
+#	include <jpeglib.h>
+#endif
+
+namespace Benchmark
+{
+#	define JPEG_WIDTH 1920
+#	define JPEG_HEIGHT 1080
+#	define JPEG_QUALITY 80
+#	define JPEG_BAND 64
+#	define JPEG_CHUNK 65536
+
+  // Tables of JPEG specification, annex K.
+  static const unsigned char luma_quantization[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+  };
+
+  static const unsigned char chroma_quantization[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+  };
+
+  static const unsigned char dc_luma_counts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+  static const unsigned char dc_chroma_counts[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+  static const unsigned char dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+  static const unsigned char ac_luma_counts[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+  static const unsigned char ac_luma_values[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+  };
+
+  static const unsigned char ac_chroma_counts[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+  static const unsigned char ac_chroma_values[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+  };
+
+  static const unsigned char zigzag[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+  };
+
+  struct HuffmanCodes
+  {
+    unsigned short code[256];
+    unsigned char length[256];
+
+    HuffmanCodes(const unsigned char* counts, const unsigned char* values)
+    {
+      memset(length, 0, sizeof(length));
+
+      unsigned int next = 0;
+
+      for (int bits = 1, k = 0; bits <= 16; ++bits, next <<= 1)
+      {
+        for (int i = 0; i < counts[bits - 1]; ++i, ++k, ++next)
+        {
+          code[values[k]] = (unsigned short)next;
+          length[values[k]] = (unsigned char)bits;
+        }
+      }
+    }
+  };
+
+  // Baseline JPEG encoder, plain and slow, only to produce input of the decoder.
+  class JpegEncoder
+  {
+  public:
+    // Sampling of 0 encodes grayscale, otherwise it is horizontal and vertical one of luma.
+    JpegEncoder(int quality, int h, int v):
+      _h(h), _v(v), _dc_luma(dc_luma_counts, dc_values), _dc_chroma(dc_chroma_counts, dc_values),
+      _ac_luma(ac_luma_counts, ac_luma_values), _ac_chroma(ac_chroma_counts, ac_chroma_values)
+    {
+      int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+      for (int i = 0; i < 64; ++i)
+      {
+        _quantization[0][i] = std::min(std::max((luma_quantization[i] * scale + 50) / 100, 1), 255);
+        _quantization[1][i] = std::min(std::max((chroma_quantization[i] * scale + 50) / 100, 1), 255);
+      }
+
+      for (int u = 0; u < 8; ++u)
+      {
+        for (int x = 0; x < 8; ++x)
+          _cosines[u][x] = (u ? 0.5 : 0.5 / sqrt(2.0)) * cos((2 * x + 1) * u * 3.14159265358979 / 16);
+      }
+    }
+
+    // Image from rows of red, green and blue bytes.
+    std::string encode(const unsigned char* rgb, size_t stride, int width, int height)
+    {
+      _out.clear();
+      _bits = 0;
+      _count = 0;
+
+      bool gray = !_h;
+      int h = gray ? 1 : _h;
+      int v = gray ? 1 : _v;
+      int components = gray ? 1 : 3;
+
+      put_marker(0xd8);
+
+      put_marker(0xdb);
+      put16(2 + 65 * (gray ? 1 : 2));
+
+      for (int t = 0; t < (gray ? 1 : 2); ++t)
+      {
+        _out += (char)t;
+
+        for (int i = 0; i < 64; ++i)
+          _out += (char)_quantization[t][zigzag[i]];
+      }
+
+      put_marker(0xc0);
+      put16(8 + components * 3);
+      _out += (char)8;
+      put16(height);
+      put16(width);
+      _out += (char)components;
+
+      for (int c = 0; c < components; ++c)
+      {
+        _out += (char)(c + 1);
+        _out += (char)(c ? 0x11 : (h << 4) | v);
+        _out += (char)(c ? 1 : 0);
+      }
+
+      put_huffman(0x00, dc_luma_counts, dc_values);
+      put_huffman(0x10, ac_luma_counts, ac_luma_values);
+
+      if (!gray)
+      {
+        put_huffman(0x01, dc_chroma_counts, dc_values);
+        put_huffman(0x11, ac_chroma_counts, ac_chroma_values);
+      }
+
+      put_marker(0xda);
+      put16(6 + components * 2);
+      _out += (char)components;
+
+      for (int c = 0; c < components; ++c)
+      {
+        _out += (char)(c + 1);
+        _out += (char)(c ? 0x11 : 0x00);
+      }
+
+      _out += (char)0;
+      _out += (char)63;
+      _out += (char)0;
+
+      int dc[3] = { 0, 0, 0 };
+      double samples[3][16][16];
+
+      for (int mcu_y = 0; mcu_y < height; mcu_y += 8 * v)
+      {
+        for (int mcu_x = 0; mcu_x < width; mcu_x += 8 * h)
+        {
+          // Edge pixels are repeated past image.
+          for (int y = 0; y < 8 * v; ++y)
+          {
+            for (int x = 0; x < 8 * h; ++x)
+            {
+              const unsigned char* p = rgb + std::min(mcu_y + y, height - 1) * stride + std::min(mcu_x + x, width - 1) * 3;
+
+              samples[0][y][x] = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2] - 128;
+              samples[1][y][x] = -0.168736 * p[0] - 0.331264 * p[1] + 0.5 * p[2];
+              samples[2][y][x] = 0.5 * p[0] - 0.418688 * p[1] - 0.081312 * p[2];
+            }
+          }
+
+          for (int y = 0; y < v; ++y)
+          {
+            for (int x = 0; x < h; ++x)
+              put_block(&samples[0][y * 8][x * 8], 16, 1, 1, 0, dc[0]);
+          }
+
+          // Chroma is averaged over sampling of luma.
+          for (int c = 1; c < components; ++c)
+            put_block(&samples[c][0][0], 16, h, v, 1, dc[c]);
+        }
+      }
+
+      put_bits(0x7f, 7);
+      put_marker(0xd9);
+
+      return _out;
+    }
+
+  private:
+    void put16(int value)
+    {
+      _out += (char)(value >> 8);
+      _out += (char)value;
+    }
+
+    void put_marker(int marker)
+    {
+      _out += (char)0xff;
+      _out += (char)marker;
+    }
+
+    void put_huffman(int table, const unsigned char* counts, const unsigned char* values)
+    {
+      int count = 0;
+
+      for (int i = 0; i < 16; ++i)
+        count += counts[i];
+
+      put_marker(0xc4);
+      put16(3 + 16 + count);
+      _out += (char)table;
+      _out.append((const char*)counts, 16);
+      _out.append((const char*)values, count);
+    }
+
+    void put_bits(unsigned int bits, int length)
+    {
+      _bits = (_bits << length) | (bits & ((1u << length) - 1));
+      _count += length;
+
+      while (_count >= 8)
+      {
+        unsigned char byte = (unsigned char)(_bits >> (_count - 8));
+
+        _out += (char)byte;
+
+        if (byte == 0xff)
+          _out += (char)0;
+
+        _count -= 8;
+      }
+    }
+
+    void put_value(const HuffmanCodes& codes, int symbol_high, int value)
+    {
+      int magnitude = abs(value);
+      int size = 0;
+
+      while (magnitude >> size)
+        ++size;
+
+      int symbol = (symbol_high << 4) | size;
+
+      put_bits(codes.code[symbol], codes.length[symbol]);
+
+      if (size)
+        put_bits(value < 0 ? value - 1 : value, size);
+    }
+
+    void put_block(const double* samples, int stride, int h, int v, int table, int& dc)
+    {
+      double block[8][8];
+      double rows[8][8];
+
+      for (int y = 0; y < 8; ++y)
+      {
+        for (int x = 0; x < 8; ++x)
+        {
+          double sum = 0;
+
+          for (int j = 0; j < v; ++j)
+          {
+            for (int i = 0; i < h; ++i)
+              sum += samples[(y * v + j) * stride + x * h + i];
+          }
+
+          block[y][x] = sum / (h * v);
+        }
+      }
+
+      for (int y = 0; y < 8; ++y)
+      {
+        for (int u = 0; u < 8; ++u)
+        {
+          double sum = 0;
+
+          for (int x = 0; x < 8; ++x)
+            sum += block[y][x] * _cosines[u][x];
+
+          rows[y][u] = sum;
+        }
+      }
+
+      int coefficients[64];
+
+      for (int u = 0; u < 8; ++u)
+      {
+        for (int w = 0; w < 8; ++w)
+        {
+          double sum = 0;
+
+          for (int y = 0; y < 8; ++y)
+            sum += rows[y][u] * _cosines[w][y];
+
+          coefficients[w * 8 + u] = (int)floor(sum / _quantization[table][w * 8 + u] + 0.5);
+        }
+      }
+
+      const HuffmanCodes& dc_codes = table ? _dc_chroma : _dc_luma;
+      const HuffmanCodes& ac_codes = table ? _ac_chroma : _ac_luma;
+
+      put_value(dc_codes, 0, coefficients[0] - dc);
+      dc = coefficients[0];
+
+      int run = 0;
+
+      for (int i = 1; i < 64; ++i)
+      {
+        int value = coefficients[zigzag[i]];
+
+        if (!value)
+        {
+          ++run;
+          continue;
+        }
+
+        for (; run >= 16; run -= 16)
+          put_bits(ac_codes.code[0xf0], ac_codes.length[0xf0]);
+
+        put_value(ac_codes, run, value);
+        run = 0;
+      }
+
+      if (run)
+        put_bits(ac_codes.code[0], ac_codes.length[0]);
+    }
+
+  private:
+    int _h;
+    int _v;
+
+    int _quantization[2][64];
+    double _cosines[8][8];
+
+    HuffmanCodes _dc_luma;
+    HuffmanCodes _dc_chroma;
+    HuffmanCodes _ac_luma;
+    HuffmanCodes _ac_chroma;
+
+    std::string _out;
+    unsigned int _bits;
+    int _count;
+  };
+
+  // Photo with smooth gradients, texture and noise, and some sharp edges.
+  static std::vector<unsigned char> photo_scene()
+  {
+    std::vector<unsigned char> rgb((size_t)JPEG_WIDTH * JPEG_HEIGHT * 3);
+
+    srand(3);
+
+    for (int y = 0; y < JPEG_HEIGHT; ++y)
+    {
+      for (int x = 0; x < JPEG_WIDTH; ++x)
+      {
+        unsigned char* p = &rgb[((size_t)y * JPEG_WIDTH + x) * 3];
+
+        double sky = y < JPEG_HEIGHT / 3 + 40 * sin(x * 0.01) ? 1.0 : 0.0;
+        double texture = 20 * sin(x * 0.05 + y * 0.02) * cos(y * 0.07) + rand() % 12;
+
+        p[0] = (unsigned char)std::min(255.0, std::max(0.0, sky ? 90 + y * 0.2 : 70 + texture + x * 0.05));
+        p[1] = (unsigned char)std::min(255.0, std::max(0.0, sky ? 140 + y * 0.2 : 110 + texture - y * 0.03));
+        p[2] = (unsigned char)std::min(255.0, std::max(0.0, sky ? 220 - y * 0.1 : 50 + texture / 2));
+      }
+    }
+
+    return rgb;
+  }
+
+  static Network::PixelFormat jpeg_format(int bpp)
+  {
+    Network::PixelFormat format;
+    memset(&format, 0, sizeof(format));
+
+    format.bits_per_pixel = bpp * 8;
+    format.depth = bpp == 4 ? 24 : 16;
+    format.true_colour = true;
+
+    if (bpp == 4)
+    {
+      format.red_max = format.green_max = format.blue_max = 255;
+      format.red_shift = 16;
+      format.green_shift = 8;
+    }
+    else
+    {
+      format.red_max = format.blue_max = 31;
+      format.green_max = 63;
+      format.red_shift = 11;
+      format.green_shift = 5;
+    }
+
+    return format;
+  }
+
+  // Peak signal to noise ratio of decoded 4 byte pixels against source image.
+  static double psnr(const std::vector<char>& framebuffer, const std::vector<unsigned char>& rgb, bool gray)
+  {
+    double error = 0;
+
+    for (size_t i = 0; i < (size_t)JPEG_WIDTH * JPEG_HEIGHT; ++i)
+    {
+      const unsigned char* p = &rgb[i * 3];
+      const unsigned char* q = (const unsigned char*)&framebuffer[i * 4];
+
+      for (int c = 0; c < 3; ++c)
+      {
+        double source = gray ? 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2] : p[c];
+        double difference = source - q[2 - c];
+
+        error += difference * difference;
+      }
+    }
+
+    error /= (double)JPEG_WIDTH * JPEG_HEIGHT * 3;
+
+    return error > 0 ? 10 * log10(255.0 * 255.0 / error) : 99.0;
+  }
+
+  // Whole frame as one image, straight into framebuffer.
+  static double measure_jpeg(const char* name, const std::string& jpeg, int bpp, double seconds, std::vector<char>& framebuffer)
+  {
+    Network::JpegDecoder decoder;
+    Network::PixelFormat format = jpeg_format(bpp);
+
+    framebuffer.assign((size_t)JPEG_WIDTH * JPEG_HEIGHT * bpp, 0);
+
+    int frames = 0;
+    double start = now();
+    double elapsed = 0;
+
+    do
+    {
+      if (!decoder.decode((const unsigned char*)jpeg.data(), jpeg.size(), JPEG_WIDTH, JPEG_HEIGHT, format,
+        &framebuffer[0], (size_t)JPEG_WIDTH * bpp, JPEG_WIDTH, JPEG_HEIGHT))
+      {
+        printf("%-40s decoding failed\n", name);
+        return 0;
+      }
+
+      ++frames;
+      elapsed = now() - start;
+    }
+    while (elapsed < seconds);
+
+    double frame = elapsed / frames;
+
+    printf("%-40s %8.1f KB/frame %7.2f ms/frame %8.1f Mpixels/s", name, jpeg.size() / 1024.0, frame * 1000.0,
+      (double)JPEG_WIDTH * JPEG_HEIGHT / frame / 1e6);
+
+    return frame;
+  }
+
+  // Frame in bands of Tight JPEG rectangles, fed to decoder in receive sized chunks.
+  static void measure_tight_jpeg(const std::vector<unsigned char>& rgb, int h, int v, double seconds)
+  {
+    JpegEncoder encoder(JPEG_QUALITY, h, v);
+
+    std::vector<Network::RectHeader> headers;
+    std::vector<std::string> rects;
+    double bytes = 0;
+
+    for (int top = 0; top < JPEG_HEIGHT; top += JPEG_BAND)
+    {
+      int height = std::min(JPEG_BAND, JPEG_HEIGHT - top);
+      std::string jpeg = encoder.encode(&rgb[(size_t)top * JPEG_WIDTH * 3], (size_t)JPEG_WIDTH * 3, JPEG_WIDTH, height);
+
+      std::string data(1, (char)0x90);
+      size_t length = jpeg.size();
+
+      data += (char)((length & 0x7f) | (length > 0x7f ? 0x80 : 0));
+
+      if (length > 0x7f)
+      {
+        data += (char)(((length >> 7) & 0x7f) | (length > 0x3fff ? 0x80 : 0));
+
+        if (length > 0x3fff)
+          data += (char)(length >> 14);
+      }
+
+      data += jpeg;
+
+      Network::RectHeader header = { 0, top, JPEG_WIDTH, height, Network::VncClient::encoding_tight };
+
+      headers.push_back(header);
+      rects.push_back(data);
+
+      bytes += data.size();
+    }
+
+    std::vector<char> framebuffer((size_t)JPEG_WIDTH * JPEG_HEIGHT * 4);
+    Network::ReceiveBuffer input;
+
+    Network::DecodeContext context;
+    memset(&context, 0, sizeof(context));
+
+    context.input = &input;
+    context.format = jpeg_format(4);
+    context.framebuffer = &framebuffer[0];
+    context.width = JPEG_WIDTH;
+    context.height = JPEG_HEIGHT;
+    context.stride = (size_t)JPEG_WIDTH * 4;
+
+    std::unique_ptr<Network::RectDecoder> decoder(Network::RectDecoder::create(Network::VncClient::encoding_tight));
+
+    int frames = 0;
+    double start = now();
+    double elapsed = 0;
+
+    do
+    {
+      for (size_t i = 0; i < rects.size(); ++i)
+      {
+        Network::RectDecoder::Result result = Network::RectDecoder::decode_incomplete;
+
+        for (size_t appended = 0; result == Network::RectDecoder::decode_incomplete && appended < rects[i].size();)
+        {
+          size_t length = std::min((size_t)JPEG_CHUNK, rects[i].size() - appended);
+
+          input.append(rects[i].data() + appended, length);
+          appended += length;
+
+          result = decoder->decode(context, headers[i]);
+        }
+
+        if (result != Network::RectDecoder::decode_done || !input.empty())
+        {
+          printf("Tight JPEG decoding failed\n");
+          return;
+        }
+      }
+
+      ++frames;
+      elapsed = now() - start;
+    }
+    while (elapsed < seconds);
+
+    char name[64];
+    sprintf(name, "Tight JPEG %d rows %dx%d", JPEG_BAND, h, v);
+
+    printf("%-40s %8.1f KB/frame %7.2f ms/frame %8.1f Mpixels/s PSNR %.1f dB\n", name, bytes / 1024.0,
+      elapsed / frames * 1000.0, (double)JPEG_WIDTH * JPEG_HEIGHT * frames / elapsed / 1e6, psnr(framebuffer, rgb, false));
+  }
+
+#if defined(BENCHMARK_LIBJPEG)
+  // Same image decoded by libjpeg into the same pixels, with the same integer transform and plain upsampling.
+  static double measure_libjpeg(const std::string& jpeg, double seconds, std::vector<char>& framebuffer)
+  {
+    framebuffer.assign((size_t)JPEG_WIDTH * JPEG_HEIGHT * 4, 0);
+
+    int frames = 0;
+    double start = now();
+    double elapsed = 0;
+
+    do
+    {
+      jpeg_decompress_struct decompress;
+      jpeg_error_mgr error;
+
+      decompress.err = jpeg_std_error(&error);
+      jpeg_create_decompress(&decompress);
+      jpeg_mem_src(&decompress, (unsigned char*)jpeg.data(), jpeg.size());
+      jpeg_read_header(&decompress, TRUE);
+
+      decompress.out_color_space = JCS_EXT_BGRX;
+      decompress.dct_method = JDCT_ISLOW;
+      decompress.do_fancy_upsampling = FALSE;
+
+      jpeg_start_decompress(&decompress);
+
+      while (decompress.output_scanline < decompress.output_height)
+      {
+        JSAMPROW row = (JSAMPROW)&framebuffer[(size_t)decompress.output_scanline * JPEG_WIDTH * 4];
+
+        jpeg_read_scanlines(&decompress, &row, 1);
+      }
+
+      jpeg_finish_decompress(&decompress);
+      jpeg_destroy_decompress(&decompress);
+
+      ++frames;
+      elapsed = now() - start;
+    }
+    while (elapsed < seconds);
+
+    return elapsed / frames;
+  }
+#endif
+
+  int run_jpeg(int argc, char** argv)
+  {
+    double seconds = argc > 0 ? atof(argv[0]) : 1.0;
+
+    std::vector<unsigned char> rgb = photo_scene();
+
+    static const int samplings[][2] = { { 1, 1 }, { 2, 1 }, { 2, 2 }, { 0, 0 } };
+
+    for (size_t s = 0; s < sizeof(samplings) / sizeof(samplings[0]); ++s)
+    {
+      int h = samplings[s][0];
+      int v = samplings[s][1];
+
+      JpegEncoder encoder(JPEG_QUALITY, h, v);
+      std::string jpeg = encoder.encode(&rgb[0], (size_t)JPEG_WIDTH * 3, JPEG_WIDTH, JPEG_HEIGHT);
+
+      char name[64];
+
+      if (h)
+        sprintf(name, "JPEG %dx%d sampling 4 bpp", h, v);
+      else
+        sprintf(name, "JPEG grayscale 4 bpp");
+
+      std::vector<char> framebuffer;
+      double frame = measure_jpeg(name, jpeg, 4, seconds, framebuffer);
+
+      if (!frame)
+        continue;
+
+      printf(" PSNR %.1f dB\n", psnr(framebuffer, rgb, !h));
+
+#if defined(BENCHMARK_LIBJPEG)
+      std::vector<char> reference;
+      double reference_frame = measure_libjpeg(jpeg, seconds, reference);
+
+      int difference = 0;
+
+      for (size_t i = 0; i < reference.size(); ++i)
+      {
+        if (i % 4 != 3)
+          difference = std::max(difference, abs((unsigned char)reference[i] - (unsigned char)framebuffer[i]));
+      }
+
+      printf("%-40s %26.2f ms/frame %8.1f Mpixels/s %.2fx time, difference up to %d\n", "  libjpeg", reference_frame * 1000.0,
+        (double)JPEG_WIDTH * JPEG_HEIGHT / reference_frame / 1e6, frame / reference_frame, difference);
+#endif
+
+      if (h == 2 && v == 2)
+      {
+        sprintf(name, "JPEG %dx%d sampling 2 bpp", h, v);
+
+        if (measure_jpeg(name, jpeg, 2, seconds, framebuffer))
+          printf("\n");
+      }
+    }
+
+    measure_tight_jpeg(rgb, 2, 2, seconds);
+
+    return 0;
+  }
+}
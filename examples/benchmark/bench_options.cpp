@@ -0,0 +1,145 @@
+#include "benchmark.hpp"
+#include "stand_in_server.hpp"
+
+#include "../../src/vnc_client.hpp"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace Benchmark
+{
+#	define INPUT_SAMPLES 2000
+#	define FRAME_WIDTH 1920
+#	define FRAME_HEIGHT 1080
+
+  static bool connect(Network::VncClient& client)
+  {
+    double start = now();
+
+    while (!client.connected() && now() - start < 10.0)
+    {
+      if (!client.update(0.1f))
+        return false;
+    }
+
+    client.set_keep_framebuffer(true);
+
+    return client.connected();
+  }
+
+  // Round trip of key press answered by server with small update, as seen by keypad user.
+  static void measure_input(const char* name, const Network::SocketOptions& options)
+  {
+    StandInServer server(64, 64);
+    if (!server.start())
+      return;
+
+    char pixel[4] = { 1, 2, 3, 4 };
+    std::string reply = StandInServer::raw_update(0, 0, 1, 1, pixel);
+
+    server.set_handler([&](int connection, const char* message, size_t)
+    {
+      if (message[0] == 4 && message[1])
+        server.send(connection, reply);
+    });
+
+    Network::VncClient client("127.0.0.1", server.port(), Network::RawStream::transport_poll, options);
+    if (!connect(client))
+    {
+      printf("Could not connect.\n");
+      return;
+    }
+
+    std::vector<double> latency;
+
+    for (int i = 0; i < INPUT_SAMPLES; ++i)
+    {
+      int version = client.framebuffer_version();
+      double sent = now();
+
+      client.send_key('a', true);
+      client.send_key('a', false);
+
+      while (client.framebuffer_version() == version && now() - sent < 5.0)
+        client.update(1.0f);
+
+      latency.push_back(now() - sent);
+    }
+
+    std::sort(latency.begin(), latency.end());
+
+    printf("%-14s input round trip: median %7.1f us, p99 %7.1f us\n", name,
+      latency[latency.size() / 2] * 1e6, latency[latency.size() * 99 / 100] * 1e6);
+
+    server.stop();
+  }
+
+  // Full screen RAW frames, one after another, as in screen capture.
+  static void measure_frames(const char* name, const Network::SocketOptions& options, double seconds)
+  {
+    StandInServer server(FRAME_WIDTH, FRAME_HEIGHT);
+    if (!server.start())
+      return;
+
+    std::string pixels(FRAME_WIDTH * FRAME_HEIGHT * 4, 7);
+    std::string frame = StandInServer::raw_update(0, 0, FRAME_WIDTH, FRAME_HEIGHT, pixels.data());
+
+    Network::VncClient client("127.0.0.1", server.port(), Network::RawStream::transport_poll, options);
+    if (!connect(client))
+    {
+      printf("Could not connect.\n");
+      return;
+    }
+
+    double start = now();
+    int frames = 0;
+
+    while (now() - start < seconds)
+    {
+      int version = client.framebuffer_version();
+
+      server.send(0, frame);
+
+      while (client.framebuffer_version() == version && client.update(1.0f))
+        ;
+
+      ++frames;
+    }
+
+    double elapsed = now() - start;
+
+    printf("%-14s frames: %6.1f frames/s %8.1f MB/s\n", name, frames / elapsed, frames * (double)frame.size() / elapsed / (1024.0 * 1024.0));
+
+    server.stop();
+  }
+
+  int run_options(int argc, char** argv)
+  {
+    double seconds = argc > 0 ? atof(argv[0]) : 2.0;
+
+    Network::initialize();
+
+    struct Preset
+    {
+      const char* name;
+      Network::SocketOptions options;
+    };
+
+    Preset presets[] = {
+      { "default", Network::SocketOptions() },
+      { "low_latency", Network::SocketOptions::low_latency() },
+      { "bulk_transfer", Network::SocketOptions::bulk_transfer() },
+    };
+
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i)
+      measure_input(presets[i].name, presets[i].options);
+
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i)
+      measure_frames(presets[i].name, presets[i].options, seconds);
+
+    return 0;
+  }
+}
@@ -0,0 +1,184 @@
+#include "benchmark.hpp"
+#include "stand_in_server.hpp"
+
+#include "../../src/session_reactor.hpp"
+#include "../../src/vnc_client.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace Benchmark
+{
+#	define LATENCY_SAMPLES 500
+#	define LOAD_UPDATES_PER_SECOND 10
+#	define HANDSHAKE_DEADLINE 0.5f
+
+  // Sessions are connected to stand-in server, then reactor thread CPU time is measured while idle
+  // and while every session receives small updates, and latency of single update delivery is sampled.
+  // Finally as many sessions connect to a hung server, and are failed by their handshake deadline.
+  int run_reactor(int argc, char** argv)
+  {
+    int sessions = argc > 0 ? atoi(argv[0]) : 1000;
+    double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+    StandInServer server(64, 64);
+    if (!server.start())
+    {
+      printf("Could not start stand-in server.\n");
+      return 1;
+    }
+
+    Network::initialize();
+
+    Network::SessionReactor reactor;
+    std::vector<Network::VncClient*> clients;
+
+    for (int i = 0; i < sessions; ++i)
+    {
+      clients.push_back(new Network::VncClient("127.0.0.1", server.port()));
+      clients.back()->set_keep_framebuffer(true);
+
+      reactor.add(clients.back());
+    }
+
+    // Connect everything.
+    double start = now();
+    int connected = 0;
+
+    while (now() - start < 60.0)
+    {
+      reactor.run(0.1);
+
+      connected = 0;
+      for (int i = 0; i < sessions; ++i)
+        connected += clients[i]->connected() ? 1 : 0;
+
+      if (connected == sessions)
+        break;
+    }
+
+    printf("%d of %d sessions connected in %.2f s\n", connected, sessions, now() - start);
+
+    // Map server connection index to client, using desktop name.
+    std::vector<Network::VncClient*> by_connection(sessions);
+    for (int i = 0; i < sessions; ++i)
+    {
+      int index = atoi(clients[i]->desktop_name() + strlen("session-"));
+      if (index >= 0 && index < sessions)
+        by_connection[index] = clients[i];
+    }
+
+    // Idle.
+    double cpu = thread_time();
+    start = now();
+
+    while (now() - start < seconds)
+      reactor.run((float)(seconds - (now() - start)));
+
+    printf("idle: reactor thread CPU %.3f%%\n", 100.0 * (thread_time() - cpu) / (now() - start));
+
+    // Wakeup latency, time from server queueing single update to client applying it.
+    char pixel[4] = { 1, 2, 3, 4 };
+    std::string update = StandInServer::raw_update(0, 0, 1, 1, pixel);
+
+    std::vector<double> latency;
+
+    for (int i = 0; i < LATENCY_SAMPLES && connected; ++i)
+    {
+      int connection = (int)((i * 7919LL) % sessions);
+      Network::VncClient* client = by_connection[connection];
+      if (!client || !client->connected())
+        continue;
+
+      int version = client->framebuffer_version();
+      double sent = now();
+
+      server.send(connection, update);
+
+      while (client->framebuffer_version() == version && now() - sent < 5.0)
+        reactor.run(1.0f);
+
+      latency.push_back(now() - sent);
+    }
+
+    if (!latency.empty())
+    {
+      std::sort(latency.begin(), latency.end());
+      printf("wakeup latency: median %.1f us, p99 %.1f us\n", latency[latency.size() / 2] * 1e6, latency[latency.size() * 99 / 100] * 1e6);
+    }
+
+    // Load, every session gets small updates at fixed rate.
+    cpu = thread_time();
+    start = now();
+
+    double next = start;
+    int rounds = 0;
+
+    while (now() - start < seconds)
+    {
+      if (now() >= next)
+      {
+        server.send_all(update);
+
+        next += 1.0 / LOAD_UPDATES_PER_SECOND;
+        ++rounds;
+      }
+
+      reactor.run((float)std::max(0.0, next - now()));
+    }
+
+    double load = (thread_time() - cpu) / (now() - start);
+
+    printf("load: %d updates/s per session, reactor thread CPU %.2f%%, %.0f sessions per core\n",
+      LOAD_UPDATES_PER_SECOND, 100.0 * load, load > 0 ? sessions / load : 0.0);
+
+    for (int i = 0; i < sessions; ++i)
+      delete clients[i];
+
+    server.stop();
+
+    // Hung hosts.
+    StandInServer hung(64, 64);
+    hung.set_hung(true);
+
+    if (hung.start())
+    {
+      clients.clear();
+
+      for (int i = 0; i < sessions; ++i)
+      {
+        clients.push_back(new Network::VncClient("127.0.0.1", hung.port()));
+        clients.back()->set_deadlines(0, HANDSHAKE_DEADLINE, 0);
+
+        reactor.add(clients.back());
+      }
+
+      cpu = thread_time();
+      start = now();
+
+      int failed = 0;
+
+      while (failed < sessions && now() - start < 10.0)
+      {
+        reactor.run(1.0f);
+
+        failed = 0;
+        for (int i = 0; i < sessions; ++i)
+          failed += clients[i]->error_code() ? 1 : 0;
+      }
+
+      printf("hung: %d of %d sessions failed in %.2f s with %.1f s handshake deadline, reactor thread CPU %.2f%%\n",
+        failed, sessions, now() - start, HANDSHAKE_DEADLINE, 100.0 * (thread_time() - cpu) / (now() - start));
+
+      for (int i = 0; i < sessions; ++i)
+        delete clients[i];
+
+      hung.stop();
+    }
+
+    return 0;
+  }
+}
@@ -0,0 +1,132 @@
+#include "benchmark.hpp"
+#include "stand_in_server.hpp"
+
+#include "../../src/vnc_client.hpp"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Benchmark
+{
+#	define RECONNECT_WIDTH 64
+#	define RECONNECT_HEIGHT 64
+
+  static void report_recovery(const char* name, std::vector<double>& recovery)
+  {
+    if (recovery.empty())
+      return;
+
+    std::sort(recovery.begin(), recovery.end());
+
+    printf("%-10s drop to fresh framebuffer: median %7.1f us, p99 %7.1f us\n", name,
+      recovery[recovery.size() / 2] * 1e6, recovery[recovery.size() * 99 / 100] * 1e6);
+  }
+
+  static bool wait_for_frame(Network::VncClient& client, int version)
+  {
+    double start = now();
+
+    while (client.framebuffer_version() == version && now() - start < 5.0)
+    {
+      if (!client.update(1.0f))
+        return false;
+    }
+
+    return client.framebuffer_version() != version;
+  }
+
+  // Recovery is time from server dropping the connection until the client has fresh framebuffer again,
+  // either by building new client, as applications had to, or by reconnecting existing one.
+  int run_reconnect(int argc, char** argv)
+  {
+    int samples = argc > 0 ? atoi(argv[0]) : 200;
+
+    Network::initialize();
+
+    std::vector<char> pixels(RECONNECT_WIDTH * RECONNECT_HEIGHT * 4, 0x55);
+    std::string frame = StandInServer::raw_update(0, 0, RECONNECT_WIDTH, RECONNECT_HEIGHT, &pixels[0]);
+
+    StandInServer server(RECONNECT_WIDTH, RECONNECT_HEIGHT);
+    if (!server.start())
+      return 1;
+
+    std::atomic<int> connection(-1);
+
+    server.set_handler([&](int index, const char* message, size_t)
+    {
+      if (message[0] == 3)
+      {
+        connection = index;
+        server.send(index, frame);
+      }
+    });
+
+    std::vector<double> recovery;
+    std::unique_ptr<Network::VncClient> previous;
+
+    for (int i = 0; i <= samples; ++i)
+    {
+      double start = now();
+
+      // Application notices the error, and builds new client.
+      if (previous)
+      {
+        server.drop(connection);
+
+        while (previous->update(1.0f))
+          ;
+      }
+
+      previous.reset(new Network::VncClient("127.0.0.1", server.port()));
+      previous->set_keep_framebuffer(true);
+      previous->request_screen(false, 0, 0, RECONNECT_WIDTH, RECONNECT_HEIGHT);
+
+      if (!wait_for_frame(*previous, 0))
+        break;
+
+      if (i)
+        recovery.push_back(now() - start);
+    }
+
+    previous.reset();
+
+    report_recovery("new client", recovery);
+
+    recovery.clear();
+
+    Network::VncClient client("127.0.0.1", server.port());
+    client.set_keep_framebuffer(true);
+    client.set_reconnect(-1);
+
+    // Request is held until session is set up.
+    client.request_screen(false, 0, 0, RECONNECT_WIDTH, RECONNECT_HEIGHT);
+
+    if (wait_for_frame(client, 0))
+    {
+      for (int i = 0; i < samples; ++i)
+      {
+        int version = client.framebuffer_version();
+        double start = now();
+
+        server.drop(connection);
+
+        if (!wait_for_frame(client, version))
+          break;
+
+        recovery.push_back(now() - start);
+      }
+    }
+
+    report_recovery("reconnect", recovery);
+
+    printf("reconnects %llu\n", client.statistics().reconnects);
+
+    server.stop();
+
+    return 0;
+  }
+}
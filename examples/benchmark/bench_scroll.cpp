@@ -0,0 +1,135 @@
+#include "benchmark.hpp"
+#include "stand_in_server.hpp"
+
+#include "../../src/vnc_client.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace Benchmark
+{
+#	define SCROLL_WIDTH 1280
+#	define SCROLL_HEIGHT 720
+#	define SCROLL_STEP 16
+
+  // Document taller than the screen, every row of it distinct.
+  static void document_rows(std::vector<char>& pixels, int first, int rows)
+  {
+    pixels.resize((size_t)rows * SCROLL_WIDTH * 4);
+
+    for (int row = 0; row < rows; ++row)
+    {
+      for (int x = 0; x < SCROLL_WIDTH; ++x)
+      {
+        unsigned int value = (unsigned int)(first + row) * 2654435761u + x * 40503u;
+        memcpy(&pixels[((size_t)row * SCROLL_WIDTH + x) * 4], &value, 4);
+      }
+    }
+  }
+
+  // Scrolls document down and back up by SCROLL_STEP rows per frame. With CopyRect, server moves
+  // what stays on screen and sends only newly exposed rows, otherwise whole screen is sent again.
+  static void measure_scroll(const char* name, bool copy_rect, int frames)
+  {
+    StandInServer server(SCROLL_WIDTH, SCROLL_HEIGHT);
+    if (!server.start())
+      return;
+
+    Network::VncClient client("127.0.0.1", server.port());
+    client.set_keep_framebuffer(true);
+
+    if (copy_rect)
+      client.set_encodings({ Network::VncClient::encoding_copy_rect, Network::VncClient::encoding_raw });
+
+    double start = now();
+
+    while (!client.connected() && now() - start < 10.0)
+    {
+      if (!client.update(0.1f))
+        break;
+    }
+
+    if (!client.connected())
+    {
+      printf("Could not connect.\n");
+      return;
+    }
+
+    std::vector<char> pixels;
+    document_rows(pixels, 0, SCROLL_HEIGHT);
+    server.send(0, StandInServer::raw_update(0, 0, SCROLL_WIDTH, SCROLL_HEIGHT, &pixels[0]));
+
+    while (client.framebuffer_version() == 0 && client.update(1.0f))
+      ;
+
+    unsigned long long bytes = server.bytes_sent();
+    int top = 0;
+    int version = client.framebuffer_version();
+    bool valid = true;
+
+    start = now();
+
+    for (int i = 0; i < frames; ++i)
+    {
+      int step = i < frames / 2 ? SCROLL_STEP : -SCROLL_STEP;
+      int kept = SCROLL_HEIGHT - SCROLL_STEP;
+
+      top += step;
+
+      if (!copy_rect)
+      {
+        document_rows(pixels, top, SCROLL_HEIGHT);
+        server.send(0, StandInServer::raw_update(0, 0, SCROLL_WIDTH, SCROLL_HEIGHT, &pixels[0]));
+      }
+      else if (step > 0)
+      {
+        document_rows(pixels, top + kept, SCROLL_STEP);
+        server.send(0, StandInServer::copy_rect_update(0, 0, SCROLL_WIDTH, kept, 0, SCROLL_STEP) +
+          StandInServer::raw_update(0, kept, SCROLL_WIDTH, SCROLL_STEP, &pixels[0]));
+      }
+      else
+      {
+        document_rows(pixels, top, SCROLL_STEP);
+        server.send(0, StandInServer::copy_rect_update(0, SCROLL_STEP, SCROLL_WIDTH, kept, 0, 0) +
+          StandInServer::raw_update(0, 0, SCROLL_WIDTH, SCROLL_STEP, &pixels[0]));
+      }
+
+      version += copy_rect ? 2 : 1;
+
+      while (client.framebuffer_version() < version && client.update(1.0f))
+        ;
+
+      if (client.framebuffer_version() < version)
+      {
+        valid = false;
+        break;
+      }
+    }
+
+    double elapsed = now() - start;
+
+    // Client framebuffer has to match the document where scrolling ended.
+    document_rows(pixels, top, SCROLL_HEIGHT);
+    valid = valid && memcmp(client.framebuffer(), &pixels[0], pixels.size()) == 0;
+
+    printf("%-10s %5d frames: %10.1f KB/frame %8.1f frames/s %s\n", name, frames,
+      (server.bytes_sent() - bytes) / 1024.0 / frames, frames / elapsed, valid ? "" : "framebuffer mismatch");
+
+    server.stop();
+  }
+
+  int run_scroll(int argc, char** argv)
+  {
+    int frames = argc > 0 ? atoi(argv[0]) : 400;
+
+    Network::initialize();
+
+    measure_scroll("raw", false, frames);
+    measure_scroll("copy rect", true, frames);
+
+    return 0;
+  }
+}
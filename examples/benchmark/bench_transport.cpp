@@ -0,0 +1,122 @@
+#include "benchmark.hpp"
+#include "stand_in_server.hpp"
+
+#include "../../src/session_reactor.hpp"
+#include "../../src/vnc_client.hpp"
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+namespace Benchmark
+{
+  // Every round sends one update to all sessions and runs reactor until each of them applied it.
+  static void measure(Network::RawStream::Transport transport, bool pair, int sessions, int size, double seconds)
+  {
+    StandInServer server(64, 64);
+    if (!server.start())
+    {
+      printf("Could not start stand-in server.\n");
+      return;
+    }
+
+    Network::SessionReactor reactor;
+    std::vector<Network::VncClient*> clients;
+
+    for (int i = 0; i < sessions; ++i)
+    {
+      if (pair)
+        clients.push_back(new Network::VncClient(server.connect_pair(), transport));
+      else
+        clients.push_back(new Network::VncClient("127.0.0.1", server.port(), transport));
+      clients.back()->set_keep_framebuffer(true);
+
+      reactor.add(clients.back());
+    }
+
+    double start = now();
+    int connected = 0;
+
+    while (connected < sessions && now() - start < 60.0)
+    {
+      reactor.run(0.1f);
+
+      connected = 0;
+      for (int i = 0; i < sessions; ++i)
+        connected += clients[i]->connected() ? 1 : 0;
+    }
+
+    std::string pixels(size * size * 4, 7);
+    std::string update = StandInServer::raw_update(0, 0, size, size, pixels.data());
+
+    std::vector<int> versions(sessions);
+    unsigned long long calls = 0;
+    for (int i = 0; i < sessions; ++i)
+      calls += clients[i]->statistics().receive_calls;
+
+    double cpu = thread_time();
+    start = now();
+
+    long long updates = 0;
+
+    while (connected == sessions && now() - start < seconds)
+    {
+      for (int i = 0; i < sessions; ++i)
+        versions[i] = clients[i]->framebuffer_version();
+
+      server.send_all(update);
+
+      for (int i = 0; i < sessions; )
+      {
+        if (clients[i]->framebuffer_version() != versions[i] || !clients[i]->connected())
+          ++i;
+        else
+          reactor.run(1.0f);
+      }
+
+      updates += sessions;
+    }
+
+    double elapsed = now() - start;
+    cpu = thread_time() - cpu;
+
+    unsigned long long receive_calls = 0;
+    for (int i = 0; i < sessions; ++i)
+      receive_calls += clients[i]->statistics().receive_calls;
+
+    receive_calls -= calls;
+
+    printf("%-8s %-8s %5d sessions %3dx%-3d %10.0f updates/s %8.1f MB/s %6.2f us CPU/update %6.2f receives/update\n",
+      clients[0]->transport() == Network::RawStream::transport_io_uring ? "io_uring" : "poll", pair ? "unix" : "loopback",
+      sessions, size, size, updates / elapsed, updates * (double)update.size() / elapsed / (1024.0 * 1024.0),
+      updates ? cpu * 1e6 / updates : 0.0, updates ? (double)receive_calls / updates : 0.0);
+
+    for (int i = 0; i < sessions; ++i)
+      delete clients[i];
+
+    server.stop();
+  }
+
+  int run_transport(int argc, char** argv)
+  {
+    double seconds = argc > 0 ? atof(argv[0]) : 2.0;
+
+    Network::initialize();
+
+    static const int sessions[] = { 1, 100, 1000 };
+    static const int sizes[] = { 1, 64 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+      for (size_t i = 0; i < sizeof(sessions) / sizeof(sessions[0]); ++i)
+      {
+        measure(Network::RawStream::transport_poll, false, sessions[i], sizes[s], seconds);
+        measure(Network::RawStream::transport_io_uring, false, sessions[i], sizes[s], seconds);
+        measure(Network::RawStream::transport_poll, true, sessions[i], sizes[s], seconds);
+      }
+    }
+
+    return 0;
+  }
+}
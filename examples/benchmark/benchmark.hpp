@@ -0,0 +1,39 @@
+#ifndef header_8e1f2c55_7a7d_4f43_9d0b_3c6a0e5f7b21
+#define header_8e1f2c55_7a7d_4f43_9d0b_3c6a0e5f7b21
+
+#include <stdio.h>
+#include <time.h>
+
+#include <chrono>
+
+namespace Benchmark
+{
+  inline double now()
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  inline double thread_time()
+  {
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+  }
+
+  inline void report(const char* name, double seconds, double bytes)
+  {
+    printf("%-40s %10.2f ms %10.1f MB/s\n", name, seconds * 1000.0, seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0.0);
+  }
+
+  int run_buffer(int argc, char** argv);
+  int run_reactor(int argc, char** argv);
+  int run_transport(int argc, char** argv);
+  int run_options(int argc, char** argv);
+  int run_input(int argc, char** argv);
+  int run_reconnect(int argc, char** argv);
+  int run_scroll(int argc, char** argv);
+  int run_decode(int argc, char** argv);
+  int run_jpeg(int argc, char** argv);
+}
+
+#endif
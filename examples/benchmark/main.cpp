@@ -0,0 +1,37 @@
+#include "benchmark.hpp"
+
+#include <string.h>
+
+struct Entry
+{
+  const char* name;
+  const char* description;
+  int (*run)(int argc, char** argv);
+};
+
+static const Entry entries[] = {
+  { "buffer", "receive buffer consume cost, std::string versus ring buffer", Benchmark::run_buffer },
+  { "reactor", "[sessions] [seconds], idle cost, wakeup latency and load of sessions on one reactor", Benchmark::run_reactor },
+  { "transport", "[seconds], poll versus io_uring transport and socket pairs at 1, 100 and 1000 sessions", Benchmark::run_transport },
+  { "options", "[seconds], input latency and frame throughput of socket option presets", Benchmark::run_options },
+  { "input", "[samples], keystroke to wire latency with queued and direct send", Benchmark::run_input },
+  { "reconnect", "[samples], recovery from dropped connection, new client versus automatic reconnect", Benchmark::run_reconnect },
+  { "scroll", "[frames], bytes on the wire and frame rate of scrolling with RAW versus CopyRect", Benchmark::run_scroll },
+  { "decode", "[seconds] [workers], rectangle fill kernel and decoder throughput on synthetic updates", Benchmark::run_decode },
+  { "jpeg", "[seconds], JPEG decoder on a photo, whole frame and as Tight rectangles", Benchmark::run_jpeg },
+};
+
+int main(int argc, char** argv)
+{
+  for (size_t i = 0; argc >= 2 && i < sizeof(entries) / sizeof(entries[0]); ++i)
+  {
+    if (strcmp(argv[1], entries[i].name) == 0)
+      return entries[i].run(argc - 2, argv + 2);
+  }
+
+  printf("Usage: benchmark name [arguments]\n");
+  for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); ++i)
+    printf("  %-12s %s\n", entries[i].name, entries[i].description);
+
+  return 1;
+}
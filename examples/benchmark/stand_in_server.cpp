@@ -0,0 +1,462 @@
+#include "stand_in_server.hpp"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace Benchmark
+{
+  enum Stage
+  {
+    stage_version,
+    stage_security,
+    stage_client_init,
+    stage_messages
+  };
+
+  static void put16(std::string& s, int v)
+  {
+    s += (char)((v >> 8) & 0xff);
+    s += (char)(v & 0xff);
+  }
+
+  static void put32(std::string& s, unsigned int v)
+  {
+    put16(s, (int)(v >> 16));
+    put16(s, (int)(v & 0xffff));
+  }
+
+  static unsigned int get16(const std::string& s, size_t offset)
+  {
+    return ((unsigned char)s[offset] << 8) | (unsigned char)s[offset + 1];
+  }
+
+  static unsigned int get32(const std::string& s, size_t offset)
+  {
+    return (get16(s, offset) << 16) | get16(s, offset + 2);
+  }
+
+  static void set_nonblocking(int socket)
+  {
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+  }
+
+  StandInServer::StandInServer(int width, int height)
+    : _width(width), _height(height), _listen(-1), _hung(false)
+  {
+    _stop = false;
+    _initialized = 0;
+    _bytes_sent = 0;
+    _wakeup[0] = _wakeup[1] = -1;
+  }
+
+  StandInServer::~StandInServer()
+  {
+    stop();
+  }
+
+  bool StandInServer::start()
+  {
+    _listen = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (_listen < 0)
+      return false;
+
+    int reuse = 1;
+    setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t length = sizeof(address);
+    if (bind(_listen, (sockaddr*)&address, sizeof(address)) != 0 || listen(_listen, 8192) != 0 || getsockname(_listen, (sockaddr*)&address, &length) != 0)
+      return false;
+
+    char port[16];
+    sprintf(port, "%d", ntohs(address.sin_port));
+    _port = port;
+
+    if (pipe(_wakeup) != 0)
+      return false;
+
+    set_nonblocking(_listen);
+    set_nonblocking(_wakeup[0]);
+    set_nonblocking(_wakeup[1]);
+
+    _thread = std::thread(&StandInServer::run, this);
+
+    return true;
+  }
+
+  void StandInServer::stop()
+  {
+    if (_thread.joinable())
+    {
+      _stop = true;
+
+      char signal = 1;
+      if (::write(_wakeup[1], &signal, 1) < 0)
+        perror("write");
+
+      _thread.join();
+    }
+
+    for (size_t i = 0; i < _connections.size(); ++i)
+    {
+      if (_connections[i].socket >= 0)
+        ::close(_connections[i].socket);
+    }
+    _connections.clear();
+
+    for (size_t i = 0; i < _adopted.size(); ++i)
+      ::close(_adopted[i]);
+    _adopted.clear();
+
+    if (_listen >= 0)
+      ::close(_listen);
+    if (_wakeup[0] >= 0)
+      ::close(_wakeup[0]);
+    if (_wakeup[1] >= 0)
+      ::close(_wakeup[1]);
+
+    _listen = _wakeup[0] = _wakeup[1] = -1;
+  }
+
+  void StandInServer::send(int connection, const std::string& data)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      _queued.push_back(std::make_pair(connection, data));
+    }
+
+    char signal = 1;
+    if (::write(_wakeup[1], &signal, 1) < 0 && errno != EAGAIN)
+      perror("write");
+  }
+
+  int StandInServer::connect_pair()
+  {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+      return -1;
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      _adopted.push_back(sockets[1]);
+    }
+
+    char signal = 1;
+    if (::write(_wakeup[1], &signal, 1) < 0 && errno != EAGAIN)
+      perror("write");
+
+    return sockets[0];
+  }
+
+  void StandInServer::drop(int connection)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      _dropped.push_back(connection);
+    }
+
+    char signal = 1;
+    if (::write(_wakeup[1], &signal, 1) < 0 && errno != EAGAIN)
+      perror("write");
+  }
+
+  void StandInServer::send_all(const std::string& data)
+  {
+    send(-1, data);
+  }
+
+  std::string StandInServer::raw_update(int x, int y, int width, int height, const char* pixels)
+  {
+    std::string s;
+    s += (char)0;
+    s += (char)0;
+    put16(s, 1);
+
+    put16(s, x);
+    put16(s, y);
+    put16(s, width);
+    put16(s, height);
+    put32(s, 0);
+
+    s.append(pixels, pixels + width * height * 4);
+
+    return s;
+  }
+
+  std::string StandInServer::copy_rect_update(int x, int y, int width, int height, int source_x, int source_y)
+  {
+    std::string s;
+    s += (char)0;
+    s += (char)0;
+    put16(s, 1);
+
+    put16(s, x);
+    put16(s, y);
+    put16(s, width);
+    put16(s, height);
+    put32(s, 1);
+
+    put16(s, source_x);
+    put16(s, source_y);
+
+    return s;
+  }
+
+  void StandInServer::run()
+  {
+    std::vector<pollfd> fds;
+    std::vector<std::pair<int, std::string> > queued;
+
+    while (!_stop)
+    {
+      fds.resize(_connections.size() + 2);
+
+      fds[0].fd = _listen;
+      fds[0].events = POLLIN;
+      fds[1].fd = _wakeup[0];
+      fds[1].events = POLLIN;
+
+      for (size_t i = 0; i < _connections.size(); ++i)
+      {
+        fds[i + 2].fd = _connections[i].socket;
+        fds[i + 2].events = POLLIN | (_connections[i].out.size() > _connections[i].out_offset ? POLLOUT : 0);
+      }
+
+      for (size_t i = 0; i < fds.size(); ++i)
+        fds[i].revents = 0;
+
+      if (::poll(&fds[0], fds.size(), -1) < 0 && errno != EINTR)
+        break;
+
+      if (fds[1].revents)
+      {
+        char signals[256];
+        while (::read(_wakeup[0], signals, sizeof(signals)) > 0)
+          ;
+
+        std::vector<int> adopted, dropped;
+
+        {
+          std::lock_guard<std::mutex> lock(_lock);
+          queued.swap(_queued);
+          adopted.swap(_adopted);
+          dropped.swap(_dropped);
+        }
+
+        for (size_t i = 0; i < adopted.size(); ++i)
+          add(adopted[i]);
+
+        // Closed connections keep their index, poll skips negative descriptors.
+        for (size_t i = 0; i < dropped.size(); ++i)
+        {
+          if (dropped[i] >= 0 && dropped[i] < (int)_connections.size() && _connections[dropped[i]].socket >= 0)
+          {
+            ::close(_connections[dropped[i]].socket);
+            _connections[dropped[i]].socket = -1;
+          }
+        }
+
+        for (size_t i = 0; i < queued.size(); ++i)
+        {
+          for (size_t c = 0; c < _connections.size(); ++c)
+          {
+            if ((queued[i].first < 0 || queued[i].first == (int)c) && _connections[c].socket >= 0)
+            {
+              _connections[c].out += queued[i].second;
+              transmit(_connections[c]);
+            }
+          }
+        }
+
+        queued.clear();
+      }
+
+      for (size_t i = 0; i < _connections.size(); ++i)
+      {
+        if (fds[i + 2].revents & POLLIN)
+          receive(_connections[i], (int)i);
+        if ((fds[i + 2].revents & POLLOUT) && _connections[i].socket >= 0)
+          transmit(_connections[i]);
+      }
+
+      if (fds[0].revents)
+        accept();
+    }
+  }
+
+  void StandInServer::accept()
+  {
+    for (;;)
+    {
+      int socket = ::accept(_listen, 0, 0);
+      if (socket < 0)
+        break;
+
+      add(socket);
+    }
+  }
+
+  void StandInServer::add(int socket)
+  {
+    set_nonblocking(socket);
+
+    Connection c;
+    c.socket = socket;
+    c.stage = stage_version;
+    c.out = _hung ? "" : "RFB 003.008\n";
+    c.out_offset = 0;
+
+    _connections.push_back(c);
+
+    transmit(_connections.back());
+  }
+
+  size_t StandInServer::message_length(const std::string& in)
+  {
+    switch ((unsigned char)in[0])
+    {
+      case 0: /* SetPixelFormat */
+        return 20;
+      case 2: /* SetEncodings */
+        return in.size() >= 4 ? 4 + 4 * get16(in, 2) : 0;
+      case 3: /* FramebufferUpdateRequest */
+        return 10;
+      case 4: /* KeyEvent */
+        return 8;
+      case 5: /* PointerEvent */
+        return 6;
+      case 6: /* ClientCutText */
+        return in.size() >= 8 ? 8 + get32(in, 4) : 0;
+      case 251: /* SetDesktopSize */
+        return in.size() >= 8 ? 8 + 16 * (unsigned char)in[6] : 0;
+      default:
+        return (size_t)-1;
+    }
+  }
+
+  bool StandInServer::receive(Connection& c, int index)
+  {
+    char buffer[65536];
+
+    for (;;)
+    {
+      ssize_t result = ::recv(c.socket, buffer, sizeof(buffer), 0);
+      if (result == 0)
+      {
+        ::close(c.socket);
+        c.socket = -1;
+        return false;
+      }
+
+      if (result < 0)
+        break;
+
+      c.in.append(buffer, buffer + result);
+    }
+
+    if (_hung)
+    {
+      c.in.clear();
+      return true;
+    }
+
+    size_t offset = 0;
+
+    for (;;)
+    {
+      size_t left = c.in.size() - offset;
+
+      if (c.stage == stage_version && left >= 12)
+      {
+        offset += 12;
+        c.out += std::string("\x01\x01", 2);
+        c.stage = stage_security;
+      }
+      else if (c.stage == stage_security && left >= 1)
+      {
+        offset += 1;
+        put32(c.out, 0);
+        c.stage = stage_client_init;
+      }
+      else if (c.stage == stage_client_init && left >= 1)
+      {
+        char name[32];
+        sprintf(name, "session-%d", index);
+
+        offset += 1;
+
+        // 32 bits per pixel, depth 24, little endian true colour.
+        put16(c.out, _width);
+        put16(c.out, _height);
+        c.out += std::string("\x20\x18\x00\x01\x00\xff\x00\xff\x00\xff\x10\x08\x00\x00\x00\x00", 16);
+        put32(c.out, (unsigned int)strlen(name));
+        c.out += name;
+
+        c.stage = stage_messages;
+
+        ++_initialized;
+      }
+      else if (c.stage == stage_messages && left >= 1)
+      {
+        std::string header = c.in.substr(offset, 8);
+
+        size_t length = message_length(header);
+        if (length == (size_t)-1)
+        {
+          ::shutdown(c.socket, SHUT_RDWR);
+          return false;
+        }
+
+        if (!length || left < length)
+          break;
+
+        if (_handler)
+          _handler(index, c.in.data() + offset, length);
+
+        offset += length;
+      }
+      else
+        break;
+    }
+
+    c.in.erase(0, offset);
+
+    return transmit(c);
+  }
+
+  bool StandInServer::transmit(Connection& c)
+  {
+    while (c.out_offset < c.out.size())
+    {
+      ssize_t result = ::send(c.socket, c.out.data() + c.out_offset, c.out.size() - c.out_offset, MSG_NOSIGNAL);
+      if (result <= 0)
+        break;
+
+      c.out_offset += result;
+      _bytes_sent += result;
+    }
+
+    if (c.out_offset == c.out.size())
+    {
+      c.out.clear();
+      c.out_offset = 0;
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef header_165f6019_a3aa_472f_ba49_025630f787dd
+#define header_165f6019_a3aa_472f_ba49_025630f787dd
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Benchmark
+{
+  // Minimal RFB 3.8 server without authentication, serving loopback connections on its own thread.
+  // Desktop name of each connection is "session-<index>", index being order of acceptance.
+  class StandInServer
+  {
+  public:
+    // Called on server thread for every complete client message after initialization.
+    typedef std::function<void(int connection, const char* message, size_t length)> Handler;
+
+    StandInServer(int width, int height);
+    ~StandInServer();
+
+    bool start();
+    void stop();
+
+    const char* port() const
+    {
+      return _port.c_str();
+    }
+
+    int connections() const
+    {
+      return _initialized;
+    }
+
+    unsigned long long bytes_sent() const
+    {
+      return _bytes_sent;
+    }
+
+    void set_handler(Handler handler)
+    {
+      _handler = handler;
+    }
+
+    // Connections are accepted but never answered, as by a hung host. Set before start().
+    void set_hung(bool hung)
+    {
+      _hung = hung;
+    }
+
+    // Queues data for connection, may be called from any thread.
+    void send(int connection, const std::string& data);
+    void send_all(const std::string& data);
+
+    // Connection over socket pair instead of loopback, returns client end of it.
+    int connect_pair();
+
+    // Closes connection under the client, may be called from any thread.
+    void drop(int connection);
+
+    // FramebufferUpdate message with single RAW rectangle, 32 bits per pixel.
+    static std::string raw_update(int x, int y, int width, int height, const char* pixels);
+
+    // FramebufferUpdate message with single CopyRect rectangle.
+    static std::string copy_rect_update(int x, int y, int width, int height, int source_x, int source_y);
+
+  private:
+    struct Connection
+    {
+      int socket;
+      int stage;
+      std::string in;
+      std::string out;
+      size_t out_offset;
+    };
+
+    void run();
+
+    void accept();
+
+    void add(int socket);
+
+    bool receive(Connection& c, int index);
+
+    bool transmit(Connection& c);
+
+    size_t message_length(const std::string& in);
+
+  private:
+    int _width;
+    int _height;
+
+    int _listen;
+    int _wakeup[2];
+
+    std::string _port;
+
+    std::thread _thread;
+    std::atomic<bool> _stop;
+    std::atomic<int> _initialized;
+    std::atomic<unsigned long long> _bytes_sent;
+
+    std::vector<Connection> _connections;
+
+    std::mutex _lock;
+    std::vector<std::pair<int, std::string> > _queued;
+    std::vector<int> _adopted;
+    std::vector<int> _dropped;
+
+    Handler _handler;
+
+    bool _hung;
+  };
+}
+
+#endif
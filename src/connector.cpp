@@ -0,0 +1,499 @@
+#include "connector.hpp"
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <math.h>
+#define closesocket close
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace Network
+{
+#	define MAX_RESOLVE_THREADS 4
+#	define DEFAULT_CACHE_TTL 60.0f
+#	define CONNECT_ATTEMPT_DELAY 0.25
+
+#ifdef WIN32
+  typedef WSAPOLLFD PollDescriptor;
+#else
+  typedef pollfd PollDescriptor;
+#endif
+
+  inline bool connect_pending(int r)
+  {
+#ifdef WIN32
+    return r == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return r < 0 && errno == EINPROGRESS;
+#endif
+  }
+
+  inline int socket_error()
+  {
+#ifdef WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+  }
+
+  Connector& Connector::instance()
+  {
+    // Never destroyed, resolver threads may still be blocked in system calls when the process exits.
+    static Connector* connector = new Connector();
+
+    return *connector;
+  }
+
+  Connector::Connector()
+    : _cache_ttl(DEFAULT_CACHE_TTL), _resolve_threads(0), _idle_resolve_threads(0)
+  {
+    open_wakeup(_wakeup);
+
+    _connect_thread = std::thread(&Connector::connect_thread, this);
+    _connect_thread.detach();
+  }
+
+  Connector::Request Connector::connect(const char* host, const char* port, ConnectRequest::Notify notify)
+  {
+    Request request = std::make_shared<ConnectRequest>();
+    request->key = std::string(host) + ":" + port;
+    request->host = host;
+    request->port = port;
+    request->notify = notify;
+    request->finished = false;
+    request->cancelled = false;
+    request->socket = 0;
+    request->next_address = 0;
+    request->next_attempt = 0;
+    request->attempt_error = 0;
+    request->start = 0;
+
+    std::lock_guard<std::mutex> lock(_lock);
+
+#ifndef WIN32
+    // Unix socket path needs no lookup.
+    if (strncmp(host, "unix:", 5) == 0)
+    {
+      sockaddr_un address;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      strncpy(address.sun_path, host + 5, sizeof(address.sun_path) - 1);
+
+      request->addresses.push_back(std::string((const char*)&address, sizeof(address)));
+
+      _connecting.push_back(request);
+      signal_wakeup(_wakeup);
+
+      return request;
+    }
+#endif
+
+    std::map<std::string, CacheEntry>::iterator cached = _cache.find(request->key);
+    if (cached != _cache.end() && cached->second.expires > monotonic_time())
+    {
+      request->addresses = cached->second.addresses;
+
+      _connecting.push_back(request);
+      signal_wakeup(_wakeup);
+
+      return request;
+    }
+
+    // Streams connecting to the same host share single lookup.
+    std::vector<Request>& waiting = _resolving[request->key];
+    waiting.push_back(request);
+
+    if (waiting.size() == 1)
+    {
+      _lookups.push_back(request->key);
+
+      if (!_idle_resolve_threads && _resolve_threads < MAX_RESOLVE_THREADS)
+      {
+        std::thread(&Connector::resolve_thread, this).detach();
+        ++_resolve_threads;
+      }
+
+      _lookup_ready.notify_one();
+    }
+
+    return request;
+  }
+
+  Connector::Request Connector::reconnect(const Request& previous, float delay, ConnectRequest::Notify notify)
+  {
+    Request request = std::make_shared<ConnectRequest>();
+    request->key = previous->key;
+    request->host = previous->host;
+    request->port = previous->port;
+    request->notify = notify;
+    request->finished = false;
+    request->cancelled = false;
+    request->socket = 0;
+    request->next_address = 0;
+    request->next_attempt = 0;
+    request->attempt_error = 0;
+    request->start = monotonic_time() + std::max(delay, 0.0f);
+    request->address = previous->address;
+
+    // Network may have changed in between, so other addresses still follow the one which worked.
+    request->addresses = previous->addresses;
+
+    std::vector<std::string>::iterator last = std::find(request->addresses.begin(), request->addresses.end(), previous->address);
+    if (last != request->addresses.end())
+      std::rotate(request->addresses.begin(), last, last + 1);
+
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _connecting.push_back(request);
+    signal_wakeup(_wakeup);
+
+    return request;
+  }
+
+  bool Connector::result(const Request& request, Socket& socket, std::string& error)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (!request->finished)
+      return false;
+
+    socket = request->socket;
+    error = request->error;
+
+    request->socket = 0;
+
+    return true;
+  }
+
+  void Connector::cancel(const Request& request)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    request->cancelled = true;
+    request->notify = ConnectRequest::Notify();
+
+    // Attempts in flight are closed by connect thread.
+    if (!request->finished)
+      signal_wakeup(_wakeup);
+    else if (request->socket)
+    {
+      ::closesocket(request->socket);
+      request->socket = 0;
+    }
+  }
+
+  void Connector::set_cache_ttl(float seconds)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _cache_ttl = seconds;
+  }
+
+  void Connector::flush_cache()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _cache.clear();
+  }
+
+  void Connector::resolve_thread()
+  {
+    for (;;)
+    {
+      std::string key, host, port;
+
+      {
+        std::unique_lock<std::mutex> lock(_lock);
+
+        ++_idle_resolve_threads;
+
+        while (_lookups.empty())
+          _lookup_ready.wait(lock);
+
+        --_idle_resolve_threads;
+
+        key = _lookups.front();
+        _lookups.pop_front();
+
+        host = _resolving[key].front()->host;
+        port = _resolving[key].front()->port;
+      }
+
+      addrinfo hints, *resolved = 0;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+
+      std::vector<std::string> addresses;
+
+      if (getaddrinfo(host.c_str(), port.c_str(), &hints, &resolved) == 0)
+      {
+        // Interleave address families, starting with the one system prefers.
+        std::vector<std::string> preferred, other;
+
+        for (addrinfo* a = resolved; a; a = a->ai_next)
+        {
+          std::string address((const char*)a->ai_addr, a->ai_addrlen);
+
+          if (a->ai_family == resolved->ai_family)
+            preferred.push_back(address);
+          else
+            other.push_back(address);
+        }
+
+        for (size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+        {
+          if (i < preferred.size())
+            addresses.push_back(preferred[i]);
+          if (i < other.size())
+            addresses.push_back(other[i]);
+        }
+
+        freeaddrinfo(resolved);
+      }
+
+      resolved_addresses(key, addresses);
+    }
+  }
+
+  void Connector::resolved_addresses(const std::string& key, const std::vector<std::string>& addresses)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    std::vector<Request> waiting;
+    waiting.swap(_resolving[key]);
+    _resolving.erase(key);
+
+    if (!addresses.empty() && _cache_ttl > 0)
+    {
+      CacheEntry& entry = _cache[key];
+      entry.addresses = addresses;
+      entry.expires = monotonic_time() + _cache_ttl;
+    }
+
+    for (size_t i = 0; i < waiting.size(); ++i)
+    {
+      ConnectRequest& request = *waiting[i];
+
+      if (request.cancelled)
+        continue;
+
+      if (addresses.empty())
+      {
+        finish(request, 0, "Could not resolve destination address");
+        continue;
+      }
+
+      request.addresses = addresses;
+      _connecting.push_back(waiting[i]);
+    }
+
+    signal_wakeup(_wakeup);
+  }
+
+  void Connector::connect_thread()
+  {
+    std::vector<PollDescriptor> fds;
+    std::vector<Request> owners;
+
+    for (;;)
+    {
+      double now = monotonic_time();
+      double timeout = -1;
+
+      fds.resize(1);
+      fds[0].fd = _wakeup[0];
+      fds[0].events = POLLIN;
+      fds[0].revents = 0;
+
+      owners.resize(1);
+
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        for (size_t i = 0; i < _connecting.size(); )
+        {
+          ConnectRequest& request = *_connecting[i];
+
+          bool active = !request.cancelled && !request.finished;
+
+          if (active && now < request.start)
+          {
+            double delay = request.start - now;
+            timeout = timeout < 0 ? delay : std::min(timeout, delay);
+
+            ++i;
+            continue;
+          }
+
+          // Next address is tried when there is nothing in flight, or previous attempt takes too long.
+          if (active && (request.attempts.empty() || now >= request.next_attempt))
+            attempt(request, now);
+
+          if (active && request.attempts.empty())
+          {
+            std::string error = "Could not connect.";
+            if (request.attempt_error)
+              error = std::string("Could not connect: ") + strerror(request.attempt_error) + ".";
+
+            finish(request, 0, error.c_str());
+          }
+
+          if (request.cancelled || request.finished)
+          {
+            for (size_t j = 0; j < request.attempts.size(); ++j)
+              ::closesocket(request.attempts[j]);
+
+            request.attempts.clear();
+            request.attempt_addresses.clear();
+
+            _connecting[i] = _connecting.back();
+            _connecting.pop_back();
+            continue;
+          }
+
+          for (size_t j = 0; j < request.attempts.size(); ++j)
+          {
+            PollDescriptor descriptor;
+            descriptor.fd = request.attempts[j];
+            descriptor.events = POLLOUT;
+            descriptor.revents = 0;
+
+            fds.push_back(descriptor);
+            owners.push_back(_connecting[i]);
+          }
+
+          if (request.next_address < request.addresses.size())
+          {
+            double delay = std::max(0.0, request.next_attempt - now);
+            timeout = timeout < 0 ? delay : std::min(timeout, delay);
+          }
+
+          ++i;
+        }
+      }
+
+      int milliseconds = timeout < 0 ? -1 : (int)ceil(timeout * 1000.0);
+
+#ifdef WIN32
+      int result = WSAPoll(&fds[0], (ULONG)fds.size(), milliseconds);
+#else
+      int result = ::poll(&fds[0], fds.size(), milliseconds);
+#endif
+
+      if (result <= 0)
+        continue;
+
+      if (fds[0].revents)
+        drain_wakeup(_wakeup);
+
+      std::lock_guard<std::mutex> lock(_lock);
+
+      for (size_t i = 1; i < fds.size(); ++i)
+      {
+        ConnectRequest& request = *owners[i];
+
+        if (!fds[i].revents || request.cancelled || request.finished)
+          continue;
+
+        Socket socket = fds[i].fd;
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&error, &length) != 0)
+          error = -1;
+
+        size_t attempt = std::find(request.attempts.begin(), request.attempts.end(), socket) - request.attempts.begin();
+        size_t address = request.attempt_addresses[attempt];
+
+        request.attempts.erase(request.attempts.begin() + attempt);
+        request.attempt_addresses.erase(request.attempt_addresses.begin() + attempt);
+
+        if (!error)
+        {
+          request.address = request.addresses[address];
+
+          finish(request, socket, 0);
+          continue;
+        }
+
+        // Failed attempt makes room for the next address right away.
+        ::closesocket(socket);
+        request.next_attempt = 0;
+        request.attempt_error = error > 0 ? error : request.attempt_error;
+      }
+    }
+  }
+
+  void Connector::attempt(ConnectRequest& request, double now)
+  {
+    while (request.next_address < request.addresses.size())
+    {
+      size_t index = request.next_address++;
+      const std::string& address = request.addresses[index];
+      const sockaddr* destination = (const sockaddr*)address.data();
+
+      Socket socket = ::socket(destination->sa_family, SOCK_STREAM, 0);
+
+#ifdef WIN32
+      if (socket == INVALID_SOCKET)
+        continue;
+
+      unsigned long mode = 1;
+      ioctlsocket(socket, FIONBIO, &mode);
+#else
+      if (socket < 0)
+        continue;
+
+      fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+      fcntl(socket, F_SETFD, FD_CLOEXEC);
+#endif
+
+      int result = ::connect(socket, destination, (int)address.size());
+      if (result != 0 && !connect_pending(result))
+        request.attempt_error = socket_error();
+
+      if (result == 0 || connect_pending(result))
+      {
+        request.attempts.push_back(socket);
+        request.attempt_addresses.push_back(index);
+        request.next_attempt = now + CONNECT_ATTEMPT_DELAY;
+
+        return;
+      }
+
+      ::closesocket(socket);
+    }
+  }
+
+  void Connector::finish(ConnectRequest& request, Socket socket, const char* error)
+  {
+    for (size_t i = 0; i < request.attempts.size(); ++i)
+      ::closesocket(request.attempts[i]);
+
+    request.attempts.clear();
+    request.attempt_addresses.clear();
+
+    request.finished = true;
+    request.socket = socket;
+    request.error = error ? error : "";
+
+    if (request.notify)
+      request.notify();
+  }
+}
@@ -0,0 +1,115 @@
+#ifndef header_56f30636_bb2c_4091_971e_1546fb0750fe
+#define header_56f30636_bb2c_4091_971e_1546fb0750fe
+
+#include "raw_query.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace Network
+{
+  // Connection being established by Connector on behalf of a stream.
+  struct ConnectRequest
+  {
+    typedef std::function<void()> Notify;
+
+    std::string key;
+    std::string host;
+    std::string port;
+
+    // Called on connector thread once result is available.
+    Notify notify;
+
+    bool finished;
+    bool cancelled;
+    Socket socket;
+    std::string error;
+
+    // Resolved addresses in order of attempts, and sockets of attempts in flight with their addresses.
+    std::vector<std::string> addresses;
+    size_t next_address;
+    std::vector<Socket> attempts;
+    std::vector<size_t> attempt_addresses;
+    double next_attempt;
+
+    // System error of the last failed attempt, reported when none succeeds.
+    int attempt_error;
+
+    // No attempts are made before this time, and address which connected is kept for reconnects.
+    double start;
+    std::string address;
+  };
+
+  // Resolves host names and establishes TCP connections off the calling thread. Lookups run on
+  // small pool of resolver threads and their results are cached for all streams in the process.
+  // Connections to resolved addresses are raced as described by RFC 8305 (Happy Eyeballs) on
+  // single connect thread: IPv6 and IPv4 addresses are interleaved, and next address is tried
+  // when previous one did not connect within attempt delay, first one to connect wins.
+  // Host names in form of unix:<path> are connected as unix sockets, without lookup.
+  class Connector
+  {
+  public:
+    typedef std::shared_ptr<ConnectRequest> Request;
+
+    static Connector& instance();
+
+    Request connect(const char* host, const char* port, ConnectRequest::Notify notify);
+
+    // Connects again to the host of finished request after delay in seconds, without looking it up.
+    // Address which connected last time is tried first.
+    Request reconnect(const Request& previous, float delay, ConnectRequest::Notify notify);
+
+    // Returns true once request is finished, with connected socket or zero socket and error description.
+    // Socket is handed over to the caller.
+    bool result(const Request& request, Socket& socket, std::string& error);
+
+    // Stops connecting, notification is not called after this returns.
+    void cancel(const Request& request);
+
+    // Time in seconds for which resolved addresses are reused.
+    void set_cache_ttl(float seconds);
+
+    void flush_cache();
+
+  private:
+    struct CacheEntry
+    {
+      std::vector<std::string> addresses;
+      double expires;
+    };
+
+    Connector();
+
+    void resolve_thread();
+
+    void connect_thread();
+
+    void resolved_addresses(const std::string& key, const std::vector<std::string>& addresses);
+
+    void attempt(ConnectRequest& request, double now);
+
+    void finish(ConnectRequest& request, Socket socket, const char* error);
+
+  private:
+    std::mutex _lock;
+
+    std::condition_variable _lookup_ready;
+    std::deque<std::string> _lookups;
+    std::map<std::string, std::vector<Request> > _resolving;
+    std::map<std::string, CacheEntry> _cache;
+    float _cache_ttl;
+
+    int _resolve_threads;
+    int _idle_resolve_threads;
+
+    std::vector<Request> _connecting;
+    std::thread _connect_thread;
+    Socket _wakeup[2];
+  };
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "hextile_decoder.hpp"
+#include "pixel_fill.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace Network
+{
+#	define HEXTILE_SIZE 16
+
+  HextileDecoder::HextileDecoder()
+  {
+    _tile = 0;
+
+    memset(_background, 0, sizeof(_background));
+    memset(_foreground, 0, sizeof(_foreground));
+  }
+
+  RectDecoder::Result HextileDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    switch (context.format.bytes_per_pixel())
+    {
+      case 1:
+        return decode_tiles<1>(context, rect);
+      case 2:
+        return decode_tiles<2>(context, rect);
+      case 4:
+        return decode_tiles<4>(context, rect);
+      default:
+        return decode_failed;
+    }
+  }
+
+  size_t HextileDecoder::tile_length(ReceiveBuffer& input, int width, int height, size_t bpp)
+  {
+    if (input.length() < 1)
+      return 0;
+
+    int subencoding = input.u8(0);
+
+    size_t length = 1;
+
+    if (subencoding & hextile_raw)
+    {
+      length += width * height * bpp;
+    }
+    else
+    {
+      if (subencoding & hextile_background)
+        length += bpp;
+
+      if (subencoding & hextile_foreground)
+        length += bpp;
+
+      if (subencoding & hextile_any_subrects)
+      {
+        if (input.length() < length + 1)
+          return 0;
+
+        length += 1 + input.u8(length) * ((subencoding & hextile_subrects_coloured) ? bpp + 2 : 2);
+      }
+    }
+
+    return input.length() >= length ? length : 0;
+  }
+
+  // Tiles are decoded once they have fully arrived, so each tile is parsed without bounds checks.
+  template <int BPP>
+  RectDecoder::Result HextileDecoder::decode_tiles(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    int columns = (rect.width + HEXTILE_SIZE - 1) / HEXTILE_SIZE;
+    int tiles = columns * ((rect.height + HEXTILE_SIZE - 1) / HEXTILE_SIZE);
+
+    for (; _tile < tiles; ++_tile)
+    {
+      int left = (_tile % columns) * HEXTILE_SIZE;
+      int top = (_tile / columns) * HEXTILE_SIZE;
+      int width = std::min(HEXTILE_SIZE, rect.width - left);
+      int height = std::min(HEXTILE_SIZE, rect.height - top);
+
+      size_t length = tile_length(input, width, height, BPP);
+      if (!length)
+        return decode_incomplete;
+
+      const char* data = input.contiguous(0, length);
+      int subencoding = (unsigned char)*data++;
+
+      int x = rect.x + left;
+      int y = rect.y + top;
+      bool inside = context.framebuffer && x + width <= context.width && y + height <= context.height;
+
+      char* destination = inside ? context.framebuffer + y * context.stride + x * BPP : _pixels;
+      size_t stride = inside ? context.stride : HEXTILE_SIZE * BPP;
+
+      if (subencoding & hextile_raw)
+      {
+        for (int row = 0; row < height; ++row, data += width * BPP)
+          memcpy(destination + row * stride, data, width * BPP);
+      }
+      else
+      {
+        if (subencoding & hextile_background)
+        {
+          memcpy(_background, data, BPP);
+          data += BPP;
+        }
+
+        if (subencoding & hextile_foreground)
+        {
+          memcpy(_foreground, data, BPP);
+          data += BPP;
+        }
+
+        fill_tile<BPP>(destination, stride, width, height, _background);
+
+        if (subencoding & hextile_any_subrects)
+        {
+          int count = (unsigned char)*data++;
+          bool coloured = (subencoding & hextile_subrects_coloured) != 0;
+
+          for (int i = 0; i < count; ++i)
+          {
+            const char* pixel = _foreground;
+
+            if (coloured)
+            {
+              pixel = data;
+              data += BPP;
+            }
+
+            int position = (unsigned char)data[0];
+            int size = (unsigned char)data[1];
+            data += 2;
+
+            int sx = position >> 4;
+            int sy = position & 15;
+            int sw = (size >> 4) + 1;
+            int sh = (size & 15) + 1;
+
+            if (sx + sw > width || sy + sh > height)
+            {
+              _tile = 0;
+
+              return decode_failed;
+            }
+
+            fill_tile<BPP>(destination + sy * stride + sx * BPP, stride, sw, sh, pixel);
+          }
+
+          // Last subrectangle colour is foreground of following tiles.
+          if (coloured && count > 0)
+            memcpy(_foreground, data - 2 - BPP, BPP);
+        }
+      }
+
+      if (!inside && context.framebuffer)
+      {
+        int copy_width = std::min(width, context.width - x);
+        int copy_height = std::min(height, context.height - y);
+
+        for (int row = 0; row < copy_height && copy_width > 0; ++row)
+          memcpy(context.framebuffer + (y + row) * context.stride + x * BPP, _pixels + row * stride, copy_width * BPP);
+      }
+
+      input.consume(length);
+    }
+
+    _tile = 0;
+
+    return decode_done;
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef header_60d2421a_d7cb_4e63_ad78_4dd609b3b475
+#define header_60d2421a_d7cb_4e63_ad78_4dd609b3b475
+
+#include "rect_decoder.hpp"
+
+namespace Network
+{
+  // Rectangle in 16 x 16 tiles, each either RAW or background with solid subrectangles. Background and
+  // foreground pixels carry over from tile to tile.
+  class HextileDecoder: public RectDecoder
+  {
+  public:
+    enum Subencoding
+    {
+      hextile_raw = 1,
+      hextile_background = 2,
+      hextile_foreground = 4,
+      hextile_any_subrects = 8,
+      hextile_subrects_coloured = 16
+    };
+
+  public:
+    HextileDecoder();
+
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+
+  private:
+    // Length of next tile, once all of it has arrived, zero until then.
+    size_t tile_length(ReceiveBuffer& input, int width, int height, size_t bpp);
+
+    template <int BPP>
+    Result decode_tiles(DecodeContext& context, const RectHeader& rect);
+
+  private:
+    int _tile;
+
+    char _background[4];
+    char _foreground[4];
+
+    // Tiles reaching past framebuffer are decoded here, and then clipped.
+    char _pixels[16 * 16 * 4];
+  };
+}
+
+#endif
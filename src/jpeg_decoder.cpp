@@ -0,0 +1,1293 @@
+#include "jpeg_decoder.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define JPEG_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define JPEG_NEON
+#endif
+
+namespace Network
+{
+  // Natural position of coefficients in zigzag order, followed by entries for runs past the end in corrupt data.
+  static const unsigned char dezigzag[64 + 16] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63
+  };
+
+  // Entropy coded data is read in bits from the most significant one. Bytes 0xff are followed by stuffed zero
+  // byte, anything else after them is a marker, which is not read past.
+  struct JpegDecoder::BitReader
+  {
+    const unsigned char* data;
+    const unsigned char* end;
+
+    unsigned long long bits;
+    int count;
+    bool marker;
+
+    BitReader(const unsigned char* begin, const unsigned char* finish)
+    {
+      data = begin;
+      end = finish;
+      bits = 0;
+      count = 0;
+      marker = false;
+    }
+
+    // Tops up to at least 57 bits, zeros are fed past end of data.
+    void fill()
+    {
+      while (count <= 56)
+      {
+        unsigned int byte = 0;
+
+        if (!marker && data < end)
+        {
+          byte = *data;
+
+          if (byte != 0xff)
+            ++data;
+          else if (data + 1 < end && data[1] == 0)
+            data += 2;
+          else
+          {
+            marker = true;
+            byte = 0;
+          }
+        }
+
+        bits |= (unsigned long long)byte << (56 - count);
+        count += 8;
+      }
+    }
+
+    unsigned int peek(int length) const
+    {
+      return (unsigned int)(bits >> (64 - length));
+    }
+
+    void skip(int length)
+    {
+      bits <<= length;
+      count -= length;
+    }
+
+    // Signed value of given number of bits, those starting with zero are negative.
+    int receive(int length)
+    {
+      if (count < length)
+        fill();
+
+      int value = (int)peek(length);
+
+      skip(length);
+
+      return value < (1 << (length - 1)) ? value - (1 << length) + 1 : value;
+    }
+
+    // Continues after restart marker, which is expected where data stopped.
+    void restart()
+    {
+      while (data + 1 < end && !(data[0] == 0xff && data[1] >= 0xd0 && data[1] <= 0xd7))
+        ++data;
+
+      if (data + 1 < end)
+        data += 2;
+
+      bits = 0;
+      count = 0;
+      marker = false;
+    }
+  };
+
+  bool JpegDecoder::Huffman::build(const unsigned char* counts, const unsigned char* values, bool ac)
+  {
+    memset(fast, 0, sizeof(fast));
+    memset(fast_ac, 0, sizeof(fast_ac));
+
+    unsigned int code = 0;
+    int k = 0;
+
+    for (int length = 1; length <= 16; ++length)
+    {
+      delta[length] = k - (int)code;
+
+      for (int i = 0; i < counts[length - 1]; ++i, ++k, ++code)
+      {
+        symbols[k] = values[k];
+
+        if (length <= 9)
+        {
+          int first = code << (9 - length);
+
+          for (int j = 0; j < 1 << (9 - length); ++j)
+            fast[first + j] = (unsigned short)((length << 8) | values[k]);
+        }
+      }
+
+      if (code > 1u << length)
+        return false;
+
+      maxcode[length] = code << (16 - length);
+      code <<= 1;
+    }
+
+    maxcode[17] = 0xffffffff;
+
+    if (!ac)
+      return true;
+
+    for (int i = 0; i < 512; ++i)
+    {
+      if (!fast[i])
+        continue;
+
+      int run = (fast[i] >> 4) & 15;
+      int size = fast[i] & 15;
+      int length = fast[i] >> 8;
+
+      if (size && length + size <= 9)
+      {
+        int value = ((i << length) & 511) >> (9 - size);
+
+        if (value < 1 << (size - 1))
+          value -= (1 << size) - 1;
+
+        if (value >= -128 && value <= 127)
+          fast_ac[i] = (short)(value * 256 + run * 16 + length + size);
+      }
+    }
+
+    return true;
+  }
+
+  int JpegDecoder::Huffman::decode(BitReader& reader) const
+  {
+    if (reader.count < 16)
+      reader.fill();
+
+    unsigned int entry = fast[reader.peek(9)];
+
+    if (entry)
+    {
+      reader.skip(entry >> 8);
+
+      return entry & 255;
+    }
+
+    unsigned int code = reader.peek(16);
+    int length = 10;
+
+    while (code >= maxcode[length])
+      ++length;
+
+    if (length > 16)
+      return -1;
+
+    int index = (int)reader.peek(length) + delta[length];
+
+    reader.skip(length);
+
+    return symbols[index & 255];
+  }
+
+  // Inverse DCT in 12 bit fixed point, as the accurate integer one of libjpeg. Vector versions process all
+  // columns, then all rows, at once, with the same results as scalar one.
+#	define JPEG_FIX(x) ((int)((x) * 4096 + 0.5))
+
+#if defined(JPEG_SSE2)
+  static void idct_block(unsigned char* out, size_t stride, const short* data)
+  {
+    __m128i row0 = _mm_loadu_si128((const __m128i*)(data + 0 * 8));
+    __m128i row1 = _mm_loadu_si128((const __m128i*)(data + 1 * 8));
+    __m128i row2 = _mm_loadu_si128((const __m128i*)(data + 2 * 8));
+    __m128i row3 = _mm_loadu_si128((const __m128i*)(data + 3 * 8));
+    __m128i row4 = _mm_loadu_si128((const __m128i*)(data + 4 * 8));
+    __m128i row5 = _mm_loadu_si128((const __m128i*)(data + 5 * 8));
+    __m128i row6 = _mm_loadu_si128((const __m128i*)(data + 6 * 8));
+    __m128i row7 = _mm_loadu_si128((const __m128i*)(data + 7 * 8));
+    __m128i tmp;
+
+    // Rotations are dot products of interleaved inputs with pairs of constants.
+#	define JPEG_CONST(x, y) _mm_setr_epi16((x), (y), (x), (y), (x), (y), (x), (y))
+
+    const __m128i rot0_0 = JPEG_CONST(JPEG_FIX(0.5411961), JPEG_FIX(0.5411961) + JPEG_FIX(-1.847759065));
+    const __m128i rot0_1 = JPEG_CONST(JPEG_FIX(0.5411961) + JPEG_FIX(0.765366865), JPEG_FIX(0.5411961));
+    const __m128i rot1_0 = JPEG_CONST(JPEG_FIX(1.175875602) + JPEG_FIX(-0.899976223), JPEG_FIX(1.175875602));
+    const __m128i rot1_1 = JPEG_CONST(JPEG_FIX(1.175875602), JPEG_FIX(1.175875602) + JPEG_FIX(-2.562915447));
+    const __m128i rot2_0 = JPEG_CONST(JPEG_FIX(-1.961570560) + JPEG_FIX(0.298631336), JPEG_FIX(-1.961570560));
+    const __m128i rot2_1 = JPEG_CONST(JPEG_FIX(-1.961570560), JPEG_FIX(-1.961570560) + JPEG_FIX(3.072711026));
+    const __m128i rot3_0 = JPEG_CONST(JPEG_FIX(-0.390180644) + JPEG_FIX(2.053119869), JPEG_FIX(-0.390180644));
+    const __m128i rot3_1 = JPEG_CONST(JPEG_FIX(-0.390180644), JPEG_FIX(-0.390180644) + JPEG_FIX(1.501321110));
+
+    // Rounding of column pass keeps 2 more bits, row pass adds 128 to bring samples to 0..255.
+    const __m128i bias_0 = _mm_set1_epi32(512);
+    const __m128i bias_1 = _mm_set1_epi32(65536 + (128 << 17));
+
+#	define JPEG_ROT(out0, out1, x, y, c0, c1) \
+    __m128i out0##_lo = _mm_unpacklo_epi16((x), (y)); \
+    __m128i out0##_hi = _mm_unpackhi_epi16((x), (y)); \
+    __m128i out0##_l = _mm_madd_epi16(out0##_lo, c0); \
+    __m128i out0##_h = _mm_madd_epi16(out0##_hi, c0); \
+    __m128i out1##_l = _mm_madd_epi16(out0##_lo, c1); \
+    __m128i out1##_h = _mm_madd_epi16(out0##_hi, c1)
+
+#	define JPEG_WIDEN(out, in) \
+    __m128i out##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
+    __m128i out##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4)
+
+#	define JPEG_WADD(out, a, b) \
+    __m128i out##_l = _mm_add_epi32(a##_l, b##_l); \
+    __m128i out##_h = _mm_add_epi32(a##_h, b##_h)
+
+#	define JPEG_WSUB(out, a, b) \
+    __m128i out##_l = _mm_sub_epi32(a##_l, b##_l); \
+    __m128i out##_h = _mm_sub_epi32(a##_h, b##_h)
+
+#	define JPEG_BUTTERFLY(out0, out1, a, b, bias, shift) \
+    { \
+      __m128i biased_l = _mm_add_epi32(a##_l, bias); \
+      __m128i biased_h = _mm_add_epi32(a##_h, bias); \
+      JPEG_WADD(sum, biased, b); \
+      JPEG_WSUB(difference, biased, b); \
+      out0 = _mm_packs_epi32(_mm_srai_epi32(sum_l, shift), _mm_srai_epi32(sum_h, shift)); \
+      out1 = _mm_packs_epi32(_mm_srai_epi32(difference_l, shift), _mm_srai_epi32(difference_h, shift)); \
+    }
+
+#	define JPEG_PASS(bias, shift) \
+    { \
+      JPEG_ROT(t2e, t3e, row2, row6, rot0_0, rot0_1); \
+      __m128i sum04 = _mm_add_epi16(row0, row4); \
+      __m128i difference04 = _mm_sub_epi16(row0, row4); \
+      JPEG_WIDEN(t0e, sum04); \
+      JPEG_WIDEN(t1e, difference04); \
+      JPEG_WADD(x0, t0e, t3e); \
+      JPEG_WSUB(x3, t0e, t3e); \
+      JPEG_WADD(x1, t1e, t2e); \
+      JPEG_WSUB(x2, t1e, t2e); \
+      JPEG_ROT(y0o, y2o, row7, row3, rot2_0, rot2_1); \
+      JPEG_ROT(y1o, y3o, row5, row1, rot3_0, rot3_1); \
+      __m128i sum17 = _mm_add_epi16(row1, row7); \
+      __m128i sum35 = _mm_add_epi16(row3, row5); \
+      JPEG_ROT(y4o, y5o, sum17, sum35, rot1_0, rot1_1); \
+      JPEG_WADD(x4, y0o, y4o); \
+      JPEG_WADD(x5, y1o, y5o); \
+      JPEG_WADD(x6, y2o, y5o); \
+      JPEG_WADD(x7, y3o, y4o); \
+      JPEG_BUTTERFLY(row0, row7, x0, x7, bias, shift); \
+      JPEG_BUTTERFLY(row1, row6, x1, x6, bias, shift); \
+      JPEG_BUTTERFLY(row2, row5, x2, x5, bias, shift); \
+      JPEG_BUTTERFLY(row3, row4, x3, x4, bias, shift); \
+    }
+
+#	define JPEG_INTERLEAVE16(a, b) \
+    tmp = a; \
+    a = _mm_unpacklo_epi16(a, b); \
+    b = _mm_unpackhi_epi16(tmp, b)
+
+#	define JPEG_INTERLEAVE8(a, b) \
+    tmp = a; \
+    a = _mm_unpacklo_epi8(a, b); \
+    b = _mm_unpackhi_epi8(tmp, b)
+
+    JPEG_PASS(bias_0, 10);
+
+    // Transposes 8x8 block of 16 bit values.
+    JPEG_INTERLEAVE16(row0, row4);
+    JPEG_INTERLEAVE16(row1, row5);
+    JPEG_INTERLEAVE16(row2, row6);
+    JPEG_INTERLEAVE16(row3, row7);
+
+    JPEG_INTERLEAVE16(row0, row2);
+    JPEG_INTERLEAVE16(row1, row3);
+    JPEG_INTERLEAVE16(row4, row6);
+    JPEG_INTERLEAVE16(row5, row7);
+
+    JPEG_INTERLEAVE16(row0, row1);
+    JPEG_INTERLEAVE16(row2, row3);
+    JPEG_INTERLEAVE16(row4, row5);
+    JPEG_INTERLEAVE16(row6, row7);
+
+    JPEG_PASS(bias_1, 17);
+
+    // Packs to 0..255 and transposes back.
+    __m128i p0 = _mm_packus_epi16(row0, row1);
+    __m128i p1 = _mm_packus_epi16(row2, row3);
+    __m128i p2 = _mm_packus_epi16(row4, row5);
+    __m128i p3 = _mm_packus_epi16(row6, row7);
+
+    JPEG_INTERLEAVE8(p0, p2);
+    JPEG_INTERLEAVE8(p1, p3);
+
+    JPEG_INTERLEAVE8(p0, p1);
+    JPEG_INTERLEAVE8(p2, p3);
+
+    JPEG_INTERLEAVE8(p0, p2);
+    JPEG_INTERLEAVE8(p1, p3);
+
+    _mm_storel_epi64((__m128i*)(out + 0 * stride), p0);
+    _mm_storel_epi64((__m128i*)(out + 1 * stride), _mm_shuffle_epi32(p0, 0x4e));
+    _mm_storel_epi64((__m128i*)(out + 2 * stride), p2);
+    _mm_storel_epi64((__m128i*)(out + 3 * stride), _mm_shuffle_epi32(p2, 0x4e));
+    _mm_storel_epi64((__m128i*)(out + 4 * stride), p1);
+    _mm_storel_epi64((__m128i*)(out + 5 * stride), _mm_shuffle_epi32(p1, 0x4e));
+    _mm_storel_epi64((__m128i*)(out + 6 * stride), p3);
+    _mm_storel_epi64((__m128i*)(out + 7 * stride), _mm_shuffle_epi32(p3, 0x4e));
+
+#	undef JPEG_CONST
+#	undef JPEG_ROT
+#	undef JPEG_WIDEN
+#	undef JPEG_WADD
+#	undef JPEG_WSUB
+#	undef JPEG_BUTTERFLY
+#	undef JPEG_PASS
+#	undef JPEG_INTERLEAVE16
+#	undef JPEG_INTERLEAVE8
+  }
+#elif defined(JPEG_NEON)
+  static void idct_block(unsigned char* out, size_t stride, const short* data)
+  {
+    int16x8_t row0 = vld1q_s16(data + 0 * 8);
+    int16x8_t row1 = vld1q_s16(data + 1 * 8);
+    int16x8_t row2 = vld1q_s16(data + 2 * 8);
+    int16x8_t row3 = vld1q_s16(data + 3 * 8);
+    int16x8_t row4 = vld1q_s16(data + 4 * 8);
+    int16x8_t row5 = vld1q_s16(data + 5 * 8);
+    int16x8_t row6 = vld1q_s16(data + 6 * 8);
+    int16x8_t row7 = vld1q_s16(data + 7 * 8);
+
+    const int16x4_t rot0_0 = vdup_n_s16(JPEG_FIX(0.5411961));
+    const int16x4_t rot0_1 = vdup_n_s16(JPEG_FIX(-1.847759065));
+    const int16x4_t rot0_2 = vdup_n_s16(JPEG_FIX(0.765366865));
+    const int16x4_t rot1_0 = vdup_n_s16(JPEG_FIX(1.175875602));
+    const int16x4_t rot1_1 = vdup_n_s16(JPEG_FIX(-0.899976223));
+    const int16x4_t rot1_2 = vdup_n_s16(JPEG_FIX(-2.562915447));
+    const int16x4_t rot2_0 = vdup_n_s16(JPEG_FIX(-1.961570560));
+    const int16x4_t rot2_1 = vdup_n_s16(JPEG_FIX(-0.390180644));
+    const int16x4_t rot3_0 = vdup_n_s16(JPEG_FIX(0.298631336));
+    const int16x4_t rot3_1 = vdup_n_s16(JPEG_FIX(2.053119869));
+    const int16x4_t rot3_2 = vdup_n_s16(JPEG_FIX(3.072711026));
+    const int16x4_t rot3_3 = vdup_n_s16(JPEG_FIX(1.501321110));
+
+#	define JPEG_MUL(out, in, c) \
+    int32x4_t out##_l = vmull_s16(vget_low_s16(in), c); \
+    int32x4_t out##_h = vmull_s16(vget_high_s16(in), c)
+
+#	define JPEG_MAC(out, acc, in, c) \
+    int32x4_t out##_l = vmlal_s16(acc##_l, vget_low_s16(in), c); \
+    int32x4_t out##_h = vmlal_s16(acc##_h, vget_high_s16(in), c)
+
+#	define JPEG_WIDEN(out, in) \
+    int32x4_t out##_l = vshll_n_s16(vget_low_s16(in), 12); \
+    int32x4_t out##_h = vshll_n_s16(vget_high_s16(in), 12)
+
+#	define JPEG_WADD(out, a, b) \
+    int32x4_t out##_l = vaddq_s32(a##_l, b##_l); \
+    int32x4_t out##_h = vaddq_s32(a##_h, b##_h)
+
+#	define JPEG_WSUB(out, a, b) \
+    int32x4_t out##_l = vsubq_s32(a##_l, b##_l); \
+    int32x4_t out##_h = vsubq_s32(a##_h, b##_h)
+
+#	define JPEG_BUTTERFLY(out0, out1, a, b, shift_op, shift) \
+    { \
+      JPEG_WADD(sum, a, b); \
+      JPEG_WSUB(difference, a, b); \
+      out0 = vcombine_s16(shift_op(sum_l, shift), shift_op(sum_h, shift)); \
+      out1 = vcombine_s16(shift_op(difference_l, shift), shift_op(difference_h, shift)); \
+    }
+
+#	define JPEG_PASS(shift_op, shift) \
+    { \
+      int16x8_t sum26 = vaddq_s16(row2, row6); \
+      JPEG_MUL(p1e, sum26, rot0_0); \
+      JPEG_MAC(t2e, p1e, row6, rot0_1); \
+      JPEG_MAC(t3e, p1e, row2, rot0_2); \
+      int16x8_t sum04 = vaddq_s16(row0, row4); \
+      int16x8_t difference04 = vsubq_s16(row0, row4); \
+      JPEG_WIDEN(t0e, sum04); \
+      JPEG_WIDEN(t1e, difference04); \
+      JPEG_WADD(x0, t0e, t3e); \
+      JPEG_WSUB(x3, t0e, t3e); \
+      JPEG_WADD(x1, t1e, t2e); \
+      JPEG_WSUB(x2, t1e, t2e); \
+      int16x8_t sum15 = vaddq_s16(row1, row5); \
+      int16x8_t sum17 = vaddq_s16(row1, row7); \
+      int16x8_t sum35 = vaddq_s16(row3, row5); \
+      int16x8_t sum37 = vaddq_s16(row3, row7); \
+      int16x8_t sum_odd = vaddq_s16(sum17, sum35); \
+      JPEG_MUL(p5o, sum_odd, rot1_0); \
+      JPEG_MAC(p1o, p5o, sum17, rot1_1); \
+      JPEG_MAC(p2o, p5o, sum35, rot1_2); \
+      JPEG_MUL(p3o, sum37, rot2_0); \
+      JPEG_MUL(p4o, sum15, rot2_1); \
+      JPEG_WADD(sump13o, p1o, p3o); \
+      JPEG_WADD(sump24o, p2o, p4o); \
+      JPEG_WADD(sump23o, p2o, p3o); \
+      JPEG_WADD(sump14o, p1o, p4o); \
+      JPEG_MAC(x4, sump13o, row7, rot3_0); \
+      JPEG_MAC(x5, sump24o, row5, rot3_1); \
+      JPEG_MAC(x6, sump23o, row3, rot3_2); \
+      JPEG_MAC(x7, sump14o, row1, rot3_3); \
+      JPEG_BUTTERFLY(row0, row7, x0, x7, shift_op, shift); \
+      JPEG_BUTTERFLY(row1, row6, x1, x6, shift_op, shift); \
+      JPEG_BUTTERFLY(row2, row5, x2, x5, shift_op, shift); \
+      JPEG_BUTTERFLY(row3, row4, x3, x4, shift_op, shift); \
+    }
+
+    // 128 added to every sample is 1024 in DC coefficient.
+    row0 = vaddq_s16(row0, vsetq_lane_s16(1024, vdupq_n_s16(0), 0));
+
+    // Column pass rounds with its shift, so that 2 more bits are kept.
+    JPEG_PASS(vrshrn_n_s32, 10);
+
+    {
+#	define JPEG_TRN16(x, y) { int16x8x2_t t = vtrnq_s16(x, y); x = t.val[0]; y = t.val[1]; }
+#	define JPEG_TRN32(x, y) { int32x4x2_t t = vtrnq_s32(vreinterpretq_s32_s16(x), vreinterpretq_s32_s16(y)); \
+      x = vreinterpretq_s16_s32(t.val[0]); y = vreinterpretq_s16_s32(t.val[1]); }
+#	define JPEG_TRN64(x, y) { int16x8_t x0 = x; int16x8_t y0 = y; \
+      x = vcombine_s16(vget_low_s16(x0), vget_low_s16(y0)); y = vcombine_s16(vget_high_s16(x0), vget_high_s16(y0)); }
+
+      JPEG_TRN16(row0, row1);
+      JPEG_TRN16(row2, row3);
+      JPEG_TRN16(row4, row5);
+      JPEG_TRN16(row6, row7);
+
+      JPEG_TRN32(row0, row2);
+      JPEG_TRN32(row1, row3);
+      JPEG_TRN32(row4, row6);
+      JPEG_TRN32(row5, row7);
+
+      JPEG_TRN64(row0, row4);
+      JPEG_TRN64(row1, row5);
+      JPEG_TRN64(row2, row6);
+      JPEG_TRN64(row3, row7);
+    }
+
+    // Shift of 17 is done as 16 and a rounding one when packing.
+    JPEG_PASS(vshrn_n_s32, 16);
+
+    {
+      uint8x8_t p0 = vqrshrun_n_s16(row0, 1);
+      uint8x8_t p1 = vqrshrun_n_s16(row1, 1);
+      uint8x8_t p2 = vqrshrun_n_s16(row2, 1);
+      uint8x8_t p3 = vqrshrun_n_s16(row3, 1);
+      uint8x8_t p4 = vqrshrun_n_s16(row4, 1);
+      uint8x8_t p5 = vqrshrun_n_s16(row5, 1);
+      uint8x8_t p6 = vqrshrun_n_s16(row6, 1);
+      uint8x8_t p7 = vqrshrun_n_s16(row7, 1);
+
+#	define JPEG_TRN8_8(x, y) { uint8x8x2_t t = vtrn_u8(x, y); x = t.val[0]; y = t.val[1]; }
+#	define JPEG_TRN8_16(x, y) { uint16x4x2_t t = vtrn_u16(vreinterpret_u16_u8(x), vreinterpret_u16_u8(y)); \
+      x = vreinterpret_u8_u16(t.val[0]); y = vreinterpret_u8_u16(t.val[1]); }
+#	define JPEG_TRN8_32(x, y) { uint32x2x2_t t = vtrn_u32(vreinterpret_u32_u8(x), vreinterpret_u32_u8(y)); \
+      x = vreinterpret_u8_u32(t.val[0]); y = vreinterpret_u8_u32(t.val[1]); }
+
+      JPEG_TRN8_8(p0, p1);
+      JPEG_TRN8_8(p2, p3);
+      JPEG_TRN8_8(p4, p5);
+      JPEG_TRN8_8(p6, p7);
+
+      JPEG_TRN8_16(p0, p2);
+      JPEG_TRN8_16(p1, p3);
+      JPEG_TRN8_16(p4, p6);
+      JPEG_TRN8_16(p5, p7);
+
+      JPEG_TRN8_32(p0, p4);
+      JPEG_TRN8_32(p1, p5);
+      JPEG_TRN8_32(p2, p6);
+      JPEG_TRN8_32(p3, p7);
+
+      vst1_u8(out + 0 * stride, p0);
+      vst1_u8(out + 1 * stride, p1);
+      vst1_u8(out + 2 * stride, p2);
+      vst1_u8(out + 3 * stride, p3);
+      vst1_u8(out + 4 * stride, p4);
+      vst1_u8(out + 5 * stride, p5);
+      vst1_u8(out + 6 * stride, p6);
+      vst1_u8(out + 7 * stride, p7);
+    }
+
+#	undef JPEG_MUL
+#	undef JPEG_MAC
+#	undef JPEG_WIDEN
+#	undef JPEG_WADD
+#	undef JPEG_WSUB
+#	undef JPEG_BUTTERFLY
+#	undef JPEG_PASS
+#	undef JPEG_TRN16
+#	undef JPEG_TRN32
+#	undef JPEG_TRN64
+#	undef JPEG_TRN8_8
+#	undef JPEG_TRN8_16
+#	undef JPEG_TRN8_32
+  }
+#else
+  static inline unsigned char clamp(int value)
+  {
+    return (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+  }
+
+  // One dimensional transform of 8 values, leaves even part in x0..x3 and odd part in t0..t3.
+#	define JPEG_IDCT_1D(s0, s1, s2, s3, s4, s5, s6, s7) \
+    int t0, t1, t2, t3, p1, p2, p3, p4, p5, x0, x1, x2, x3; \
+    p2 = s2; \
+    p3 = s6; \
+    p1 = (p2 + p3) * JPEG_FIX(0.5411961); \
+    t2 = p1 + p3 * JPEG_FIX(-1.847759065); \
+    t3 = p1 + p2 * JPEG_FIX(0.765366865); \
+    p2 = s0; \
+    p3 = s4; \
+    t0 = (p2 + p3) * 4096; \
+    t1 = (p2 - p3) * 4096; \
+    x0 = t0 + t3; \
+    x3 = t0 - t3; \
+    x1 = t1 + t2; \
+    x2 = t1 - t2; \
+    t0 = s7; \
+    t1 = s5; \
+    t2 = s3; \
+    t3 = s1; \
+    p3 = t0 + t2; \
+    p4 = t1 + t3; \
+    p1 = t0 + t3; \
+    p2 = t1 + t2; \
+    p5 = (p3 + p4) * JPEG_FIX(1.175875602); \
+    t0 = t0 * JPEG_FIX(0.298631336); \
+    t1 = t1 * JPEG_FIX(2.053119869); \
+    t2 = t2 * JPEG_FIX(3.072711026); \
+    t3 = t3 * JPEG_FIX(1.501321110); \
+    p1 = p5 + p1 * JPEG_FIX(-0.899976223); \
+    p2 = p5 + p2 * JPEG_FIX(-2.562915447); \
+    p3 = p3 * JPEG_FIX(-1.961570560); \
+    p4 = p4 * JPEG_FIX(-0.390180644); \
+    t3 += p1 + p4; \
+    t2 += p2 + p3; \
+    t1 += p2 + p4; \
+    t0 += p1 + p3;
+
+  static void idct_block(unsigned char* out, size_t stride, const short* data)
+  {
+    int values[64];
+
+    // Columns, 2 more bits are kept.
+    for (int i = 0; i < 8; ++i)
+    {
+      const short* d = data + i;
+      int* v = values + i;
+
+      JPEG_IDCT_1D(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56])
+
+      x0 += 512;
+      x1 += 512;
+      x2 += 512;
+      x3 += 512;
+
+      v[0] = (x0 + t3) >> 10;
+      v[56] = (x0 - t3) >> 10;
+      v[8] = (x1 + t2) >> 10;
+      v[48] = (x1 - t2) >> 10;
+      v[16] = (x2 + t1) >> 10;
+      v[40] = (x2 - t1) >> 10;
+      v[24] = (x3 + t0) >> 10;
+      v[32] = (x3 - t0) >> 10;
+    }
+
+    // Rows, scaled by 4096 in constants, 4 from columns and 8 from both passes, centered on 128.
+    for (int i = 0; i < 8; ++i, out += stride)
+    {
+      const int* v = values + i * 8;
+
+      JPEG_IDCT_1D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7])
+
+      x0 += 65536 + (128 << 17);
+      x1 += 65536 + (128 << 17);
+      x2 += 65536 + (128 << 17);
+      x3 += 65536 + (128 << 17);
+
+      out[0] = clamp((x0 + t3) >> 17);
+      out[7] = clamp((x0 - t3) >> 17);
+      out[1] = clamp((x1 + t2) >> 17);
+      out[6] = clamp((x1 - t2) >> 17);
+      out[2] = clamp((x2 + t1) >> 17);
+      out[5] = clamp((x2 - t1) >> 17);
+      out[3] = clamp((x3 + t0) >> 17);
+      out[4] = clamp((x3 - t0) >> 17);
+    }
+  }
+
+#	undef JPEG_IDCT_1D
+#endif
+
+  // Block of DC coefficient only is flat.
+  static void dc_block(unsigned char* out, size_t stride, int dc)
+  {
+    int value = ((dc + 4) >> 3) + 128;
+
+    memset(out, value < 0 ? 0 : value > 255 ? 255 : value, 8);
+
+    for (int i = 1; i < 8; ++i)
+      memcpy(out + i * stride, out, 8);
+  }
+
+  // Pixels are stored either by vector code, for 8 bit colours in 4 bytes, or from per colour tables.
+  struct PixelTarget
+  {
+    bool vector;
+    int bytes;
+    bool big_endian;
+
+    int red_shift;
+    int green_shift;
+    int blue_shift;
+
+    const unsigned int* red;
+    const unsigned int* green;
+    const unsigned int* blue;
+  };
+
+  // YCbCr to RGB in 14 bit fixed point, with JFIF coefficients.
+#	define JPEG_CR_RED 22970
+#	define JPEG_CB_GREEN -5638
+#	define JPEG_CR_GREEN -11700
+#	define JPEG_CB_BLUE 29032
+
+  static inline void store_pixel(char* pixel, int red, int green, int blue, const PixelTarget& target)
+  {
+    red = std::min(std::max(red, 0), 255);
+    green = std::min(std::max(green, 0), 255);
+    blue = std::min(std::max(blue, 0), 255);
+
+    unsigned int value = target.red[red] | target.green[green] | target.blue[blue];
+
+    for (int i = 0; i < target.bytes; ++i)
+      pixel[i] = (char)(value >> (target.big_endian ? (target.bytes - 1 - i) * 8 : i * 8));
+  }
+
+  static inline void convert_pixel(int y, int cb, int cr, char* pixel, const PixelTarget& target)
+  {
+    cb -= 128;
+    cr -= 128;
+
+    int red = y + ((cr * JPEG_CR_RED + 8192) >> 14);
+    int green = y + ((cb * JPEG_CB_GREEN + cr * JPEG_CR_GREEN + 8192) >> 14);
+    int blue = y + ((cb * JPEG_CB_BLUE + 8192) >> 14);
+
+    store_pixel(pixel, red, green, blue, target);
+  }
+
+  // Converts row of samples, chroma one is upsampled by repeating its samples. Rows of samples may be read up
+  // to 8 samples past width.
+  static void convert_row(const unsigned char* luma, const unsigned char* cb, const unsigned char* cr, int chroma_h,
+    char* out, int width, const PixelTarget& target)
+  {
+    int x = 0;
+
+#if defined(JPEG_SSE2)
+    if (target.vector)
+    {
+      __m128i zero = _mm_setzero_si128();
+      __m128i offset = _mm_set1_epi16(128);
+      __m128i round = _mm_set1_epi32(8192);
+      __m128i red_factors = _mm_setr_epi16(0, JPEG_CR_RED, 0, JPEG_CR_RED, 0, JPEG_CR_RED, 0, JPEG_CR_RED);
+      __m128i green_factors = _mm_setr_epi16(JPEG_CB_GREEN, JPEG_CR_GREEN, JPEG_CB_GREEN, JPEG_CR_GREEN,
+        JPEG_CB_GREEN, JPEG_CR_GREEN, JPEG_CB_GREEN, JPEG_CR_GREEN);
+      __m128i blue_factors = _mm_setr_epi16(JPEG_CB_BLUE, 0, JPEG_CB_BLUE, 0, JPEG_CB_BLUE, 0, JPEG_CB_BLUE, 0);
+      __m128i red_shift = _mm_cvtsi32_si128(target.red_shift);
+      __m128i green_shift = _mm_cvtsi32_si128(target.green_shift);
+      __m128i blue_shift = _mm_cvtsi32_si128(target.blue_shift);
+
+      for (; x + 8 <= width; x += 8)
+      {
+        __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(luma + x)), zero);
+        __m128i red = y;
+        __m128i green = y;
+        __m128i blue = y;
+
+        if (cb)
+        {
+          __m128i b;
+          __m128i r;
+
+          if (chroma_h == 2)
+          {
+            int word;
+
+            memcpy(&word, cb + x / 2, 4);
+            b = _mm_cvtsi32_si128(word);
+            b = _mm_unpacklo_epi8(b, b);
+
+            memcpy(&word, cr + x / 2, 4);
+            r = _mm_cvtsi32_si128(word);
+            r = _mm_unpacklo_epi8(r, r);
+          }
+          else
+          {
+            b = _mm_loadl_epi64((const __m128i*)(cb + x));
+            r = _mm_loadl_epi64((const __m128i*)(cr + x));
+          }
+
+          b = _mm_sub_epi16(_mm_unpacklo_epi8(b, zero), offset);
+          r = _mm_sub_epi16(_mm_unpacklo_epi8(r, zero), offset);
+
+          // Pairs of chroma samples, multiplied and summed to 32 bits.
+          __m128i low = _mm_unpacklo_epi16(b, r);
+          __m128i high = _mm_unpackhi_epi16(b, r);
+
+#	define JPEG_CHROMA(factors) _mm_packs_epi32( \
+            _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(low, factors), round), 14), \
+            _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(high, factors), round), 14))
+
+          red = _mm_add_epi16(red, JPEG_CHROMA(red_factors));
+          green = _mm_add_epi16(green, JPEG_CHROMA(green_factors));
+          blue = _mm_add_epi16(blue, JPEG_CHROMA(blue_factors));
+
+#	undef JPEG_CHROMA
+        }
+
+        // Clamped to 0..255 by packing, then widened to 32 bits and shifted into place.
+        red = _mm_unpacklo_epi8(_mm_packus_epi16(red, zero), zero);
+        green = _mm_unpacklo_epi8(_mm_packus_epi16(green, zero), zero);
+        blue = _mm_unpacklo_epi8(_mm_packus_epi16(blue, zero), zero);
+
+        __m128i low = _mm_or_si128(_mm_or_si128(
+          _mm_sll_epi32(_mm_unpacklo_epi16(red, zero), red_shift),
+          _mm_sll_epi32(_mm_unpacklo_epi16(green, zero), green_shift)),
+          _mm_sll_epi32(_mm_unpacklo_epi16(blue, zero), blue_shift));
+
+        __m128i high = _mm_or_si128(_mm_or_si128(
+          _mm_sll_epi32(_mm_unpackhi_epi16(red, zero), red_shift),
+          _mm_sll_epi32(_mm_unpackhi_epi16(green, zero), green_shift)),
+          _mm_sll_epi32(_mm_unpackhi_epi16(blue, zero), blue_shift));
+
+        _mm_storeu_si128((__m128i*)(out + x * 4), low);
+        _mm_storeu_si128((__m128i*)(out + x * 4 + 16), high);
+      }
+    }
+#elif defined(JPEG_NEON)
+    if (target.vector)
+    {
+      int16x8_t offset = vdupq_n_s16(128);
+      int32x4_t red_shift = vdupq_n_s32(target.red_shift);
+      int32x4_t green_shift = vdupq_n_s32(target.green_shift);
+      int32x4_t blue_shift = vdupq_n_s32(target.blue_shift);
+
+      for (; x + 8 <= width; x += 8)
+      {
+        int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(luma + x)));
+        uint8x8_t red8;
+        uint8x8_t green8;
+        uint8x8_t blue8;
+
+        if (cb)
+        {
+          uint8x8_t b8 = vld1_u8(cb + (chroma_h == 2 ? x / 2 : x));
+          uint8x8_t r8 = vld1_u8(cr + (chroma_h == 2 ? x / 2 : x));
+
+          if (chroma_h == 2)
+          {
+            b8 = vzip_u8(b8, b8).val[0];
+            r8 = vzip_u8(r8, r8).val[0];
+          }
+
+          int16x8_t b = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(b8)), offset);
+          int16x8_t r = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(r8)), offset);
+
+          int16x8_t red = vcombine_s16(vrshrn_n_s32(vmull_n_s16(vget_low_s16(r), JPEG_CR_RED), 14),
+            vrshrn_n_s32(vmull_n_s16(vget_high_s16(r), JPEG_CR_RED), 14));
+
+          int16x8_t green = vcombine_s16(
+            vrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(b), JPEG_CB_GREEN), vget_low_s16(r), JPEG_CR_GREEN), 14),
+            vrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(b), JPEG_CB_GREEN), vget_high_s16(r), JPEG_CR_GREEN), 14));
+
+          int16x8_t blue = vcombine_s16(vrshrn_n_s32(vmull_n_s16(vget_low_s16(b), JPEG_CB_BLUE), 14),
+            vrshrn_n_s32(vmull_n_s16(vget_high_s16(b), JPEG_CB_BLUE), 14));
+
+          red8 = vqmovun_s16(vaddq_s16(y, red));
+          green8 = vqmovun_s16(vaddq_s16(y, green));
+          blue8 = vqmovun_s16(vaddq_s16(y, blue));
+        }
+        else
+          red8 = green8 = blue8 = vqmovun_s16(y);
+
+        uint16x8_t red16 = vmovl_u8(red8);
+        uint16x8_t green16 = vmovl_u8(green8);
+        uint16x8_t blue16 = vmovl_u8(blue8);
+
+        uint32x4_t low = vorrq_u32(vorrq_u32(
+          vshlq_u32(vmovl_u16(vget_low_u16(red16)), red_shift),
+          vshlq_u32(vmovl_u16(vget_low_u16(green16)), green_shift)),
+          vshlq_u32(vmovl_u16(vget_low_u16(blue16)), blue_shift));
+
+        uint32x4_t high = vorrq_u32(vorrq_u32(
+          vshlq_u32(vmovl_u16(vget_high_u16(red16)), red_shift),
+          vshlq_u32(vmovl_u16(vget_high_u16(green16)), green_shift)),
+          vshlq_u32(vmovl_u16(vget_high_u16(blue16)), blue_shift));
+
+        vst1q_u8((uint8_t*)(out + x * 4), vreinterpretq_u8_u32(low));
+        vst1q_u8((uint8_t*)(out + x * 4 + 16), vreinterpretq_u8_u32(high));
+      }
+    }
+#endif
+
+    for (; x < width; ++x)
+    {
+      char* pixel = out + x * target.bytes;
+
+      if (cb)
+        convert_pixel(luma[x], cb[x / chroma_h], cr[x / chroma_h], pixel, target);
+      else
+        store_pixel(pixel, luma[x], luma[x], luma[x], target);
+    }
+  }
+
+  JpegDecoder::JpegDecoder()
+  {
+    memset(_quantization_defined, 0, sizeof(_quantization_defined));
+    memset(_dc_defined, 0, sizeof(_dc_defined));
+    memset(_ac_defined, 0, sizeof(_ac_defined));
+    memset(_components, 0, sizeof(_components));
+
+    _width = 0;
+    _height = 0;
+    _component_count = 0;
+    _h_max = 1;
+    _v_max = 1;
+    _restart_interval = 0;
+    _frame = false;
+  }
+
+  bool JpegDecoder::read_quantization(const unsigned char* data, size_t length)
+  {
+    while (length > 0)
+    {
+      int precision = data[0] >> 4;
+      int table = data[0] & 15;
+      size_t size = 1 + 64 * (precision ? 2 : 1);
+
+      if (table > 3 || precision > 1 || length < size)
+        return false;
+
+      for (int i = 0; i < 64; ++i)
+        _quantization[table][dezigzag[i]] = precision ? (data[1 + i * 2] << 8) | data[2 + i * 2] : data[1 + i];
+
+      _quantization_defined[table] = true;
+
+      data += size;
+      length -= size;
+    }
+
+    return true;
+  }
+
+  bool JpegDecoder::read_huffman(const unsigned char* data, size_t length)
+  {
+    while (length > 0)
+    {
+      if (length < 17)
+        return false;
+
+      int type = data[0] >> 4;
+      int table = data[0] & 15;
+      size_t count = 0;
+
+      for (int i = 0; i < 16; ++i)
+        count += data[1 + i];
+
+      if (type > 1 || table > 3 || count > 256 || length < 17 + count)
+        return false;
+
+      Huffman& huffman = type ? _ac[table] : _dc[table];
+
+      if (!huffman.build(data + 1, data + 17, type == 1))
+        return false;
+
+      (type ? _ac_defined : _dc_defined)[table] = true;
+
+      data += 17 + count;
+      length -= 17 + count;
+    }
+
+    return true;
+  }
+
+  bool JpegDecoder::read_frame(const unsigned char* data, size_t length, int width, int height)
+  {
+    if (length < 6)
+      return false;
+
+    int count = data[5];
+
+    if (data[0] != 8 || ((data[1] << 8) | data[2]) != height || ((data[3] << 8) | data[4]) != width ||
+      (count != 1 && count != 3) || length < 6 + (size_t)count * 3)
+      return false;
+
+    _width = width;
+    _height = height;
+    _component_count = count;
+    _h_max = 1;
+    _v_max = 1;
+
+    for (int i = 0; i < count; ++i)
+    {
+      Component& component = _components[i];
+      const unsigned char* c = data + 6 + i * 3;
+
+      component.id = c[0];
+      component.h = c[1] >> 4;
+      component.v = c[1] & 15;
+      component.quantization = c[2];
+
+      // Sampling of single component does not matter, its blocks are not interleaved.
+      if (count == 1)
+        component.h = component.v = 1;
+
+      if (component.h < 1 || component.h > 2 || component.v < 1 || component.v > 2 || component.quantization > 3)
+        return false;
+
+      _h_max = std::max(_h_max, component.h);
+      _v_max = std::max(_v_max, component.v);
+    }
+
+    // Luma is at full resolution, chroma components are sampled in the same way.
+    if (count == 3 && (_components[0].h != _h_max || _components[0].v != _v_max ||
+      _components[1].h != _components[2].h || _components[1].v != _components[2].v))
+      return false;
+
+    _frame = true;
+
+    return true;
+  }
+
+  bool JpegDecoder::decode(const unsigned char* data, size_t length, int width, int height, const PixelFormat& format,
+    char* destination, size_t stride, int visible_width, int visible_height)
+  {
+    memset(_quantization_defined, 0, sizeof(_quantization_defined));
+    memset(_dc_defined, 0, sizeof(_dc_defined));
+    memset(_ac_defined, 0, sizeof(_ac_defined));
+
+    _restart_interval = 0;
+    _frame = false;
+
+    if (!format.true_colour || length < 2 || data[0] != 0xff || data[1] != 0xd8)
+      return false;
+
+    for (unsigned int i = 0; i < 256; ++i)
+    {
+      _red[i] = ((i * format.red_max + 127) / 255) << format.red_shift;
+      _green[i] = ((i * format.green_max + 127) / 255) << format.green_shift;
+      _blue[i] = ((i * format.blue_max + 127) / 255) << format.blue_shift;
+    }
+
+    size_t position = 2;
+
+    while (position < length)
+    {
+      if (data[position] != 0xff)
+        return false;
+
+      // Markers may be preceded by any number of fill bytes.
+      while (position < length && data[position] == 0xff)
+        ++position;
+
+      if (position >= length)
+        return false;
+
+      int marker = data[position++];
+
+      if (marker == 0xd8 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+        continue;
+
+      // End of image before any scan.
+      if (marker == 0xd9 || position + 2 > length)
+        return false;
+
+      size_t size = (data[position] << 8) | data[position + 1];
+
+      if (size < 2 || position + size > length)
+        return false;
+
+      const unsigned char* segment = data + position + 2;
+      size_t segment_length = size - 2;
+
+      switch (marker)
+      {
+        case 0xdb: /* Quantization tables */
+          if (!read_quantization(segment, segment_length))
+            return false;
+          break;
+
+        case 0xc4: /* Huffman tables */
+          if (!read_huffman(segment, segment_length))
+            return false;
+          break;
+
+        case 0xc0: /* Baseline */
+        case 0xc1: /* Extended sequential, Huffman coded */
+          if (!read_frame(segment, segment_length, width, height))
+            return false;
+          break;
+
+        case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7: /* Progressive, lossless and hierarchical */
+        case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf: /* Arithmetic coding */
+          return false;
+
+        case 0xdd: /* Restart interval */
+          if (segment_length < 2)
+            return false;
+
+          _restart_interval = (segment[0] << 8) | segment[1];
+          break;
+
+        case 0xda: /* Start of scan */
+        {
+          if (!_frame || segment_length < 1)
+            return false;
+
+          int count = segment[0];
+
+          // All components in one scan, in order of frame.
+          if (count != _component_count || segment_length < 4 + (size_t)count * 2)
+            return false;
+
+          for (int i = 0; i < count; ++i)
+          {
+            Component& component = _components[i];
+            const unsigned char* c = segment + 1 + i * 2;
+
+            component.dc_table = c[1] >> 4;
+            component.ac_table = c[1] & 15;
+
+            if (c[0] != component.id || component.dc_table > 3 || component.ac_table > 3 ||
+              !_dc_defined[component.dc_table] || !_ac_defined[component.ac_table] ||
+              !_quantization_defined[component.quantization])
+              return false;
+          }
+
+          const unsigned char* selection = segment + 1 + count * 2;
+
+          if (selection[0] != 0 || selection[1] != 63 || selection[2] != 0)
+            return false;
+
+          BitReader reader(data + position + size, data + length);
+
+          return decode_scan(reader, format, destination, stride, visible_width, visible_height);
+        }
+
+        default: /* Application data and comments */
+          break;
+      }
+
+      position += size;
+    }
+
+    return false;
+  }
+
+  bool JpegDecoder::decode_scan(BitReader& reader, const PixelFormat& format, char* destination, size_t stride,
+    int visible_width, int visible_height)
+  {
+    int mcu_width = 8 * _h_max;
+    int mcu_height = 8 * _v_max;
+    int mcus_x = (_width + mcu_width - 1) / mcu_width;
+    int mcus_y = (_height + mcu_height - 1) / mcu_height;
+
+    // Planes hold a row of MCUs of each component, padded for vector reads past their end.
+    size_t planes_length = 16;
+
+    for (int i = 0; i < _component_count; ++i)
+    {
+      Component& component = _components[i];
+
+      component.plane_stride = mcus_x * component.h * 8;
+      component.dc = 0;
+
+      planes_length += component.plane_stride * component.v * 8;
+    }
+
+    if (_planes.size() < planes_length)
+      _planes.resize(planes_length);
+
+    unsigned char* plane = &_planes[0];
+
+    for (int i = 0; i < _component_count; ++i)
+    {
+      _components[i].plane = plane;
+      plane += _components[i].plane_stride * _components[i].v * 8;
+    }
+
+    short block[64];
+    int restart = _restart_interval;
+
+    for (int mcu_y = 0; mcu_y < mcus_y; ++mcu_y)
+    {
+      for (int mcu_x = 0; mcu_x < mcus_x; ++mcu_x)
+      {
+        if (_restart_interval && !restart--)
+        {
+          reader.restart();
+
+          for (int i = 0; i < _component_count; ++i)
+            _components[i].dc = 0;
+
+          restart = _restart_interval - 1;
+        }
+
+        for (int i = 0; i < _component_count; ++i)
+        {
+          Component& component = _components[i];
+
+          for (int y = 0; y < component.v; ++y)
+          {
+            for (int x = 0; x < component.h; ++x)
+            {
+              int last = decode_block(reader, component, block);
+
+              if (last < 0)
+                return false;
+
+              unsigned char* out = component.plane + y * 8 * component.plane_stride + (mcu_x * component.h + x) * 8;
+
+              // Flat blocks are common in screen content and much cheaper than transform.
+              if (last <= 1)
+                dc_block(out, component.plane_stride, block[0]);
+              else
+                idct_block(out, component.plane_stride, block);
+            }
+          }
+        }
+      }
+
+      int rows = std::min(mcu_height, visible_height - mcu_y * mcu_height);
+
+      if (rows > 0 && visible_width > 0)
+        store_rows(rows, format, destination + mcu_y * mcu_height * stride, stride, visible_width);
+
+      // Rows past visible ones are not decoded, data is taken whole anyway.
+      if ((mcu_y + 1) * mcu_height >= visible_height)
+        return true;
+    }
+
+    return true;
+  }
+
+  int JpegDecoder::decode_block(BitReader& reader, Component& component, short* block)
+  {
+    const Huffman& ac = _ac[component.ac_table];
+    const unsigned short* quantization = _quantization[component.quantization];
+
+    memset(block, 0, 64 * sizeof(short));
+
+    int size = _dc[component.dc_table].decode(reader);
+
+    if (size < 0 || size > 11)
+      return -1;
+
+    component.dc += size ? reader.receive(size) : 0;
+    block[0] = (short)(component.dc * quantization[0]);
+
+    int last = 1;
+
+    for (int k = 1; k < 64;)
+    {
+      if (reader.count < 16)
+        reader.fill();
+
+      int entry = ac.fast_ac[reader.peek(9)];
+
+      if (entry)
+      {
+        k += (entry >> 4) & 15;
+        reader.skip(entry & 15);
+
+        int position = dezigzag[k++];
+
+        block[position] = (short)((entry >> 8) * quantization[position]);
+        last = k;
+
+        continue;
+      }
+
+      int symbol = ac.decode(reader);
+
+      if (symbol < 0)
+        return -1;
+
+      int run = symbol >> 4;
+
+      size = symbol & 15;
+
+      // End of block, or run of 16 zeros.
+      if (!size)
+      {
+        if (run != 15)
+          break;
+
+        k += 16;
+
+        continue;
+      }
+
+      k += run;
+
+      int position = dezigzag[k++];
+
+      block[position] = (short)(reader.receive(size) * quantization[position]);
+      last = k;
+    }
+
+    return last;
+  }
+
+  void JpegDecoder::store_rows(int rows, const PixelFormat& format, char* destination, size_t stride, int width)
+  {
+    PixelTarget target;
+
+    target.bytes = format.bytes_per_pixel();
+    target.big_endian = format.big_endian;
+    target.red = _red;
+    target.green = _green;
+    target.blue = _blue;
+
+    // Colours in whole bytes of 4 byte pixels are shifted into place by vector code.
+    bool bytes = format.red_max == 255 && format.green_max == 255 && format.blue_max == 255 &&
+      format.red_shift <= 24 && format.green_shift <= 24 && format.blue_shift <= 24;
+    bool aligned = format.red_shift % 8 == 0 && format.green_shift % 8 == 0 && format.blue_shift % 8 == 0;
+
+    target.vector = target.bytes == 4 && bytes && (!format.big_endian || aligned);
+    target.red_shift = format.big_endian ? 24 - format.red_shift : format.red_shift;
+    target.green_shift = format.big_endian ? 24 - format.green_shift : format.green_shift;
+    target.blue_shift = format.big_endian ? 24 - format.blue_shift : format.blue_shift;
+
+    const Component& luma = _components[0];
+
+    for (int y = 0; y < rows; ++y, destination += stride)
+    {
+      const unsigned char* cb = 0;
+      const unsigned char* cr = 0;
+      int chroma_h = 1;
+
+      if (_component_count == 3)
+      {
+        const Component& blue = _components[1];
+        const Component& red = _components[2];
+        size_t offset = (y * blue.v / _v_max) * blue.plane_stride;
+
+        cb = blue.plane + offset;
+        cr = red.plane + offset;
+        chroma_h = _h_max / blue.h;
+      }
+
+      convert_row(luma.plane + y * luma.plane_stride, cb, cr, chroma_h, destination, width, target);
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef header_244c1c09_fbe8_4395_9d43_2b0278d9f6cd
+#define header_244c1c09_fbe8_4395_9d43_2b0278d9f6cd
+
+#include "rect_decoder.hpp"
+
+#include <vector>
+
+namespace Network
+{
+  // Baseline JPEG, as sent by Tight for photo-like content: Huffman coded 8 bit grayscale or YCbCr image, with
+  // chroma subsampled by up to 2 in each direction, in a single scan. Image is decoded a row of MCUs at a time
+  // and converted straight into framebuffer pixels.
+  class JpegDecoder
+  {
+  public:
+    JpegDecoder();
+
+    // Decodes image of given size, storing its part of visible width and height at destination.
+    // False when data is corrupt, image has different size, or it uses unsupported features.
+    bool decode(const unsigned char* data, size_t length, int width, int height, const PixelFormat& format,
+      char* destination, size_t stride, int visible_width, int visible_height);
+
+  private:
+    struct BitReader;
+
+    struct Huffman
+    {
+      // Codes of up to 9 bits are looked up by their bits, entry is length << 8 | symbol, zero for longer ones.
+      unsigned short fast[512];
+
+      // Longer codes: first code past those of each length, aligned to 16 bits, and offset of their symbols.
+      unsigned int maxcode[18];
+      int delta[17];
+
+      unsigned char symbols[256];
+
+      // AC coefficients with short code and value in one lookup: value << 8 | run << 4 | bits taken.
+      short fast_ac[512];
+
+      // Canonical codes from counts of codes of each length. False when there are too many of them.
+      bool build(const unsigned char* counts, const unsigned char* values, bool ac);
+
+      // Next symbol, or negative for invalid code.
+      int decode(BitReader& reader) const;
+    };
+
+    struct Component
+    {
+      int id;
+      int h;
+      int v;
+      int quantization;
+      int dc_table;
+      int ac_table;
+      int dc;
+
+      // Row of MCUs of the component, in samples.
+      unsigned char* plane;
+      size_t plane_stride;
+    };
+
+    bool read_quantization(const unsigned char* data, size_t length);
+    bool read_huffman(const unsigned char* data, size_t length);
+    bool read_frame(const unsigned char* data, size_t length, int width, int height);
+
+    bool decode_scan(BitReader& reader, const PixelFormat& format, char* destination, size_t stride,
+      int visible_width, int visible_height);
+
+    // Decodes and dequantizes block in natural order. Returns zigzag position past its last coefficient,
+    // negative when data is corrupt.
+    int decode_block(BitReader& reader, Component& component, short* block);
+
+    // Converts rows of decoded MCU row into framebuffer pixels.
+    void store_rows(int rows, const PixelFormat& format, char* destination, size_t stride, int width);
+
+  private:
+    unsigned short _quantization[4][64];
+    bool _quantization_defined[4];
+
+    Huffman _dc[4];
+    Huffman _ac[4];
+    bool _dc_defined[4];
+    bool _ac_defined[4];
+
+    int _width;
+    int _height;
+
+    Component _components[3];
+    int _component_count;
+    int _h_max;
+    int _v_max;
+    int _restart_interval;
+    bool _frame;
+
+    std::vector<unsigned char> _planes;
+
+    // Stored pixel of each colour value, for formats without vector conversion.
+    unsigned int _red[256];
+    unsigned int _green[256];
+    unsigned int _blue[256];
+  };
+}
+
+#endif
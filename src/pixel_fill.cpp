@@ -0,0 +1,94 @@
+#include "pixel_fill.hpp"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define PIXEL_FILL_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define PIXEL_FILL_NEON
+#endif
+
+namespace Network
+{
+  // Pattern of 32 bytes holds whole pixels for 1, 2 and 4 bytes per pixel, so any 16 or 32 byte step keeps
+  // pixels in place.
+  template <int BPP>
+  static void fill_rows(char* destination, size_t stride, int width, int height, const char* pixel)
+  {
+    if (BPP == 1)
+    {
+      for (int row = 0; row < height; ++row, destination += stride)
+        memset(destination, (unsigned char)pixel[0], width);
+
+      return;
+    }
+
+    unsigned char pattern[32];
+    for (int i = 0; i < 32; ++i)
+      pattern[i] = pixel[i % BPP];
+
+    size_t length = (size_t)width * BPP;
+
+#if defined(PIXEL_FILL_SSE2)
+    __m128i vector = _mm_loadu_si128((const __m128i*)pattern);
+#elif defined(PIXEL_FILL_NEON)
+    uint8x16_t vector = vld1q_u8(pattern);
+#endif
+
+    for (int row = 0; row < height; ++row, destination += stride)
+    {
+      char* p = destination;
+      char* end = destination + length;
+
+#if defined(PIXEL_FILL_SSE2)
+      for (; p + 32 <= end; p += 32)
+      {
+        _mm_storeu_si128((__m128i*)p, vector);
+        _mm_storeu_si128((__m128i*)(p + 16), vector);
+      }
+
+      if (p + 16 <= end)
+      {
+        _mm_storeu_si128((__m128i*)p, vector);
+        p += 16;
+      }
+#elif defined(PIXEL_FILL_NEON)
+      for (; p + 16 <= end; p += 16)
+        vst1q_u8((uint8_t*)p, vector);
+#else
+      for (; p + 32 <= end; p += 32)
+        memcpy(p, pattern, 32);
+#endif
+
+      memcpy(p, pattern, end - p);
+    }
+  }
+
+  void fill_rect(char* destination, size_t stride, int width, int height, int bpp, const char* pixel)
+  {
+    if (width <= 0 || height <= 0)
+      return;
+
+    switch (bpp)
+    {
+      case 1:
+        fill_rows<1>(destination, stride, width, height, pixel);
+        break;
+      case 2:
+        fill_rows<2>(destination, stride, width, height, pixel);
+        break;
+      case 4:
+        fill_rows<4>(destination, stride, width, height, pixel);
+        break;
+      default:
+        for (int row = 0; row < height; ++row, destination += stride)
+        {
+          for (int x = 0; x < width; ++x)
+            memcpy(destination + x * bpp, pixel, bpp);
+        }
+        break;
+    }
+  }
+}
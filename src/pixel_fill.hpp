@@ -0,0 +1,26 @@
+#ifndef header_31723c12_7432_4a19_aa22_3db4adf684ea
+#define header_31723c12_7432_4a19_aa22_3db4adf684ea
+
+#include <stddef.h>
+#include <string.h>
+
+namespace Network
+{
+  // Fills width * height pixels of framebuffer rows with one pixel of bpp bytes, as stored in framebuffer.
+  // Rows are filled with 16 byte vector stores where SSE2 or NEON is available.
+  void fill_rect(char* destination, size_t stride, int width, int height, int bpp, const char* pixel);
+
+  // Fill of small areas, such as subrectangles of tiles, for decoders specialized per bytes per pixel.
+  // Fixed size copies compile to single moves, without per-pixel branches.
+  template <int BPP>
+  inline void fill_tile(char* destination, size_t stride, int width, int height, const char* pixel)
+  {
+    for (int row = 0; row < height; ++row, destination += stride)
+    {
+      for (int x = 0; x < width; ++x)
+        memcpy(destination + x * BPP, pixel, BPP);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,623 @@
+#include "png_decoder.hpp"
+
+#include "cryptoppmin/zlib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define PNG_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define PNG_NEON
+#endif
+
+namespace Network
+{
+#	define PNG_CHUNK(a, b, c, d) (((unsigned int)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+#	define PNG_IHDR PNG_CHUNK('I', 'H', 'D', 'R')
+#	define PNG_PLTE PNG_CHUNK('P', 'L', 'T', 'E')
+#	define PNG_IDAT PNG_CHUNK('I', 'D', 'A', 'T')
+#	define PNG_IEND PNG_CHUNK('I', 'E', 'N', 'D')
+
+  // Room past end of rows for vector loads and stores.
+#	define PNG_ROW_PADDING 32
+
+  static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+  enum PngFilter
+  {
+    png_filter_none = 0,
+    png_filter_sub = 1,
+    png_filter_up = 2,
+    png_filter_average = 3,
+    png_filter_paeth = 4
+  };
+
+  static inline unsigned int load_u32(const unsigned char* data)
+  {
+    return ((unsigned int)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+  }
+
+  // Takes output of Inflator as rows of image.
+  class PngSink: public CryptoPP::Bufferless<CryptoPP::Sink>
+  {
+  public:
+    PngSink(PngDecoder* decoder)
+    {
+      _decoder = decoder;
+    }
+
+    size_t Put2(const byte* data, size_t length, int, bool)
+    {
+      _decoder->take_rows(data, length);
+
+      return 0;
+    }
+
+  private:
+    PngDecoder* _decoder;
+  };
+
+  static inline int paeth(int a, int b, int c)
+  {
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - c - c);
+
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+  }
+
+  // Bytes of single byte pixels depend on each other one after another, there is nothing to vectorize.
+  static void unfilter_bytes(int filter, unsigned char* row, const unsigned char* previous, size_t length, int bpp)
+  {
+    size_t i = 0;
+
+    switch (filter)
+    {
+      case png_filter_sub:
+        for (i = bpp; i < length; ++i)
+          row[i] = (unsigned char)(row[i] + row[i - bpp]);
+        break;
+
+      case png_filter_average:
+        for (; i < (size_t)bpp; ++i)
+          row[i] = (unsigned char)(row[i] + (previous[i] >> 1));
+
+        for (; i < length; ++i)
+          row[i] = (unsigned char)(row[i] + ((row[i - bpp] + previous[i]) >> 1));
+        break;
+
+      case png_filter_paeth:
+        for (; i < (size_t)bpp; ++i)
+          row[i] = (unsigned char)(row[i] + previous[i]);
+
+        for (; i < length; ++i)
+          row[i] = (unsigned char)(row[i] + paeth(row[i - bpp], previous[i], previous[i - bpp]));
+        break;
+    }
+  }
+
+  // Up filter has no dependency within row, other ones depend on the pixel to the left, so colours of a pixel
+  // are unfiltered together in one register. Pixels are loaded as 4 bytes, 3 byte ones are stored as 3.
+  static void unfilter_row(int filter, unsigned char* row, const unsigned char* previous, size_t length, int bpp)
+  {
+    if (filter == png_filter_none)
+      return;
+
+    if (filter == png_filter_up)
+    {
+      size_t i = 0;
+
+#if defined(PNG_SSE2)
+      for (; i < length; i += 16)
+        _mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(row + i)),
+          _mm_loadu_si128((const __m128i*)(previous + i))));
+#elif defined(PNG_NEON)
+      for (; i < length; i += 16)
+        vst1q_u8(row + i, vaddq_u8(vld1q_u8(row + i), vld1q_u8(previous + i)));
+#endif
+
+      for (; i < length; ++i)
+        row[i] = (unsigned char)(row[i] + previous[i]);
+
+      return;
+    }
+
+#if defined(PNG_SSE2)
+    if (bpp == 3 || bpp == 4)
+    {
+      __m128i zero = _mm_setzero_si128();
+      __m128i a = zero;
+      int word;
+
+      if (filter == png_filter_sub)
+      {
+        for (size_t i = 0; i < length; i += bpp)
+        {
+          memcpy(&word, row + i, 4);
+          a = _mm_add_epi8(a, _mm_cvtsi32_si128(word));
+
+          word = _mm_cvtsi128_si32(a);
+          memcpy(row + i, &word, bpp);
+        }
+      }
+      else if (filter == png_filter_average)
+      {
+        __m128i one = _mm_set1_epi8(1);
+
+        for (size_t i = 0; i < length; i += bpp)
+        {
+          memcpy(&word, previous + i, 4);
+          __m128i b = _mm_cvtsi32_si128(word);
+
+          // Rounding average is one too much where the sum is odd.
+          __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+
+          memcpy(&word, row + i, 4);
+          a = _mm_add_epi8(average, _mm_cvtsi32_si128(word));
+
+          word = _mm_cvtsi128_si32(a);
+          memcpy(row + i, &word, bpp);
+        }
+      }
+      else
+      {
+        // Distances are computed in 16 bits, left pixel wins ties over above one, and that over above left.
+        __m128i b = zero;
+        __m128i c = zero;
+
+        for (size_t i = 0; i < length; i += bpp)
+        {
+          c = b;
+
+          memcpy(&word, previous + i, 4);
+          b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero);
+
+          __m128i pa = _mm_sub_epi16(b, c);
+          __m128i pb = _mm_sub_epi16(a, c);
+          __m128i pc = _mm_add_epi16(pa, pb);
+
+          pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+          pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+          pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+          __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+          __m128i use_a = _mm_cmpeq_epi16(smallest, pa);
+          __m128i use_b = _mm_cmpeq_epi16(smallest, pb);
+
+          __m128i nearest = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+          nearest = _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, nearest));
+
+          memcpy(&word, row + i, 4);
+          a = _mm_and_si128(_mm_add_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), nearest), _mm_set1_epi16(0xff));
+
+          word = _mm_cvtsi128_si32(_mm_packus_epi16(a, zero));
+          memcpy(row + i, &word, bpp);
+        }
+      }
+
+      return;
+    }
+#elif defined(PNG_NEON)
+    if (bpp == 3 || bpp == 4)
+    {
+      uint8x8_t a = vdup_n_u8(0);
+      uint32_t word;
+
+      if (filter == png_filter_sub)
+      {
+        for (size_t i = 0; i < length; i += bpp)
+        {
+          memcpy(&word, row + i, 4);
+          a = vadd_u8(a, vreinterpret_u8_u32(vdup_n_u32(word)));
+
+          word = vget_lane_u32(vreinterpret_u32_u8(a), 0);
+          memcpy(row + i, &word, bpp);
+        }
+      }
+      else if (filter == png_filter_average)
+      {
+        for (size_t i = 0; i < length; i += bpp)
+        {
+          memcpy(&word, previous + i, 4);
+          uint8x8_t average = vhadd_u8(a, vreinterpret_u8_u32(vdup_n_u32(word)));
+
+          memcpy(&word, row + i, 4);
+          a = vadd_u8(average, vreinterpret_u8_u32(vdup_n_u32(word)));
+
+          word = vget_lane_u32(vreinterpret_u32_u8(a), 0);
+          memcpy(row + i, &word, bpp);
+        }
+      }
+      else
+      {
+        uint8x8_t b = a;
+        uint8x8_t c = a;
+
+        for (size_t i = 0; i < length; i += bpp)
+        {
+          c = b;
+
+          memcpy(&word, previous + i, 4);
+          b = vreinterpret_u8_u32(vdup_n_u32(word));
+
+          // Distances in 16 bits, left pixel wins ties over above one, and that over above left.
+          uint16x8_t pa = vabdl_u8(b, c);
+          uint16x8_t pb = vabdl_u8(a, c);
+          uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+
+          uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+          uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+
+          uint8x8_t nearest = vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+
+          memcpy(&word, row + i, 4);
+          a = vadd_u8(nearest, vreinterpret_u8_u32(vdup_n_u32(word)));
+
+          word = vget_lane_u32(vreinterpret_u32_u8(a), 0);
+          memcpy(row + i, &word, bpp);
+        }
+      }
+
+      return;
+    }
+#endif
+
+    unfilter_bytes(filter, row, previous, length, bpp);
+  }
+
+  template <int BPP>
+  static void store_indices(const unsigned char* row, const char (*palette)[4], char* destination, int width)
+  {
+    for (int x = 0; x < width; ++x)
+      memcpy(destination + x * BPP, palette[row[x]], BPP);
+  }
+
+  template <int BPP>
+  static void store_colours(const unsigned char* row, int channels, const unsigned int* red, const unsigned int* green,
+    const unsigned int* blue, bool big_endian, char* destination, int width)
+  {
+    for (int x = 0; x < width; ++x, row += channels, destination += BPP)
+    {
+      unsigned int value = red[row[0]] | green[row[1]] | blue[row[2]];
+
+      for (int i = 0; i < BPP; ++i)
+        destination[i] = (char)(value >> (big_endian ? (BPP - 1 - i) * 8 : i * 8));
+    }
+  }
+
+  PngDecoder::PngDecoder()
+  {
+    _inflator = 0;
+
+    _state = state_end;
+    _valid = false;
+    _complete = false;
+
+    _header_length = 0;
+    _chunk_type = 0;
+    _chunk_remaining = 0;
+    _chunk_length = 0;
+    _image_header = false;
+
+    _width = 0;
+    _height = 0;
+    _colour_type = 0;
+    _channels = 0;
+
+    memset(&_format, 0, sizeof(_format));
+    _destination = 0;
+    _stride = 0;
+    _visible_width = 0;
+    _visible_height = 0;
+
+    _row_length = 0;
+    _row_fill = 0;
+    _filter = 0;
+    _y = 0;
+
+    _row = 0;
+    _previous = 0;
+  }
+
+  PngDecoder::~PngDecoder()
+  {
+    // Sink is owned by inflator.
+    delete _inflator;
+  }
+
+  void PngDecoder::start(int width, int height, const PixelFormat& format, char* destination, size_t stride,
+    int visible_width, int visible_height)
+  {
+    _state = state_signature;
+    _valid = true;
+    _header_length = 0;
+    _image_header = false;
+
+    _width = width;
+    _height = height;
+
+    _format = format;
+    _destination = destination;
+    _stride = stride;
+    _visible_width = visible_width;
+    _visible_height = visible_height;
+
+    _y = 0;
+
+    // Image which is not seen is not decoded at all.
+    _complete = !destination || visible_width <= 0 || visible_height <= 0;
+  }
+
+  bool PngDecoder::complete() const
+  {
+    return _complete;
+  }
+
+  bool PngDecoder::read_header()
+  {
+    const unsigned char* c = _chunk;
+
+    if (_chunk_length != 13 || (int)load_u32(c) != _width || (int)load_u32(c + 4) != _height)
+      return false;
+
+    int depth = c[8];
+
+    _colour_type = c[9];
+
+    // 8 bit colours, deflate, adaptive filters, no interlace.
+    if (depth != 8 || c[10] != 0 || c[11] != 0 || c[12] != 0)
+      return false;
+
+    if (_colour_type == colour_rgb)
+      _channels = 3;
+    else if (_colour_type == colour_rgba)
+      _channels = 4;
+    else if (_colour_type == colour_palette)
+      _channels = 1;
+    else
+      return false;
+
+    _row_length = (size_t)_width * _channels;
+    _row_fill = 0;
+
+    _rows.assign((_row_length + PNG_ROW_PADDING) * 2, 0);
+    _row = &_rows[0];
+    _previous = _row + _row_length + PNG_ROW_PADDING;
+
+    if (_colour_type == colour_palette)
+      memset(_palette, 0, sizeof(_palette));
+    else
+    {
+      for (unsigned int i = 0; i < 256; ++i)
+      {
+        _red[i] = ((i * _format.red_max + 127) / 255) << _format.red_shift;
+        _green[i] = ((i * _format.green_max + 127) / 255) << _format.green_shift;
+        _blue[i] = ((i * _format.blue_max + 127) / 255) << _format.blue_shift;
+      }
+    }
+
+    // Every image is a new zlib stream.
+    delete _inflator;
+    _inflator = new CryptoPP::ZlibDecompressor(new PngSink(this));
+
+    _image_header = true;
+
+    return true;
+  }
+
+  void PngDecoder::read_palette()
+  {
+    // Indices past palette size pick zeroed entries.
+    memset(_palette, 0, sizeof(_palette));
+
+    for (size_t i = 0; i < _chunk_length / 3; ++i)
+      _format.store_rgb(_palette[i], _chunk[i * 3], _chunk[i * 3 + 1], _chunk[i * 3 + 2]);
+  }
+
+  bool PngDecoder::end_chunk()
+  {
+    switch (_chunk_type)
+    {
+      case PNG_IHDR:
+        return read_header();
+
+      case PNG_PLTE:
+        if (_colour_type == colour_palette)
+          read_palette();
+        return true;
+
+      case PNG_IEND:
+        if (!_image_header)
+          return false;
+
+        // Rows held back by inflator come out, and stream must have ended with its checksum.
+        try
+        {
+          _inflator->Flush(true);
+          _inflator->MessageEnd();
+        }
+        catch (const CryptoPP::Exception&)
+        {
+          return false;
+        }
+
+        return _complete;
+    }
+
+    return true;
+  }
+
+  bool PngDecoder::write(const unsigned char* data, size_t length)
+  {
+    while (length > 0 && _valid && !_complete)
+    {
+      if (_state == state_chunk_data)
+      {
+        size_t chunk = std::min(length, _chunk_remaining);
+
+        if (_chunk_type == PNG_IDAT)
+        {
+          try
+          {
+            _inflator->Put(data, chunk);
+          }
+          catch (const CryptoPP::Exception&)
+          {
+            _valid = false;
+          }
+        }
+        else if (_chunk_type == PNG_IHDR || _chunk_type == PNG_PLTE)
+        {
+          memcpy(_chunk + _chunk_length, data, chunk);
+          _chunk_length += chunk;
+        }
+
+        data += chunk;
+        length -= chunk;
+
+        _chunk_remaining -= chunk;
+
+        if (!_chunk_remaining)
+        {
+          _valid = _valid && end_chunk();
+          _state = state_chunk_crc;
+        }
+
+        continue;
+      }
+
+      if (_state == state_end)
+        break;
+
+      // Signature, chunk length and type, and checksum are collected as they arrive.
+      size_t needed = _state == state_chunk_crc ? 4 : 8;
+      size_t part = std::min(length, needed - _header_length);
+
+      memcpy(_header + _header_length, data, part);
+
+      data += part;
+      length -= part;
+
+      _header_length += part;
+
+      if (_header_length < needed)
+        break;
+
+      _header_length = 0;
+
+      if (_state == state_signature)
+      {
+        _valid = memcmp(_header, png_signature, 8) == 0;
+        _state = state_chunk_header;
+      }
+      else if (_state == state_chunk_crc)
+      {
+        // Checksum of chunks is not checked, image data has its own one in zlib stream.
+        _state = _chunk_type == PNG_IEND ? state_end : state_chunk_header;
+      }
+      else
+      {
+        _chunk_remaining = load_u32(_header);
+        _chunk_type = load_u32(_header + 4);
+        _chunk_length = 0;
+
+        // Image header comes first and only once, chunks which are kept must fit, image data needs header.
+        if ((_chunk_type == PNG_IHDR) == _image_header ||
+          (_chunk_type == PNG_IHDR && _chunk_remaining != 13) ||
+          (_chunk_type == PNG_PLTE && (_chunk_remaining > sizeof(_chunk) || _chunk_remaining % 3)))
+          _valid = false;
+
+        if (_chunk_remaining)
+          _state = state_chunk_data;
+        else
+        {
+          _valid = _valid && end_chunk();
+          _state = _chunk_type == PNG_IEND ? state_end : state_chunk_crc;
+        }
+      }
+    }
+
+    return _valid;
+  }
+
+  void PngDecoder::take_rows(const unsigned char* data, size_t length)
+  {
+    while (length > 0 && _valid && !_complete)
+    {
+      if (!_row_fill)
+      {
+        _filter = *data++;
+        --length;
+
+        if (_filter > png_filter_paeth)
+        {
+          _valid = false;
+          return;
+        }
+
+        _row_fill = 1;
+
+        continue;
+      }
+
+      size_t part = std::min(length, _row_length + 1 - _row_fill);
+
+      memcpy(_row + _row_fill - 1, data, part);
+
+      data += part;
+      length -= part;
+
+      _row_fill += part;
+
+      if (_row_fill <= _row_length)
+        break;
+
+      unfilter_row(_filter, _row, _previous, _row_length, _channels);
+      store_row(_row);
+
+      std::swap(_row, _previous);
+
+      _row_fill = 0;
+
+      // Rows below visible ones are not needed.
+      if (++_y >= _visible_height)
+        _complete = true;
+    }
+  }
+
+  void PngDecoder::store_row(const unsigned char* row)
+  {
+    char* destination = _destination + _y * _stride;
+    int width = _visible_width;
+
+    switch (_format.bytes_per_pixel())
+    {
+      case 1:
+        if (_colour_type == colour_palette)
+          store_indices<1>(row, _palette, destination, width);
+        else
+          store_colours<1>(row, _channels, _red, _green, _blue, _format.big_endian, destination, width);
+        break;
+
+      case 2:
+        if (_colour_type == colour_palette)
+          store_indices<2>(row, _palette, destination, width);
+        else
+          store_colours<2>(row, _channels, _red, _green, _blue, _format.big_endian, destination, width);
+        break;
+
+      case 4:
+        if (_colour_type == colour_palette)
+          store_indices<4>(row, _palette, destination, width);
+        else
+          store_colours<4>(row, _channels, _red, _green, _blue, _format.big_endian, destination, width);
+        break;
+    }
+  }
+}
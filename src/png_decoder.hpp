@@ -0,0 +1,112 @@
+#ifndef header_d7c23050_16aa_4164_9a4d_38c7bb46c435
+#define header_d7c23050_16aa_4164_9a4d_38c7bb46c435
+
+#include "rect_decoder.hpp"
+
+#include <vector>
+
+namespace CryptoPP
+{
+  class ZlibDecompressor;
+}
+
+namespace Network
+{
+  class PngSink;
+
+  // PNG, as sent by TightPNG: 8 bit RGB, RGBA or palette image, not interlaced. Image data is inflated and
+  // unfiltered a row at a time as it arrives, only the previous row is kept, and rows go straight into
+  // framebuffer pixels. Alpha is dropped.
+  class PngDecoder
+  {
+    friend class PngSink;
+
+  public:
+    PngDecoder();
+    ~PngDecoder();
+
+    // Starts image of given size, storing its part of visible width and height at destination.
+    void start(int width, int height, const PixelFormat& format, char* destination, size_t stride,
+      int visible_width, int visible_height);
+
+    // Takes next part of image as it arrives. False when data is corrupt, image has different size, or it
+    // uses unsupported features.
+    bool write(const unsigned char* data, size_t length);
+
+    // Whether all visible rows are stored. Data past them is not decoded.
+    bool complete() const;
+
+  private:
+    enum State
+    {
+      state_signature = 0,
+      state_chunk_header = 1,
+      state_chunk_data = 2,
+      state_chunk_crc = 3,
+      state_end = 4
+    };
+
+    enum ColourType
+    {
+      colour_rgb = 2,
+      colour_palette = 3,
+      colour_rgba = 6
+    };
+
+    bool read_header();
+    void read_palette();
+    bool end_chunk();
+
+    // Inflated data, filter byte and filtered bytes of every row.
+    void take_rows(const unsigned char* data, size_t length);
+
+    // Unfiltered row goes into framebuffer.
+    void store_row(const unsigned char* row);
+
+  private:
+    CryptoPP::ZlibDecompressor* _inflator;
+
+    int _state;
+    bool _valid;
+    bool _complete;
+
+    unsigned char _header[8];
+    size_t _header_length;
+
+    unsigned int _chunk_type;
+    size_t _chunk_remaining;
+    size_t _chunk_length;
+    unsigned char _chunk[768];
+    bool _image_header;
+
+    int _width;
+    int _height;
+    int _colour_type;
+    int _channels;
+
+    PixelFormat _format;
+    char* _destination;
+    size_t _stride;
+    int _visible_width;
+    int _visible_height;
+
+    size_t _row_length;
+    size_t _row_fill;
+    int _filter;
+    int _y;
+
+    // Current and previous row, with room for vector loads and stores past their ends.
+    std::vector<unsigned char> _rows;
+    unsigned char* _row;
+    unsigned char* _previous;
+
+    char _palette[256][4];
+
+    // Stored pixel of each colour value, summed into pixels of RGB images.
+    unsigned int _red[256];
+    unsigned int _green[256];
+    unsigned int _blue[256];
+  };
+}
+
+#endif
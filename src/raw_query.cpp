@@ -1,4 +1,7 @@
 #include "raw_query.hpp"
+#include "session_reactor.hpp"
+#include "uring_transport.hpp"
+#include "connector.hpp"
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -6,13 +9,19 @@
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#define	TCP_NODELAY	 1	/* Don't delay send to coalesce packets  */
+#include <poll.h>
+#include <math.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #define closesocket close
 #include <time.h>
 #include <sys/time.h>
@@ -24,12 +33,66 @@
 #include <stdarg.h>
 
 #include <algorithm>
+#include <chrono>
 
 namespace Network
 {	
 #	define REQUEST_SIZE 1024
-#	define SEND_BUFFER_SIZE 2048
 #	define RECV_BUFFER_SIZE 2048
+#	define MAX_RECV_BUFFER_SIZE (1024 * 1024)
+#	define DEFAULT_READ_BUDGET (4 * 1024 * 1024)
+#	define WAKEUP_SIGNAL_SIZE 8
+#	define DISCARD_BUFFER_SIZE 65536
+#	define MAX_DIRECT_SEGMENTS 128
+#	define MAX_SEND_SEGMENTS 64
+#	define RECONNECT_DELAY 0.25f
+
+#ifdef WIN32
+  typedef WSABUF Segment;
+
+  inline void set_segment(Segment& segment, char* data, size_t length)
+  {
+    segment.buf = data;
+    segment.len = (ULONG)length;
+  }
+#else
+  typedef iovec Segment;
+
+  inline void set_segment(Segment& segment, char* data, size_t length)
+  {
+    segment.iov_base = data;
+    segment.iov_len = length;
+  }
+#endif
+
+  inline int receive_segments(Socket socket, Segment* segments, int count)
+  {
+#ifdef WIN32
+    DWORD received = 0, flags = 0;
+    return WSARecv(socket, segments, count, &received, &flags, 0, 0) == 0 ? (int)received : -1;
+#else
+    return (int)::readv(socket, segments, count);
+#endif
+  }
+
+  inline int send_segments(Socket socket, Segment* segments, int count)
+  {
+#ifdef WIN32
+    DWORD sent = 0;
+    return WSASend(socket, segments, count, &sent, 0, 0, 0) == 0 ? (int)sent : -1;
+#else
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = segments;
+    message.msg_iovlen = count;
+
+#ifdef MSG_NOSIGNAL
+    return (int)::sendmsg(socket, &message, MSG_NOSIGNAL);
+#else
+    return (int)::sendmsg(socket, &message, 0);
+#endif
+#endif
+  }
 
   inline bool would_block(int r)
   {
@@ -42,14 +105,78 @@ namespace Network
 #endif
   }	
 
-  RawStream::RawStream(const char* hostname, const char* port)
-    : _socket(0), _resolved(0), _state(state_none), _error(STREAM_NO_ERROR), _hostname(hostname), _port(port), _no_more_data(false), _timeout(-1)
+  SocketOptions::SocketOptions()
+    : receive_buffer(0), send_buffer(0), no_delay(true), quick_ack(false), busy_poll(0), keepalive_idle(0), keepalive_interval(0), keepalive_count(0), not_sent_lowat(0)
   {
   }
 
+  SocketOptions SocketOptions::low_latency()
+  {
+    SocketOptions options;
+    options.quick_ack = true;
+    options.busy_poll = 50;
+    options.keepalive_idle = 5;
+    options.keepalive_interval = 1;
+    options.keepalive_count = 3;
+    options.not_sent_lowat = 16384;
+
+    return options;
+  }
+
+  SocketOptions SocketOptions::bulk_transfer()
+  {
+    SocketOptions options;
+    options.receive_buffer = 4 * 1024 * 1024;
+    options.keepalive_idle = 60;
+    options.keepalive_interval = 10;
+    options.keepalive_count = 6;
+
+    return options;
+  }
+
+  RawStream::RawStream(const char* hostname, const char* port, Transport transport, const SocketOptions& options)
+    : _state(state_none), _transport(transport), _options(options), _uring(0), _uring_connected(false), _reconnect_attempts(0), _reconnect_failures(0), _reconnect_max_delay(0),
+      _hostname(hostname), _port(port ? port : ""), _socket(0), _error(STREAM_NO_ERROR), _no_more_data(false), _hold_input(false), _holding(false), _direct_offset(0), _direct_length(0), _read_size(RECV_BUFFER_SIZE), _read_budget(DEFAULT_READ_BUDGET), _direct_send(false), _reactor(0), _reactor_session(0),
+      _timeout(-1), _start(0), _connect_timeout(0), _handshake_timeout(0), _idle_timeout(0), _phase_start(0), _last_receive(0), _session_ready(false)
+  {
+    memset(&_direct, 0, sizeof(_direct));
+    memset(&_statistics, 0, sizeof(_statistics));
+
+    _waiting = false;
+
+    open_wakeup(_wakeup);
+  }
+
+  RawStream::RawStream(Socket socket, Transport transport, const SocketOptions& options)
+    : _state(state_none), _transport(transport), _options(options), _uring(0), _uring_connected(false), _reconnect_attempts(0), _reconnect_failures(0), _reconnect_max_delay(0),
+      _socket(0), _error(STREAM_NO_ERROR), _no_more_data(false), _hold_input(false), _holding(false), _direct_offset(0), _direct_length(0), _read_size(RECV_BUFFER_SIZE), _read_budget(DEFAULT_READ_BUDGET), _direct_send(false), _reactor(0), _reactor_session(0),
+      _timeout(-1), _start(0), _connect_timeout(0), _handshake_timeout(0), _idle_timeout(0), _phase_start(0), _last_receive(0), _session_ready(false)
+  {
+    memset(&_direct, 0, sizeof(_direct));
+    memset(&_statistics, 0, sizeof(_statistics));
+
+    _waiting = false;
+
+    open_wakeup(_wakeup);
+
+#ifdef WIN32
+    unsigned long mode = 1;
+    ioctlsocket(socket, FIONBIO, &mode);
+#else
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    adopt(socket);
+  }
+
   RawStream::~RawStream()
   {
+    if (_reactor)
+      _reactor->remove(this);
+
     close();
+
+    close_wakeup(_wakeup);
   }
 
   void RawStream::disconnect()
@@ -59,122 +186,280 @@ namespace Network
 
   void RawStream::close()
   {
-    if (_resolved)
+    if (_reactor)
+      _reactor->unwatch(this);
+
+    if (_connect)
+    {
+      Connector::instance().cancel(_connect);
+      _connect.reset();
+    }
+
+    if (_uring)
     {
-      freeaddrinfo((addrinfo*)_resolved);
-      _resolved = 0;
+      delete _uring;
+      _uring = 0;
+      _uring_connected = false;
     }
 
     if (_socket)
     {
+      // Other threads may be sending directly.
+      std::lock_guard<std::mutex> lock(_request_lock);
+
       ::shutdown(_socket, 2);
       ::closesocket(_socket);
       _socket = 0;
     }
   }  
 
-  bool RawStream::resolve()
+  bool RawStream::connect()
   {
     _state = state_none;
 
     close();
 
-    if (!_resolved)
+    // Resolving and connecting happens on connector threads, which wake us up when done.
+    _connect = Connector::instance().connect(_hostname.c_str(), _port.c_str(), [this]()
     {
-      addrinfo hints = { 0 }, *resolved = 0;
-      hints.ai_family = AF_INET;
-      hints.ai_socktype = SOCK_STREAM;
+      notify_connected();
+    });
 
-      if (getaddrinfo(_hostname.c_str(), _port.c_str(), &hints, &resolved)) 
-      {
-        _resolved = 0;
+    _state = state_connecting;
+    _phase_start = monotonic_time();
 
-        set_error(STREAM_TCP_ERROR, "Could not resolve destination address");
-      }
-      else      
+    return true;
+  }
+
+  void RawStream::notify_connected()
+  {
+    if (_reactor)
+      _reactor->schedule(this);
+    else
+      wakeup();
+  }
+
+  bool RawStream::reconnect()
+  {
+    // Streams which took over a socket have nowhere to reconnect to.
+    if (!_last_connect || !_reconnect_attempts)
+      return false;
+
+    if (_reconnect_attempts > 0 && _reconnect_failures >= _reconnect_attempts)
+      return false;
+
+    float delay = 0;
+    if (_reconnect_failures)
+      delay = std::min(_reconnect_max_delay, RECONNECT_DELAY * (float)(1 << std::min(_reconnect_failures - 1, 16)));
+
+    ++_reconnect_failures;
+    ++_statistics.reconnects;
+
+    close();
+
+    {
+      std::lock_guard<std::mutex> lock(_request_lock);
+
+      // While session is set up, only its handshake is queued and that is useless for the new one.
+      // Otherwise whole messages go out again, but one which was partly sent cannot be completed.
+      if (_holding)
+        _request.clear();
+      else
       {
-        _resolved = (addrinfo*)resolved;
+        _request.drop_partial();
+
+        if (_hold_input)
+        {
+          _held.append(_request);
+          _holding = true;
+        }
       }
     }
 
-    if (_resolved)
+    _response.clear();
+    _direct_offset = 0;
+    _direct_length = 0;
+    _read_size = RECV_BUFFER_SIZE;
+    _no_more_data = false;
+
+    reset_error();
+
+    // Address is known already, so only connect is repeated.
+    _connect = Connector::instance().reconnect(_last_connect, delay, [this]()
     {
-      addrinfo* resolved = (addrinfo*)_resolved;
-      _socket = ::socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+      notify_connected();
+    });
 
-#ifdef WIN32
-      unsigned long mode = 1;
-      if (ioctlsocket( _socket, FIONBIO, &mode )!= 0)
-      {
-        _resolved = 0;
+    _state = state_connecting;
+    _phase_start = monotonic_time() + delay;
+    _session_ready = false;
 
-        set_error(STREAM_TCP_ERROR, "Could not initiate network connection.");
-      }
-#else
-      int mode;
-      mode = fcntl(_socket, F_GETFL, 0);
-      fcntl(_socket, F_SETFL, mode | O_NONBLOCK);
-#endif
-      
-      int nodelay = 1;
-      setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(int));	
+    reconnecting();
+
+    return true;
+  }
+
+  void RawStream::set_reconnect(int attempts, float max_delay)
+  {
+    _reconnect_attempts = attempts;
+    _reconnect_max_delay = max_delay;
+  }
+
+  void RawStream::hold_input()
+  {
+    std::lock_guard<std::mutex> lock(_request_lock);
+
+    _hold_input = true;
+    _holding = true;
+  }
+
+  void RawStream::session_ready()
+  {
+    _reconnect_failures = 0;
+
+    _session_ready = true;
+    _last_receive = monotonic_time();
+
+    std::lock_guard<std::mutex> lock(_request_lock);
+
+    _holding = false;
+
+    _request.append(_held);
+  }
+
+  bool RawStream::finish_connect()
+  {
+    Socket socket;
+    std::string error;
+
+    if (!Connector::instance().result(_connect, socket, error))
+      return false;
+
+    _last_connect = _connect;
+    _connect.reset();
+
+    if (!socket)
+    {
+      set_error(STREAM_TCP_ERROR, error.c_str());
+
+      return false;
     }
 
-    return _resolved != 0;
+    adopt(socket);
+
+    return true;
   }
 
-  bool RawStream::connect()
+  void RawStream::adopt(Socket socket)
   {
-    if (_resolved)
     {
-      int r = ::connect( _socket, ((addrinfo*)_resolved)->ai_addr, ((addrinfo*)_resolved)->ai_addrlen);
+      std::lock_guard<std::mutex> lock(_request_lock);
 
-      bool error = r < 0 && !would_block(r);
-      if (error)
-      {
-        set_error(STREAM_TCP_ERROR, strerror(r));
-      }
+      _socket = socket;
     }
-    else
-      set_error(STREAM_TCP_ERROR, "Operation out of sequence.");
-      
-    return _error == STREAM_NO_ERROR;
+
+    _state = state_connected;
+    _phase_start = monotonic_time();
+
+    apply_options();
+
+    if (_transport == transport_io_uring)
+      open_uring();
+  }
+
+  inline void set_option(Socket socket, int level, int name, int value)
+  {
+    setsockopt(socket, level, name, (const char*)&value, sizeof(value));
+  }
+
+  void RawStream::apply_options()
+  {
+    // TCP level options fail harmlessly on unix sockets.
+    if (_options.receive_buffer > 0)
+      set_option(_socket, SOL_SOCKET, SO_RCVBUF, _options.receive_buffer);
+    if (_options.send_buffer > 0)
+      set_option(_socket, SOL_SOCKET, SO_SNDBUF, _options.send_buffer);
+
+    set_option(_socket, IPPROTO_TCP, TCP_NODELAY, _options.no_delay ? 1 : 0);
+
+#ifdef TCP_QUICKACK
+    if (_options.quick_ack)
+      set_option(_socket, IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
+
+#ifdef SO_BUSY_POLL
+    if (_options.busy_poll > 0)
+      set_option(_socket, SOL_SOCKET, SO_BUSY_POLL, _options.busy_poll);
+#endif
+
+    if (_options.keepalive_idle > 0)
+    {
+      set_option(_socket, SOL_SOCKET, SO_KEEPALIVE, 1);
+
+#if defined(TCP_KEEPIDLE)
+      set_option(_socket, IPPROTO_TCP, TCP_KEEPIDLE, _options.keepalive_idle);
+#elif defined(TCP_KEEPALIVE)
+      set_option(_socket, IPPROTO_TCP, TCP_KEEPALIVE, _options.keepalive_idle);
+#endif
+#ifdef TCP_KEEPINTVL
+      if (_options.keepalive_interval > 0)
+        set_option(_socket, IPPROTO_TCP, TCP_KEEPINTVL, _options.keepalive_interval);
+#endif
+#ifdef TCP_KEEPCNT
+      if (_options.keepalive_count > 0)
+        set_option(_socket, IPPROTO_TCP, TCP_KEEPCNT, _options.keepalive_count);
+#endif
+    }
+
+#ifdef TCP_NOTSENT_LOWAT
+    if (_options.not_sent_lowat > 0)
+      set_option(_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, _options.not_sent_lowat);
+#endif
   }
 
   bool RawStream::update(float timeout)
   {
-    if (tcp_error())
-      return false;
+    int poll_status = 0;
 
-    if (timeout > 0)
+    if (!tcp_error() && !_no_more_data && _state != state_none)
     {
-      if (_timeout < 0)
+      // Wait ends at the nearest deadline, so that it is noticed without network activity.
+      double deadline = this->deadline();
+      if (deadline > 0)
       {
-        _timeout = timeout;
-        _start = clock();
+        float left = (float)std::max(deadline - monotonic_time(), 0.0);
+        timeout = timeout < 0 ? left : std::min(timeout, left);
       }
 
-      float delta = 0.0f;
-      delta = (clock() - _start) / (float)CLOCKS_PER_SEC;
+      poll_status = poll(timeout);
+    }
 
-      if (delta > _timeout)
-      {
-        set_error(STREAM_TCP_ERROR, "Request timed out.");
+    return dispatch(poll_status);
+  }
 
-        return false;
-      }
-    }
+  bool RawStream::dispatch(int poll_status)
+  {
+    if (tcp_error())
+      return false;
 
-    if (_state != state_none) 
+    if (_timeout > 0 && monotonic_time() - _start > _timeout)
     {
-      int poll_status = poll();
-      if (poll_status & poll_error)
-      {
-        set_error(STREAM_TCP_ERROR, "Could not check network status.");
+      set_error(STREAM_TCP_ERROR, "Request timed out.");
+      close();
 
-        return false;
-      }
-      
+      return false;
+    }
+
+    if (_no_more_data)
+    {
+      set_error(STREAM_TCP_ERROR, "Connection closed by remote host.");
+    }
+    else if (_state == state_connected && (poll_status & poll_error))
+    {
+      set_error(STREAM_TCP_ERROR, "Could not check network status.");
+    }
+    else if (_state == state_connected) 
+    {
       if (poll_status & poll_send)
       {
         write();
@@ -196,22 +481,214 @@ namespace Network
     }
 
     if (_error == STREAM_NO_ERROR && _state == state_none)
+      connect();
+
+    if (_error == STREAM_NO_ERROR && _state == state_connecting)
+      finish_connect();
+
+    // Checked after receiving, so that data which arrived in time counts.
+    if (_error == STREAM_NO_ERROR)
+      check_deadlines();
+
+    if (!tcp_error())
+      return true;
+
+    if (reconnect())
+      return true;
+
+    // Failed connection keeps no socket or connect attempts around.
+    close();
+
+    return false;
+  }
+
+  void RawStream::set_timeout(float timeout)
+  {
+    _timeout = timeout;
+    _start = monotonic_time();
+  }
+
+  void RawStream::set_deadlines(float connect, float handshake, float idle)
+  {
+    _connect_timeout = connect;
+    _handshake_timeout = handshake;
+    _idle_timeout = idle;
+  }
+
+  double RawStream::deadline() const
+  {
+    if (_error != STREAM_NO_ERROR)
+      return 0;
+
+    double deadline = _timeout > 0 ? _start + _timeout : 0;
+    double phase = 0;
+
+    if (_state == state_connecting && _connect_timeout > 0)
+      phase = _phase_start + _connect_timeout;
+    else if (_state == state_connected && !_session_ready && _handshake_timeout > 0)
+      phase = _phase_start + _handshake_timeout;
+    else if (_state == state_connected && _session_ready && _idle_timeout > 0)
+      phase = _last_receive + _idle_timeout;
+
+    if (phase > 0 && (deadline == 0 || phase < deadline))
+      deadline = phase;
+
+    return deadline;
+  }
+
+  void RawStream::check_deadlines()
+  {
+    double now = monotonic_time();
+
+    if (_state == state_connecting && _connect_timeout > 0 && now > _phase_start + _connect_timeout)
+      set_error(STREAM_TCP_ERROR, "Connection timed out.");
+    else if (_state == state_connected && !_session_ready && _handshake_timeout > 0 && now > _phase_start + _handshake_timeout)
+      set_error(STREAM_TCP_ERROR, "Session setup timed out.");
+    else if (_state == state_connected && _session_ready && _idle_timeout > 0 && now > _last_receive + _idle_timeout)
+      set_error(STREAM_TCP_ERROR, "Server stopped responding.");
+  }
+
+  void RawStream::wakeup()
+  {
+    signal_wakeup(_wakeup);
+  }
+
+  bool RawStream::write_pending()
+  {
+    // With io_uring, next send is only possible once connected and previous one completed.
+    if (_uring && (!_uring_connected || _uring->sending()))
+      return false;
+
+    std::lock_guard<std::mutex> lock(_request_lock);
+
+    return !_request.empty();
+  }
+
+  Socket RawStream::poll_handle() const
+  {
+    return _socket && _uring ? (Socket)_uring->handle() : _socket;
+  }
+
+  void RawStream::open_uring()
+  {
+    _uring = new UringTransport();
+
+    if (_uring->open((int)_socket))
+    {
+      _uring->watch_connect();
+    }
+    else
     {
-      if (resolve() && connect())
+      // Not available on this system, continue with poll.
+      delete _uring;
+      _uring = 0;
+
+      _transport = transport_poll;
+    }
+  }
+
+  void RawStream::write_uring()
+  {
+    if (!_uring_connected || _uring->sending())
+      return;
+
+    std::lock_guard<std::mutex> lock(_request_lock);
+
+    if (_request.empty())
+      return;
+
+    // Everything queued so far goes out with one request.
+    std::string data;
+    _request.take(data);
+
+    _uring->send(data);
+  }
+
+  void RawStream::read_uring()
+  {
+    UringCompletion completion;
+
+    for (size_t total = 0; total < _read_budget && _uring->next(completion); )
+    {
+      bool receive = false;
+
+      switch (completion.operation)
       {
-        _state = state_connected;
+        case UringCompletion::operation_connect:
+          if (completion.result < 0 || (completion.result & (POLLERR | POLLHUP)))
+          {
+            set_error(STREAM_TCP_ERROR, "Could not connect.");
+          }
+          else
+          {
+            _uring_connected = true;
+            receive = true;
+          }
+          break;
+
+        case UringCompletion::operation_receive:
+          if (completion.result > 0)
+          {
+            const char* data = completion.data;
+            size_t length = completion.result;
+
+            size_t stored = direct_read_pending() ? store_direct(data, length) : 0;
+            if (stored < length)
+              _response.append(data + stored, length - stored);
+
+            total += length;
+
+            _statistics.bytes_received += length;
+            ++_statistics.receive_calls;
+
+            _last_receive = monotonic_time();
+          }
+          else if (completion.result == 0)
+          {
+            _no_more_data = true;
+          }
+          else if (completion.result != -ENOBUFS)
+          {
+            set_error(STREAM_TCP_ERROR, strerror(-completion.result));
+          }
+
+          // Multishot receive ends when kernel runs out of buffers, resume it once they are returned.
+          receive = !completion.more && completion.result != 0 && !tcp_error();
+          break;
+
+        case UringCompletion::operation_send:
+          if (completion.result < 0)
+          {
+            set_error(STREAM_TCP_ERROR, strerror(-completion.result));
+          }
+          else
+          {
+            _statistics.bytes_sent += completion.result;
+            ++_statistics.send_calls;
+
+            _uring->sent(completion.result);
+          }
+          break;
       }
-      else
-        set_error(STREAM_TCP_ERROR, "Operation out of sequence.");
-    }    
 
-    return !tcp_error();
+      _uring->release(completion);
+
+      if (receive)
+        _uring->receive();
+    }
   }
 
-  int RawStream::poll()
+  int RawStream::poll(float timeout)
   {
+    // Announce the wait before checking send queue, so that concurrent write() either is seen here or wakes us up.
+    _waiting = true;
+
+    bool sending = write_pending();
+
+#ifdef WIN32
     timeval tv;
-    tv.tv_sec = 0; tv.tv_usec = 1;
+    tv.tv_sec = timeout > 0 ? (long)timeout : 0;
+    tv.tv_usec = timeout > 0 ? (long)((timeout - tv.tv_sec) * 1000000) : 0;
 
     fd_set read_fds, write_fds, error_fds;
     FD_ZERO(&read_fds);
@@ -219,33 +696,136 @@ namespace Network
     FD_ZERO(&error_fds);
 #pragma warning(push)
 #pragma warning(disable:4127)
-    FD_SET(_socket, &read_fds);
-    FD_SET(_socket, &write_fds);
-    FD_SET(_socket, &error_fds);
+    if (_socket)
+    {
+      FD_SET(_socket, &read_fds);
+      if (sending)
+        FD_SET(_socket, &write_fds);
+      FD_SET(_socket, &error_fds);
+    }
+    if (_wakeup[0] != INVALID_SOCKET)
+      FD_SET(_wakeup[0], &read_fds);
 #pragma warning(pop)
 
-    int result = select(_socket + 1, &read_fds, &write_fds, &error_fds, &tv);
+    int result = select(0, &read_fds, &write_fds, &error_fds, timeout < 0 ? 0 : &tv);
+
+    _waiting = false;
 
     int status = 0;
     
     if (result >= 0)
     {
-      status |= FD_ISSET(_socket, &read_fds) ? poll_receive : 0;
-      status |= FD_ISSET(_socket, &write_fds) ? poll_send : 0;
-      status |= FD_ISSET(_socket, &error_fds) ? poll_error : 0;
+      if (_socket)
+      {
+        status |= FD_ISSET(_socket, &read_fds) ? poll_receive : 0;
+        status |= FD_ISSET(_socket, &write_fds) ? poll_send : 0;
+        status |= FD_ISSET(_socket, &error_fds) ? poll_error : 0;
+      }
+
+      if (_wakeup[0] != INVALID_SOCKET && FD_ISSET(_wakeup[0], &read_fds))
+        drain_wakeup(_wakeup);
     }
+#else
+    pollfd fds[2];
+    // While connecting there is no socket yet, only wakeup from connector is awaited.
+    fds[0].fd = _socket ? poll_handle() : -1;
+    fds[0].events = POLLIN | (sending ? POLLOUT : 0);
+    fds[0].revents = 0;
+    fds[1].fd = _wakeup[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    int result = ::poll(fds, _wakeup[0] >= 0 ? 2 : 1, timeout < 0 ? -1 : (int)ceil(timeout * 1000.0f));
+
+    _waiting = false;
+
+    int status = 0;
+
+    if (result >= 0)
+    {
+      // Hang up is reported as readable, so that receive notices end of stream.
+      status |= (fds[0].revents & (POLLIN | POLLHUP)) ? poll_receive : 0;
+      status |= (fds[0].revents & POLLOUT) ? poll_send : 0;
+      status |= (fds[0].revents & (POLLERR | POLLNVAL)) ? poll_error : 0;
+
+      if (fds[1].revents & POLLIN)
+        drain_wakeup(_wakeup);
+    }
+    else if (errno != EINTR)
+      status |= poll_error;
+#endif
 
     return status;
   }
 
   void RawStream::write(const char* data)
   {
-    _request.insert(_request.end(), data, data + strlen(data));
+    write(data, data + strlen(data));
   }
 
   void RawStream::write(const char* data, const char* end)
   {
-    _request.insert(_request.end(), data, end);
+    bool was_empty;
+
+    {
+      std::lock_guard<std::mutex> lock(_request_lock);
+
+      was_empty = _request.empty();
+
+      _request.append(data, end - data);
+    }
+
+    if (was_empty && _reactor)
+      _reactor->schedule(this);
+
+    if (_waiting)
+      wakeup();
+  }
+
+  void RawStream::write_now(const char* data, const char* end)
+  {
+    bool was_empty;
+
+    {
+      std::lock_guard<std::mutex> lock(_request_lock);
+
+      if (_holding)
+      {
+        _held.append(data, end - data);
+        return;
+      }
+
+      was_empty = _request.empty();
+
+      // Sending ahead of queued data would reorder messages.
+      if (_direct_send && _transport == transport_poll && was_empty && _socket)
+      {
+        Segment segment;
+        set_segment(segment, (char*)data, end - data);
+
+        // Errors are left for update() to find, rest of data is queued below.
+        int result = send_segments(_socket, &segment, 1);
+        if (result > 0)
+        {
+          _statistics.bytes_sent += result;
+          ++_statistics.send_calls;
+
+          data += result;
+        }
+
+        if (data == end)
+          return;
+      }
+
+      // Rest is queued under the same lock, so that no other message gets between its parts.
+      _request.append(data, end - data);
+    }
+
+    if (was_empty && _reactor)
+      _reactor->schedule(this);
+
+    if (_waiting)
+      wakeup();
   }
 
   void RawStream::write()
@@ -253,25 +833,48 @@ namespace Network
     if (tcp_error())
       return;
 
-    int remaining = _request.size();
-    int chunk = std::min(SEND_BUFFER_SIZE, remaining);
+    if (_uring)
+    {
+      write_uring();
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(_request_lock);
 
-    if (chunk)
+    // Flush queued chunks with gathering sends until the socket would block.
+    while (!_request.empty())
     {
-      int result = ::send(_socket, &_request[0], chunk, 0);
-      if (!would_block(result))
+      Segment segments[MAX_SEND_SEGMENTS];
+      int count = (int)std::min(_request.chunks(), (size_t)MAX_SEND_SEGMENTS);
+      size_t length = 0;
+
+      for (int i = 0; i < count; ++i)
       {
-        bool error = result < 0;
+        size_t chunk;
+        const char* data = _request.chunk(i, chunk);
 
-        if (error)
-        { 
-          set_error(STREAM_TCP_ERROR, strerror(result));          
-        }
+        set_segment(segments[i], (char*)data, chunk);
+        length += chunk;
       }
-        
-      if (!tcp_error())
-        _request.erase(_request.begin(), _request.begin() + result);
-    }    
+
+      int result = send_segments(_socket, segments, count);
+      if (result < 0)
+      {
+        if (!would_block(result))
+          set_error(STREAM_TCP_ERROR, strerror(errno));
+
+        break;
+      }
+
+      _request.consume(result);
+
+      _statistics.bytes_sent += result;
+      ++_statistics.send_calls;
+
+      // Partial send means socket buffer is full.
+      if ((size_t)result < length)
+        break;
+    }
   }
 
   void RawStream::read()
@@ -279,37 +882,273 @@ namespace Network
     if (tcp_error() || _no_more_data)
       return;
 
-    _buffer.resize(RECV_BUFFER_SIZE);
+    if (_uring)
+    {
+      read_uring();
+      return;
+    }
+
+    // Drain socket until it would block, but no more than read budget per update.
+    size_t total = 0;
+
+    while (total < _read_budget)
+    {
+      int result = direct_read_pending() ? read_direct() : read_buffered();
+      if (result <= 0)
+        break;
+
+      total += result;
+    }
 
-    int result = recv(_socket, &_buffer[0], _buffer.size(), 0 );   
+    if (total)
+      _last_receive = monotonic_time();
+
+#ifdef TCP_QUICKACK
+    // Kernel turns quick acknowledgements off again on its own, so they are renewed after receiving.
+    if (_options.quick_ack && total)
+      set_option(_socket, IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
+  }
 
+  int RawStream::read_buffered()
+  {
+    _response.reserve(_read_size);
+
+    BufferSpan<char> space = _response.writable();
+
+    size_t first = std::min(space.first_length, _read_size);
+    size_t second = std::min(space.second_length, _read_size - first);
+
+    Segment segments[2];
+    set_segment(segments[0], space.first, first);
+    set_segment(segments[1], space.second, second);
+
+    int result = received(receive_segments(_socket, segments, second ? 2 : 1));
+    if (result <= 0)
+      return result;
+
+    _response.commit(result);
+
+    // Adapt read size to the amount of data the server keeps sending.
+    if ((size_t)result == first + second)
+      _read_size = std::min(_read_size * 2, (size_t)MAX_RECV_BUFFER_SIZE);
+    else if ((size_t)result < _read_size / 4)
+      _read_size = std::max(_read_size / 2, (size_t)RECV_BUFFER_SIZE);
+
+    return result;
+  }
+
+  int RawStream::read_direct()
+  {
+    if (_discard.empty())
+      _discard.resize(DISCARD_BUFFER_SIZE);
+
+    // One segment per framebuffer row, so that the kernel copies payload straight to its destination.
+    Segment segments[MAX_DIRECT_SEGMENTS];
+    int count = 0;
+
+    for (size_t offset = _direct_offset; offset < _direct_length && count < MAX_DIRECT_SEGMENTS; ++count)
+    {
+      size_t row = offset / _direct.row_length;
+      size_t column = offset % _direct.row_length;
+
+      if (row < _direct.stored_rows && column < _direct.copy_length)
+      {
+        size_t chunk = _direct.copy_length - column;
+        set_segment(segments[count], _direct.destination + row * _direct.stride + column, chunk);
+        offset += chunk;
+      }
+      else
+      {
+        size_t chunk = row < _direct.stored_rows ? _direct.row_length - column : _direct_length - offset;
+        chunk = std::min(chunk, _discard.size());
+        set_segment(segments[count], &_discard[0], chunk);
+        offset += chunk;
+      }
+    }
+
+    int result = received(receive_segments(_socket, segments, count));
+    if (result > 0)
+      _direct_offset += result;
+
+    return result;
+  }
+
+  int RawStream::received(int result)
+  {
     if (would_block(result))
-      return;
+      return 0;
 
-    if (result < 0 )
+    if (result < 0)
     {
-      set_error(STREAM_TCP_ERROR, strerror(result));
+      set_error(STREAM_TCP_ERROR, strerror(errno));
 
-      return;
+      return -1;
     }
 
     if (result == 0)
     {
       _no_more_data = true;
-      return;
+      return 0;
     }
-    
-    if ((size_t)result <= _buffer.size())
+
+    _statistics.bytes_received += result;
+    ++_statistics.receive_calls;
+
+    return result;
+  }
+
+  void RawStream::expect(size_t bytes)
+  {
+    _read_size = std::min(std::max(_read_size, bytes), (size_t)MAX_RECV_BUFFER_SIZE);
+  }
+
+  void RawStream::read_direct(const DirectRead& target)
+  {
+    _direct = target;
+    _direct_offset = 0;
+    _direct_length = target.row_length * target.rows;
+
+    expect(_direct_length);
+
+    // Payload received together with preceding messages is already buffered, move it out first.
+    BufferSpan<const char> buffered = _response.span(0, _direct_length);
+
+    size_t stored = store_direct(buffered.first, buffered.first_length);
+    stored += store_direct(buffered.second, buffered.second_length);
+
+    _response.consume(stored);
+  }
+
+  size_t RawStream::store_direct(const char* data, size_t length)
+  {
+    size_t stored = 0;
+
+    while (stored < length && direct_read_pending())
     {
-      _response.insert(_response.end(), _buffer.begin(), _buffer.begin() + result);
+      size_t row = _direct_offset / _direct.row_length;
+      size_t column = _direct_offset % _direct.row_length;
+      size_t chunk;
+
+      if (row < _direct.stored_rows && column < _direct.copy_length)
+      {
+        chunk = std::min(length - stored, _direct.copy_length - column);
+        memcpy(_direct.destination + row * _direct.stride + column, data + stored, chunk);
+      }
+      else if (row < _direct.stored_rows)
+        chunk = std::min(length - stored, _direct.row_length - column);
+      else
+        chunk = std::min(length - stored, _direct_length - _direct_offset);
+
+      stored += chunk;
+      _direct_offset += chunk;
     }
+
+    return stored;
   }
 
   void RawStream::eat(int bytes)
   {
-    bytes = std::min(bytes, (int)_response.length());
+    _response.consume(bytes);
+  }
+
+  void signal_wakeup(Socket wakeup[2])
+  {
+#ifdef WIN32
+    if (wakeup[1] != INVALID_SOCKET)
+    {
+      char signal = 1;
+      ::send(wakeup[1], &signal, 1, 0);
+    }
+#else
+    if (wakeup[1] >= 0)
+    {
+      unsigned long long signal = 1;
+      ssize_t result = ::write(wakeup[1], &signal, WAKEUP_SIGNAL_SIZE);
+      (void)result;
+    }
+#endif
+  }
+
+  bool open_wakeup(Socket wakeup[2])
+  {
+#ifdef WIN32
+    // Windows can only wait on sockets, so wakeups are datagrams sent to ourselves over loopback.
+    wakeup[0] = wakeup[1] = INVALID_SOCKET;
+
+    Socket s = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET)
+      return false;
+
+    sockaddr_in address = { 0 };
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int length = sizeof(address);
+    unsigned long mode = 1;
+
+    if (::bind(s, (sockaddr*)&address, sizeof(address)) != 0 ||
+      getsockname(s, (sockaddr*)&address, &length) != 0 ||
+      ::connect(s, (sockaddr*)&address, sizeof(address)) != 0 ||
+      ioctlsocket(s, FIONBIO, &mode) != 0)
+    {
+      ::closesocket(s);
+      return false;
+    }
+
+    wakeup[0] = wakeup[1] = s;
+
+    return true;
+#elif defined(__linux__)
+    wakeup[0] = wakeup[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return wakeup[0] >= 0;
+#else
+    if (pipe(wakeup) != 0)
+    {
+      wakeup[0] = wakeup[1] = -1;
+      return false;
+    }
+
+    for (int i = 0; i < 2; ++i)
+    {
+      fcntl(wakeup[i], F_SETFL, fcntl(wakeup[i], F_GETFL, 0) | O_NONBLOCK);
+      fcntl(wakeup[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return true;
+#endif
+  }
+
+  void close_wakeup(Socket wakeup[2])
+  {
+#ifdef WIN32
+    if (wakeup[0] != INVALID_SOCKET)
+      ::closesocket(wakeup[0]);
+#else
+    if (wakeup[0] >= 0)
+      ::close(wakeup[0]);
+    if (wakeup[1] >= 0 && wakeup[1] != wakeup[0])
+      ::close(wakeup[1]);
+#endif
+  }
+
+  void drain_wakeup(Socket wakeup[2])
+  {
+    char signals[64];
 
-    _response.erase(_response.begin(), _response.begin() + bytes);
+#ifdef WIN32
+    while (::recv(wakeup[0], signals, sizeof(signals), 0) > 0)
+      ;
+#else
+    while (::read(wakeup[0], signals, sizeof(signals)) > 0)
+      ;
+#endif
+  }
+
+  double monotonic_time()
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
   }
 
   void initialize()
@@ -7,18 +7,81 @@
 
 #include <vector>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "stream_buffer.hpp"
+
 #define STREAM_NO_ERROR 0
 #define STREAM_TCP_ERROR 1
 #define STREAM_TCP_RANGE 1000
 
 namespace Network
 {
+  class SessionReactor;
+  class UringTransport;
+  struct ConnectRequest;
+
 #ifdef WIN32
   typedef size_t Socket;
 #else
   typedef int Socket;
 #endif
 
+  // Rows of payload which are received directly into caller owned memory instead of the receive buffer.
+  // Bytes past copy_length in each row, and all rows past stored_rows, are read and discarded.
+  struct DirectRead
+  {
+    char* destination;
+    size_t stride;
+    size_t row_length;
+    size_t copy_length;
+    size_t rows;
+    size_t stored_rows;
+  };
+
+  // Socket tuning applied when connection is established. Zero keeps system default.
+  struct SocketOptions
+  {
+    // SO_RCVBUF and SO_SNDBUF, in bytes.
+    int receive_buffer;
+    int send_buffer;
+
+    // TCP_NODELAY, and TCP_QUICKACK kept on after every receive (Linux).
+    bool no_delay;
+    bool quick_ack;
+
+    // SO_BUSY_POLL, microseconds of busy waiting for data in blocking receive (Linux).
+    int busy_poll;
+
+    // Keepalive probes, idle seconds before first one, seconds between them and their count.
+    // Zero idle time leaves keepalive off.
+    int keepalive_idle;
+    int keepalive_interval;
+    int keepalive_count;
+
+    // TCP_NOTSENT_LOWAT, socket reports writable only when less than this is waiting unsent.
+    int not_sent_lowat;
+
+    SocketOptions();
+
+    // Keystrokes and pointer events on LAN: nothing delayed, dead peers noticed within seconds.
+    static SocketOptions low_latency();
+
+    // Screen capture over WAN: large buffers to keep long fat pipes full.
+    static SocketOptions bulk_transfer();
+  };
+
+  struct StreamStatistics
+  {
+    unsigned long long bytes_received;
+    unsigned long long bytes_sent;
+    unsigned long long receive_calls;
+    unsigned long long send_calls;
+    unsigned long long reconnects;
+  };
+
   class RawStream
   {
   public: 
@@ -26,7 +89,14 @@ namespace Network
     {
       state_none = 0,
       state_handshake = 1,      
-      state_connected = 2
+      state_connected = 2,
+      state_connecting = 3
+    };
+
+    enum Transport
+    {
+      transport_poll = 0,
+      transport_io_uring = 1
     };
 
     enum PollStatus
@@ -37,10 +107,32 @@ namespace Network
     };
 
   public:
-    RawStream(const char* hostname, const char* port);
+    // io_uring transport falls back to poll when it is not supported by the system.
+    // Hostname in form of unix:<path> connects to unix socket, port is ignored then.
+    RawStream(const char* hostname, const char* port, Transport transport = transport_poll, const SocketOptions& options = SocketOptions());
+
+    // Takes over already connected socket, e.g. one end of socketpair or socket passed by systemd.
+    RawStream(Socket socket, Transport transport = transport_poll, const SocketOptions& options = SocketOptions());
     virtual ~RawStream();
 
-    bool update(float timeout = -1);
+    // Waits up to timeout seconds for network activity and processes it, negative timeout waits
+    // until something happens, zero only checks socket state.
+    virtual bool update(float timeout = -1);
+
+    // Fails the connection if it is not done within given number of seconds.
+    void set_timeout(float timeout);
+
+    // Deadlines in seconds for establishing connection, setting up session once connected, and silence
+    // from the server once session is set up. Zero turns a deadline off. Missed deadline is a network
+    // error, so connection is established again when reconnect is enabled.
+    void set_deadlines(float connect, float handshake, float idle);
+
+    // Connects again when established connection drops, up to given number of attempts in a row, negative
+    // for no limit, zero turns it off. First attempt is immediate, delay of next ones doubles up to max_delay.
+    void set_reconnect(int attempts, float max_delay = 30.0f);
+
+    // Interrupts update() waiting on another thread. Safe to call from any thread.
+    void wakeup();
 
     int error_code() const
     {
@@ -52,7 +144,47 @@ namespace Network
       return _error_description.c_str();
     }
 
+    Transport transport() const
+    {
+      return _transport;
+    }
+
+    const SocketOptions& options() const
+    {
+      return _options;
+    }
+
+    // Limits amount of data received during single update, so that callers on UI thread stay responsive.
+    void set_read_budget(size_t bytes)
+    {
+      _read_budget = bytes > 0 ? bytes : 1;
+    }
+
+    size_t read_budget() const
+    {
+      return _read_budget;
+    }
+
+    // Lets input events go out from the calling thread right away, instead of waiting for update().
+    void set_direct_send(bool direct)
+    {
+      _direct_send = direct;
+    }
+
+    bool direct_send() const
+    {
+      return _direct_send;
+    }
+
+    const StreamStatistics& statistics() const
+    {
+      return _statistics;
+    }
+
   protected:
+    // Handles network events, either found by update() or reported by reactor.
+    virtual bool dispatch(int poll_status);
+
     State state() const
     {
       return _state;
@@ -68,7 +200,7 @@ namespace Network
       return _no_more_data;
     }    
 
-    std::string& response()
+    ReceiveBuffer& response()
     {
       return _response;
     }
@@ -96,10 +228,35 @@ namespace Network
     void write(const char* data);
     void write(const char* data, const char* end);
 
+    // Same as write(), but sends immediately when direct send is enabled and nothing is queued. Thread safe.
+    // Data is held back instead while input is held.
+    void write_now(const char* data, const char* end);
+
+    // Holds data written by write_now() from the start of every connection until session_ready().
+    void hold_input();
+
+    // Session is set up, held input goes out and reconnect delay starts over.
+    void session_ready();
+
+    // Called when dropped connection is being established again, before anything is received from it.
+    virtual void reconnecting()
+    {
+    }
+
     void eat(int bytes);
 
+    void read_direct(const DirectRead& target);
+
+    // Hint about size of payload which is about to arrive, used to grow receive size.
+    void expect(size_t bytes);
+
+    bool direct_read_pending() const
+    {
+      return _direct_offset < _direct_length;
+    }
+
   private:
-    bool resolve();
+    friend class SessionReactor;
 
     void disconnect();
 
@@ -107,16 +264,60 @@ namespace Network
 
     bool connect();
 
-    int poll();
+    bool finish_connect();
+
+    void notify_connected();
+
+    bool reconnect();
+
+    // Nearest point in time on monotonic clock when a deadline passes, zero when there is none.
+    double deadline() const;
+
+    void check_deadlines();
+
+    void adopt(Socket socket);
+
+    void apply_options();
+
+    int poll(float timeout);
+
+    bool write_pending();
+
+    Socket poll_handle() const;
+
+    void open_uring();
+
+    void write_uring();
+
+    void read_uring();
+
 
     void write();
 
     void read();
+
+    int read_buffered();
+
+    int read_direct();
+
+    int received(int result);
+
+    size_t store_direct(const char* data, size_t length);
     
   private:
     State _state; 
 
-    void* _resolved;
+    Transport _transport;
+    SocketOptions _options;
+    UringTransport* _uring;
+    bool _uring_connected;
+
+    std::shared_ptr<ConnectRequest> _connect;
+    std::shared_ptr<ConnectRequest> _last_connect;
+
+    int _reconnect_attempts;
+    int _reconnect_failures;
+    float _reconnect_max_delay;
 
     std::string _hostname;
     std::string _port;
@@ -127,14 +328,53 @@ namespace Network
     bool _no_more_data;
     
     std::string _error_description;
-    std::string _request;
-    std::string _buffer;
-    std::string _response;    
+    SendQueue _request;
+    SendQueue _held;
+    bool _hold_input;
+    bool _holding;
+    std::mutex _request_lock;
+
+    Socket _wakeup[2];
+    std::atomic<bool> _waiting;
+
+    ReceiveBuffer _response;
+
+    DirectRead _direct;
+    size_t _direct_offset;
+    size_t _direct_length;
+
+    std::vector<char> _discard;
+
+    size_t _read_size;
+    size_t _read_budget;
+
+    std::atomic<bool> _direct_send;
+
+    StreamStatistics _statistics;
+
+    SessionReactor* _reactor;
+    void* _reactor_session;
 
     float _timeout;
-    long long _start;
+    double _start;
+
+    float _connect_timeout;
+    float _handshake_timeout;
+    float _idle_timeout;
+    double _phase_start;
+    double _last_receive;
+    bool _session_ready;
   };    
 
+  // Signal used by other threads to interrupt waiting on sockets.
+  bool open_wakeup(Socket wakeup[2]);
+  void close_wakeup(Socket wakeup[2]);
+  void signal_wakeup(Socket wakeup[2]);
+  void drain_wakeup(Socket wakeup[2]);
+
+  // Seconds on monotonic clock, for measuring time spans.
+  double monotonic_time();
+
   void initialize();
   void deinitialize();
 }
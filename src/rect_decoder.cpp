@@ -0,0 +1,324 @@
+#include "rect_decoder.hpp"
+#include "hextile_decoder.hpp"
+#include "pixel_fill.hpp"
+#include "tight_decoder.hpp"
+#include "tile_decoder.hpp"
+#include "zlib_decoder.hpp"
+#include "vnc_client.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace Network
+{
+  template <typename T>
+  static RectDecoder* create_decoder()
+  {
+    return new T();
+  }
+
+  struct BuiltInDecoder
+  {
+    int encoding;
+    RectDecoder::Factory factory;
+  };
+
+  // Adding an encoding takes a decoder class and a line here.
+  static const BuiltInDecoder built_in_decoders[] = {
+    { VncClient::encoding_raw, create_decoder<RawDecoder> },
+    { VncClient::encoding_copy_rect, create_decoder<CopyRectDecoder> },
+    { VncClient::encoding_rre, create_decoder<RreDecoder> },
+    { VncClient::encoding_corre, create_decoder<CorreDecoder> },
+    { VncClient::encoding_hextile, create_decoder<HextileDecoder> },
+    { VncClient::encoding_zlib, create_decoder<ZlibDecoder> },
+    { VncClient::encoding_tight, create_decoder<TightDecoder> },
+    { VncClient::encoding_tight_png, create_decoder<TightPngDecoder> },
+    { VncClient::encoding_trle, create_decoder<TrleDecoder> },
+    { VncClient::encoding_zrle, create_decoder<ZrleDecoder> },
+  };
+
+  static std::mutex registry_lock;
+
+  static std::map<int, RectDecoder::Factory> built_in_registry()
+  {
+    std::map<int, RectDecoder::Factory> factories;
+
+    for (size_t i = 0; i < sizeof(built_in_decoders) / sizeof(built_in_decoders[0]); ++i)
+      factories[built_in_decoders[i].encoding] = built_in_decoders[i].factory;
+
+    return factories;
+  }
+
+  static std::map<int, RectDecoder::Factory>& registry()
+  {
+    static std::map<int, RectDecoder::Factory> factories = built_in_registry();
+
+    return factories;
+  }
+
+  void PixelFormat::parse(const unsigned char* data)
+  {
+    bits_per_pixel = data[0];
+    depth = data[1];
+    big_endian = data[2] != 0;
+    true_colour = data[3] != 0;
+
+    red_max = (data[4] << 8) | data[5];
+    green_max = (data[6] << 8) | data[7];
+    blue_max = (data[8] << 8) | data[9];
+
+    red_shift = data[10];
+    green_shift = data[11];
+    blue_shift = data[12];
+  }
+
+  int PixelFormat::compact_pixel_size() const
+  {
+    if (bits_per_pixel != 32 || !true_colour || depth > 24)
+      return bytes_per_pixel();
+
+    bool low_bytes = ((red_max << red_shift) | (green_max << green_shift) | (blue_max << blue_shift)) < (1 << 24);
+    bool high_bytes = red_shift >= 8 && green_shift >= 8 && blue_shift >= 8;
+
+    return low_bytes || high_bytes ? 3 : 4;
+  }
+
+  int PixelFormat::compact_pixel_offset() const
+  {
+    if (compact_pixel_size() != 3)
+      return 0;
+
+    bool low_bytes = ((red_max << red_shift) | (green_max << green_shift) | (blue_max << blue_shift)) < (1 << 24);
+
+    // Unused byte is the most significant one when colours fit in low bytes, otherwise the least one.
+    return low_bytes == big_endian ? 1 : 0;
+  }
+
+  int PixelFormat::tight_pixel_size() const
+  {
+    bool rgb = bits_per_pixel == 32 && depth == 24 && true_colour && red_max == 255 && green_max == 255 && blue_max == 255;
+
+    return rgb ? 3 : bytes_per_pixel();
+  }
+
+  void PixelFormat::store_rgb(char* pixel, int red, int green, int blue) const
+  {
+    // Colours are scaled down when format has fewer bits for them.
+    if (red_max != 255 || green_max != 255 || blue_max != 255)
+    {
+      red = (red * red_max + 127) / 255;
+      green = (green * green_max + 127) / 255;
+      blue = (blue * blue_max + 127) / 255;
+    }
+
+    unsigned int value = ((unsigned int)red << red_shift) | ((unsigned int)green << green_shift) | ((unsigned int)blue << blue_shift);
+    int bytes = bytes_per_pixel();
+
+    for (int i = 0; i < bytes; ++i)
+      pixel[i] = (char)(value >> (big_endian ? (bytes - 1 - i) * 8 : i * 8));
+  }
+
+  RectDecoder::~RectDecoder()
+  {
+  }
+
+  RectDecoder* RectDecoder::create(int encoding)
+  {
+    std::lock_guard<std::mutex> lock(registry_lock);
+
+    std::map<int, Factory>::iterator factory = registry().find(encoding);
+
+    return factory != registry().end() ? factory->second() : 0;
+  }
+
+  bool RectDecoder::supported(int encoding)
+  {
+    std::lock_guard<std::mutex> lock(registry_lock);
+
+    return registry().count(encoding) > 0;
+  }
+
+  void RectDecoder::register_factory(int encoding, Factory factory)
+  {
+    std::lock_guard<std::mutex> lock(registry_lock);
+
+    registry()[encoding] = factory;
+  }
+
+  void RectDecoder::fill(DecodeContext& context, int x, int y, int width, int height, const char* pixel)
+  {
+    if (!context.framebuffer)
+      return;
+
+    width = std::min(width, context.width - x);
+    height = std::min(height, context.height - y);
+
+    if (width > 0 && height > 0)
+    {
+      int bpp = context.format.bytes_per_pixel();
+
+      fill_rect(context.framebuffer + y * context.stride + x * bpp, context.stride, width, height, bpp, pixel);
+    }
+  }
+
+  DirectRead RectDecoder::framebuffer_rows(const DecodeContext& context, const RectHeader& rect)
+  {
+    size_t bpp = context.format.bytes_per_pixel();
+
+    DirectRead rows = { 0, 0, rect.width * bpp, 0, (size_t)rect.height, 0 };
+
+    // Parts outside of framebuffer are dropped.
+    if (context.framebuffer)
+    {
+      int left = std::min(rect.x, context.width);
+      int top = std::min(rect.y, context.height);
+
+      rows.destination = context.framebuffer + top * context.stride + left * bpp;
+      rows.stride = context.stride;
+      rows.copy_length = (std::min(rect.x + rect.width, context.width) - left) * bpp;
+      rows.stored_rows = std::min(rect.y + rect.height, context.height) - top;
+    }
+
+    return rows;
+  }
+
+  RectDecoder::Result RawDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    context.read_direct = true;
+    context.direct = framebuffer_rows(context, rect);
+
+    return decode_done;
+  }
+
+  RectDecoder::Result CopyRectDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    if (input.length() < 4)
+      return decode_incomplete;
+
+    int source_x = input.u16(0);
+    int source_y = input.u16(2);
+
+    input.consume(4);
+
+    if (!context.framebuffer)
+      return decode_done;
+
+    // Both source and destination are clipped to framebuffer.
+    int width = std::min(rect.width, context.width - std::max(rect.x, source_x));
+    int height = std::min(rect.height, context.height - std::max(rect.y, source_y));
+
+    if (width <= 0 || height <= 0)
+      return decode_done;
+
+    size_t bpp = context.format.bytes_per_pixel();
+    size_t length = width * bpp;
+
+    char* source = context.framebuffer + source_y * context.stride + source_x * bpp;
+    char* destination = context.framebuffer + rect.y * context.stride + rect.x * bpp;
+
+    // Rows are copied away from the direction of the move, so that overlapping source rows are read before
+    // they are overwritten. Within a row, memmove handles horizontal overlap.
+    if (source_y < rect.y)
+    {
+      for (int row = height - 1; row >= 0; --row)
+        memmove(destination + row * context.stride, source + row * context.stride, length);
+    }
+    else
+    {
+      for (int row = 0; row < height; ++row)
+        memmove(destination + row * context.stride, source + row * context.stride, length);
+    }
+
+    return decode_done;
+  }
+
+  RreDecoder::RreDecoder(bool compact)
+  {
+    _compact = compact;
+    _started = false;
+    _subrects = 0;
+  }
+
+  RectDecoder::Result RreDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    size_t bpp = context.format.bytes_per_pixel();
+
+    if (bpp != 1 && bpp != 2 && bpp != 4)
+      return decode_failed;
+
+    if (!_started)
+    {
+      if (input.length() < 4 + bpp)
+        return decode_incomplete;
+
+      char background[4];
+      input.copy(4, bpp, background);
+
+      _subrects = input.u32(0);
+      _started = true;
+
+      fill(context, rect.x, rect.y, rect.width, rect.height, background);
+
+      input.consume(4 + bpp);
+    }
+
+    size_t size = bpp + (_compact ? 4 : 8);
+
+    // Subrectangles are applied in batches as they arrive, instead of waiting for all of them.
+    while (_subrects > 0 && input.length() >= size)
+    {
+      size_t count = std::min((size_t)_subrects, input.length() / size);
+
+      const unsigned char* data = (const unsigned char*)input.contiguous(0, count * size);
+
+      for (size_t i = 0; i < count; ++i, data += size)
+      {
+        const unsigned char* c = data + bpp;
+
+        int x, y, width, height;
+
+        if (_compact)
+        {
+          x = c[0];
+          y = c[1];
+          width = c[2];
+          height = c[3];
+        }
+        else
+        {
+          x = (c[0] << 8) | c[1];
+          y = (c[2] << 8) | c[3];
+          width = (c[4] << 8) | c[5];
+          height = (c[6] << 8) | c[7];
+        }
+
+        if (x + width > rect.width || y + height > rect.height)
+        {
+          _started = false;
+
+          return decode_failed;
+        }
+
+        fill(context, rect.x + x, rect.y + y, width, height, (const char*)data);
+      }
+
+      input.consume(count * size);
+
+      _subrects -= (unsigned int)count;
+    }
+
+    if (_subrects > 0)
+      return decode_incomplete;
+
+    _started = false;
+
+    return decode_done;
+  }
+}
@@ -0,0 +1,144 @@
+#ifndef header_5306b0a9_4fa1_4640_96fc_5dc0f7f7b544
+#define header_5306b0a9_4fa1_4640_96fc_5dc0f7f7b544
+
+#include "raw_query.hpp"
+
+namespace Network
+{
+  // Pixel format announced by the server in ServerInit, framebuffer pixels are stored in it.
+  struct PixelFormat
+  {
+    int bits_per_pixel;
+    int depth;
+    bool big_endian;
+    bool true_colour;
+
+    int red_max;
+    int green_max;
+    int blue_max;
+    int red_shift;
+    int green_shift;
+    int blue_shift;
+
+    int bytes_per_pixel() const
+    {
+      return bits_per_pixel / 8;
+    }
+
+    // Parses 16 bytes of PIXEL_FORMAT structure.
+    void parse(const unsigned char* data);
+
+    // ZRLE and TRLE send 4 byte pixels whose colours fit in 3 bytes as those 3 bytes (CPIXEL). Returns bytes
+    // of such pixel, and offset of first of them in stored pixel.
+    int compact_pixel_size() const;
+    int compact_pixel_offset() const;
+
+    // Tight sends 4 byte pixels of 8 bit colours in depth 24 as red, green and blue bytes (TPIXEL). Returns
+    // bytes of such pixel.
+    int tight_pixel_size() const;
+
+    // Stored true colour pixel of given 8 bit colours, for Tight pixels and decoded images.
+    void store_rgb(char* pixel, int red, int green, int blue) const;
+  };
+
+  struct RectHeader
+  {
+    int x;
+    int y;
+    int width;
+    int height;
+    int encoding;
+  };
+
+  // What decoder works with, rebuilt by the client for every rectangle.
+  struct DecodeContext
+  {
+    ReceiveBuffer* input;
+    PixelFormat format;
+
+    // Framebuffer of width * height pixels, null when it is not kept and decoded pixels are dropped.
+    char* framebuffer;
+    int width;
+    int height;
+    size_t stride;
+
+    // Set by decoder when rest of rectangle goes from the socket straight into framebuffer rows.
+    bool read_direct;
+    DirectRead direct;
+  };
+
+  // Decodes rectangles of one encoding. Client creates one per encoding from the registry, and keeps it for
+  // the connection, so that decoders may keep state such as compression streams between rectangles.
+  class RectDecoder
+  {
+  public:
+    enum Result
+    {
+      decode_incomplete = 0,
+      decode_done = 1,
+      decode_failed = 2
+    };
+
+    typedef RectDecoder* (*Factory)();
+
+  public:
+    virtual ~RectDecoder();
+
+    // Called as data arrives until rectangle is done. Data is consumed from input by decoder, which may
+    // take it in parts, keeping its progress, or wait until whole rectangle is received.
+    virtual Result decode(DecodeContext& context, const RectHeader& rect) = 0;
+
+    // Returns new decoder for encoding, or null when there is none.
+    static RectDecoder* create(int encoding);
+
+    static bool supported(int encoding);
+
+    // Adds decoder of an encoding, or replaces built-in one. Affects clients connected afterwards.
+    static void register_factory(int encoding, Factory factory);
+
+  protected:
+    // Fills rectangle with one pixel, clipped to framebuffer. Does nothing when framebuffer is not kept.
+    static void fill(DecodeContext& context, int x, int y, int width, int height, const char* pixel);
+
+    // Rows of rectangle in framebuffer for pixel data as it is on the wire, clipped to framebuffer.
+    static DirectRead framebuffer_rows(const DecodeContext& context, const RectHeader& rect);
+  };
+
+  // Pixel data as it is on the wire, read straight into framebuffer rows.
+  class RawDecoder: public RectDecoder
+  {
+  public:
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+  };
+
+  // Background pixel and list of solid subrectangles. CoRRE is the same with one byte coordinates.
+  class RreDecoder: public RectDecoder
+  {
+  public:
+    explicit RreDecoder(bool compact = false);
+
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+
+  private:
+    bool _compact;
+    bool _started;
+    unsigned int _subrects;
+  };
+
+  class CorreDecoder: public RreDecoder
+  {
+  public:
+    CorreDecoder(): RreDecoder(true)
+    {
+    }
+  };
+
+  // Rectangle copied from elsewhere in the framebuffer, as when scrolling or dragging a window.
+  class CopyRectDecoder: public RectDecoder
+  {
+  public:
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+  };
+}
+
+#endif
@@ -0,0 +1,416 @@
+#include "session_reactor.hpp"
+
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <math.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#endif
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace Network
+{
+#	define MAX_REACTOR_EVENTS 256
+
+#ifdef WIN32
+  typedef WSAPOLLFD PollDescriptor;
+#else
+  typedef pollfd PollDescriptor;
+#endif
+
+  inline int timeout_milliseconds(float timeout)
+  {
+    return timeout < 0 ? -1 : (int)ceil(timeout * 1000.0f);
+  }
+
+  SessionReactor::SessionReactor()
+    : _poll(-1), _has_wakeup(false)
+  {
+    _waiting = false;
+
+    _has_wakeup = open_wakeup(_wakeup);
+
+#ifdef __linux__
+    _poll = epoll_create1(EPOLL_CLOEXEC);
+
+    if (_poll >= 0 && _has_wakeup)
+    {
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.ptr = 0;
+
+      epoll_ctl(_poll, EPOLL_CTL_ADD, _wakeup[0], &event);
+    }
+
+    _events.resize(MAX_REACTOR_EVENTS * sizeof(epoll_event));
+#endif
+  }
+
+  SessionReactor::~SessionReactor()
+  {
+    while (!_sessions.empty())
+      remove(_sessions.back()->stream);
+
+    if (_has_wakeup)
+      close_wakeup(_wakeup);
+
+#ifdef __linux__
+    if (_poll >= 0)
+      ::close(_poll);
+#endif
+  }
+
+  bool SessionReactor::add(RawStream* stream)
+  {
+    if (stream->_reactor)
+      return stream->_reactor == this;
+
+#ifdef __linux__
+    if (_poll < 0)
+      return false;
+#endif
+
+    Session* session = new Session();
+    session->stream = stream;
+    session->index = _sessions.size();
+    session->socket = 0;
+    session->events = 0;
+    session->scheduled = false;
+    session->timed = false;
+
+    _sessions.push_back(session);
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      stream->_reactor = this;
+      stream->_reactor_session = session;
+    }
+
+    // Start connecting, or send data written before the stream was added, on next run.
+    schedule(stream);
+
+    return true;
+  }
+
+  void SessionReactor::remove(RawStream* stream)
+  {
+    if (stream->_reactor != this)
+      return;
+
+    Session* session = (Session*)stream->_reactor_session;
+
+#ifdef __linux__
+    if (session->events)
+      epoll_ctl(_poll, EPOLL_CTL_DEL, session->socket, 0);
+#endif
+
+    if (session->timed)
+      _timers.erase(session->timer);
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      if (session->scheduled)
+        _scheduled.erase(std::find(_scheduled.begin(), _scheduled.end(), session));
+
+      stream->_reactor = 0;
+      stream->_reactor_session = 0;
+    }
+
+    _sessions[session->index] = _sessions.back();
+    _sessions[session->index]->index = session->index;
+    _sessions.pop_back();
+
+    delete session;
+  }
+
+  int SessionReactor::run(float timeout)
+  {
+    int dispatched = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      _pending.swap(_scheduled);
+
+      for (size_t i = 0; i < _pending.size(); ++i)
+        _pending[i]->scheduled = false;
+    }
+
+    // Streams which were just added need to start connecting, and connecting ones are scheduled when
+    // connection is established. Others only get their send interest updated.
+    for (size_t i = 0; i < _pending.size(); ++i)
+    {
+      if (_pending[i]->stream->state() != RawStream::state_connected)
+      {
+        dispatch(_pending[i], 0);
+        ++dispatched;
+      }
+      else
+        watch(_pending[i]);
+    }
+
+    _pending.clear();
+
+    // Announce the wait before checking schedule, so that concurrent writes either are seen here or wake us up.
+    _waiting = true;
+
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      idle = _scheduled.empty();
+    }
+
+    float wait_timeout = idle && !dispatched ? timeout : 0;
+
+    // Wait ends when the nearest deadline passes.
+    if (!_timers.empty())
+    {
+      float left = (float)std::max(_timers.begin()->first - monotonic_time(), 0.0);
+      wait_timeout = wait_timeout < 0 ? left : std::min(wait_timeout, left);
+    }
+
+    int result = wait(wait_timeout);
+
+    _waiting = false;
+
+    if (result < 0)
+      return -1;
+
+    return dispatched + result + expire();
+  }
+
+  int SessionReactor::expire()
+  {
+    double now = monotonic_time();
+
+    // Expired timers are taken out first, dispatch arms them again with the next deadline.
+    while (!_timers.empty() && _timers.begin()->first <= now)
+    {
+      Session* session = _timers.begin()->second;
+      session->timed = false;
+
+      _timers.erase(_timers.begin());
+      _expired.push_back(session);
+    }
+
+    int dispatched = (int)_expired.size();
+
+    for (size_t i = 0; i < _expired.size(); ++i)
+      dispatch(_expired[i], 0);
+
+    _expired.clear();
+
+    return dispatched;
+  }
+
+  int SessionReactor::wait(float timeout)
+  {
+    int dispatched = 0;
+
+#ifdef __linux__
+    epoll_event* events = (epoll_event*)&_events[0];
+
+    int count = epoll_wait(_poll, events, MAX_REACTOR_EVENTS, timeout_milliseconds(timeout));
+    if (count < 0)
+      return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < count; ++i)
+    {
+      Session* session = (Session*)events[i].data.ptr;
+
+      if (!session)
+      {
+        drain_wakeup(_wakeup);
+        continue;
+      }
+
+      int status = 0;
+      status |= (events[i].events & (EPOLLIN | EPOLLHUP)) ? RawStream::poll_receive : 0;
+      status |= (events[i].events & EPOLLOUT) ? RawStream::poll_send : 0;
+      status |= (events[i].events & EPOLLERR) ? RawStream::poll_error : 0;
+
+      dispatch(session, status);
+      ++dispatched;
+    }
+#else
+    // Without epoll, interest set is rebuilt on every wait.
+    _events.resize((_sessions.size() + 1) * sizeof(PollDescriptor));
+    _pending.clear();
+
+    PollDescriptor* fds = (PollDescriptor*)&_events[0];
+    int count = 0;
+
+    if (_has_wakeup)
+    {
+      fds[count].fd = _wakeup[0];
+      fds[count].events = POLLIN;
+      fds[count].revents = 0;
+      ++count;
+    }
+
+    for (size_t i = 0; i < _sessions.size(); ++i)
+    {
+      if (!_sessions[i]->events)
+        continue;
+
+      fds[count].fd = _sessions[i]->socket;
+      fds[count].events = POLLIN | ((_sessions[i]->events & RawStream::poll_send) ? POLLOUT : 0);
+      fds[count].revents = 0;
+      ++count;
+
+      _pending.push_back(_sessions[i]);
+    }
+
+#ifdef WIN32
+    int result = WSAPoll(fds, count, timeout_milliseconds(timeout));
+#else
+    int result = ::poll(fds, count, timeout_milliseconds(timeout));
+#endif
+
+    if (result < 0)
+    {
+      _pending.clear();
+
+#ifdef WIN32
+      return -1;
+#else
+      return errno == EINTR ? 0 : -1;
+#endif
+    }
+
+    int first = _has_wakeup ? 1 : 0;
+
+    if (_has_wakeup && fds[0].revents)
+      drain_wakeup(_wakeup);
+
+    for (int i = first; i < count; ++i)
+    {
+      if (!fds[i].revents)
+        continue;
+
+      int status = 0;
+      status |= (fds[i].revents & (POLLIN | POLLHUP)) ? RawStream::poll_receive : 0;
+      status |= (fds[i].revents & POLLOUT) ? RawStream::poll_send : 0;
+      status |= (fds[i].revents & (POLLERR | POLLNVAL)) ? RawStream::poll_error : 0;
+
+      dispatch(_pending[i - first], status);
+      ++dispatched;
+    }
+
+    _pending.clear();
+#endif
+
+    return dispatched;
+  }
+
+  void SessionReactor::wakeup()
+  {
+    if (_has_wakeup)
+      signal_wakeup(_wakeup);
+  }
+
+  void SessionReactor::schedule(RawStream* stream)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      Session* session = (Session*)stream->_reactor_session;
+      if (!session || session->scheduled)
+        return;
+
+      session->scheduled = true;
+
+      _scheduled.push_back(session);
+    }
+
+    if (_waiting)
+      wakeup();
+  }
+
+  void SessionReactor::dispatch(Session* session, int poll_status)
+  {
+    session->stream->dispatch(poll_status);
+
+    watch(session);
+  }
+
+  void SessionReactor::watch(Session* session)
+  {
+    RawStream* stream = session->stream;
+
+    arm(session);
+
+    Socket socket = stream->tcp_error() ? 0 : stream->poll_handle();
+
+    int events = 0;
+    if (socket)
+      events = RawStream::poll_receive | (stream->write_pending() ? RawStream::poll_send : 0);
+
+    if (socket == session->socket && events == session->events)
+      return;
+
+#ifdef __linux__
+    if (session->events && session->socket != socket)
+      epoll_ctl(_poll, EPOLL_CTL_DEL, session->socket, 0);
+
+    if (events)
+    {
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      if (events & RawStream::poll_send)
+        event.events |= EPOLLOUT;
+      event.data.ptr = session;
+
+      // Descriptor closed by the stream was taken out by unwatch(), so registered one is still open.
+      bool registered = session->events && session->socket == socket;
+
+      epoll_ctl(_poll, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, socket, &event);
+    }
+#endif
+
+    session->socket = socket;
+    session->events = events;
+  }
+
+  void SessionReactor::unwatch(RawStream* stream)
+  {
+    Session* session = (Session*)stream->_reactor_session;
+
+#ifdef __linux__
+    if (session->events)
+      epoll_ctl(_poll, EPOLL_CTL_DEL, session->socket, 0);
+#endif
+
+    session->socket = 0;
+    session->events = 0;
+  }
+
+  void SessionReactor::arm(Session* session)
+  {
+    double deadline = session->stream->deadline();
+
+    // Timer which fires early just gets armed again, so it is only moved when deadline comes sooner.
+    // Idle deadline moving later on every receive then costs nothing.
+    if (deadline <= 0 || (session->timed && session->timer->first <= deadline))
+      return;
+
+    if (session->timed)
+      _timers.erase(session->timer);
+
+    session->timer = _timers.insert(std::make_pair(deadline, session));
+    session->timed = true;
+  }
+}
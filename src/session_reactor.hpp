@@ -0,0 +1,94 @@
+#ifndef header_0033a1a5_8d1d_413a_b9e1_b1368ee498e0
+#define header_0033a1a5_8d1d_413a_b9e1_b1368ee498e0
+
+#include "raw_query.hpp"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace Network
+{
+  // Drives many streams from a single thread. Sockets of all streams are watched by one epoll set
+  // (poll on other platforms), and only streams with network activity are dispatched.
+  // Streams are added, removed and destroyed on the thread calling run(), while data can be
+  // written to them from any thread. Stream deadlines are kept in one ordered timer list, so hung
+  // hosts are failed on time without scanning all sessions.
+  class SessionReactor
+  {
+  public:
+    SessionReactor();
+    ~SessionReactor();
+
+    bool add(RawStream* stream);
+    void remove(RawStream* stream);
+
+    // Waits up to timeout seconds for activity and dispatches ready streams, negative timeout
+    // waits until something happens. Returns number of dispatched streams, or -1 on failure.
+    int run(float timeout = -1);
+
+    // Interrupts run() waiting on another thread.
+    void wakeup();
+
+    size_t size() const
+    {
+      return _sessions.size();
+    }
+
+  private:
+    struct Session;
+
+    typedef std::multimap<double, Session*> Timers;
+
+    struct Session
+    {
+      RawStream* stream;
+      size_t index;
+      Socket socket;
+      int events;
+      bool scheduled;
+
+      Timers::iterator timer;
+      bool timed;
+    };
+
+    friend class RawStream;
+
+    void schedule(RawStream* stream);
+
+    void dispatch(Session* session, int poll_status);
+
+    void watch(Session* session);
+
+    // Takes descriptor of stream out of the watched set before stream closes it, so that its number,
+    // reused by another stream meanwhile, is never removed later.
+    void unwatch(RawStream* stream);
+
+    void arm(Session* session);
+
+    int expire();
+
+    int wait(float timeout);
+
+  private:
+    std::vector<Session*> _sessions;
+
+    Timers _timers;
+    std::vector<Session*> _expired;
+
+    std::mutex _lock;
+    std::vector<Session*> _scheduled;
+    std::vector<Session*> _pending;
+    std::atomic<bool> _waiting;
+
+    std::vector<char> _events;
+
+    int _poll;
+
+    Socket _wakeup[2];
+    bool _has_wakeup;
+  };
+}
+
+#endif
@@ -0,0 +1,307 @@
+#include "stream_buffer.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace Network
+{
+#	define MIN_RECEIVE_CAPACITY 4096
+#	define SEND_CHUNK_SIZE 4096
+
+  ReceiveBuffer::ReceiveBuffer()
+    : _head(0), _length(0), _mask(0)
+  {
+  }
+
+  unsigned char ReceiveBuffer::u8(size_t offset) const
+  {
+    return (unsigned char)(*this)[offset];
+  }
+
+  unsigned short ReceiveBuffer::u16(size_t offset) const
+  {
+    return (unsigned short)((u8(offset) << 8) | u8(offset + 1));
+  }
+
+  unsigned int ReceiveBuffer::u32(size_t offset) const
+  {
+    return
+      ((unsigned int)u8(offset) << 24) |
+      ((unsigned int)u8(offset + 1) << 16) |
+      ((unsigned int)u8(offset + 2) << 8) |
+      (unsigned int)u8(offset + 3);
+  }
+
+  BufferSpan<const char> ReceiveBuffer::span(size_t offset, size_t length) const
+  {
+    BufferSpan<const char> result = { 0, 0, 0, 0 };
+
+    length = std::min(length, _length - std::min(offset, _length));
+    if (!length)
+      return result;
+
+    size_t start = (_head + offset) & _mask;
+
+    result.first = &_storage[start];
+    result.first_length = std::min(length, _storage.size() - start);
+
+    if (result.first_length < length)
+    {
+      result.second = &_storage[0];
+      result.second_length = length - result.first_length;
+    }
+
+    return result;
+  }
+
+  void ReceiveBuffer::copy(size_t offset, size_t length, char* destination) const
+  {
+    BufferSpan<const char> s = span(offset, length);
+
+    if (s.first_length)
+      memcpy(destination, s.first, s.first_length);
+    if (s.second_length)
+      memcpy(destination + s.first_length, s.second, s.second_length);
+  }
+
+  const char* ReceiveBuffer::contiguous(size_t offset, size_t length)
+  {
+    if (_head + offset + length > _storage.size() && _head + offset < _storage.size())
+    {
+      // Requested range wraps, move queued data to the beginning of the storage.
+      std::vector<char> storage(_storage.size());
+      copy(0, _length, storage.empty() ? 0 : &storage[0]);
+
+      _storage.swap(storage);
+      _head = 0;
+    }
+
+    return _storage.empty() ? 0 : &_storage[(_head + offset) & _mask];
+  }
+
+  BufferSpan<char> ReceiveBuffer::writable()
+  {
+    BufferSpan<char> result = { 0, 0, 0, 0 };
+
+    size_t free = _storage.size() - _length;
+    if (!free)
+      return result;
+
+    size_t tail = (_head + _length) & _mask;
+
+    result.first = &_storage[tail];
+    result.first_length = std::min(free, _storage.size() - tail);
+
+    if (result.first_length < free)
+    {
+      result.second = &_storage[0];
+      result.second_length = free - result.first_length;
+    }
+
+    return result;
+  }
+
+  void ReceiveBuffer::commit(size_t bytes)
+  {
+    _length += std::min(bytes, _storage.size() - _length);
+  }
+
+  void ReceiveBuffer::reserve(size_t bytes)
+  {
+    if (_length + bytes > _storage.size())
+    {
+      size_t capacity = std::max((size_t)MIN_RECEIVE_CAPACITY, _storage.size());
+      while (capacity < _length + bytes)
+        capacity *= 2;
+
+      grow(capacity);
+    }
+  }
+
+  void ReceiveBuffer::append(const char* data, size_t length)
+  {
+    reserve(length);
+
+    BufferSpan<char> s = writable();
+
+    size_t first = std::min(length, s.first_length);
+    memcpy(s.first, data, first);
+    if (first < length)
+      memcpy(s.second, data + first, length - first);
+
+    commit(length);
+  }
+
+  void ReceiveBuffer::consume(size_t bytes)
+  {
+    bytes = std::min(bytes, _length);
+
+    _head = (_head + bytes) & _mask;
+    _length -= bytes;
+
+    // Keep data at the start of the storage when possible, so that next messages are contiguous.
+    if (!_length)
+      _head = 0;
+  }
+
+  void ReceiveBuffer::clear()
+  {
+    _head = 0;
+    _length = 0;
+  }
+
+  void ReceiveBuffer::grow(size_t capacity)
+  {
+    std::vector<char> storage(capacity);
+    copy(0, _length, &storage[0]);
+
+    _storage.swap(storage);
+    _head = 0;
+    _mask = capacity - 1;
+  }
+
+  SendQueue::SendQueue()
+    : _offset(0), _length(0), _message_offset(0)
+  {
+  }
+
+  const char* SendQueue::chunk(size_t index, size_t& length) const
+  {
+    size_t offset = index ? 0 : _offset;
+
+    length = _chunks[index].size() - offset;
+
+    return _chunks[index].data() + offset;
+  }
+
+  void SendQueue::append(const char* data, size_t length)
+  {
+    if (!length)
+      return;
+
+    if (_chunks.empty() || _chunks.back().size() + length > SEND_CHUNK_SIZE)
+    {
+      // Reuse storage of last sent chunk.
+      _chunks.push_back(std::string());
+      _chunks.back().swap(_spare);
+      _chunks.back().clear();
+    }
+
+    _chunks.back().append(data, length);
+    _length += length;
+
+    _messages.push_back(length);
+  }
+
+  void SendQueue::append(SendQueue& queue)
+  {
+    if (queue._offset)
+    {
+      queue._chunks.front().erase(0, queue._offset);
+      queue._offset = 0;
+    }
+
+    if (queue._message_offset)
+    {
+      queue._messages.front() -= queue._message_offset;
+      queue._message_offset = 0;
+    }
+
+    _messages.insert(_messages.end(), queue._messages.begin(), queue._messages.end());
+
+    for (size_t i = 0; i < queue._chunks.size(); ++i)
+    {
+      _chunks.push_back(std::string());
+      _chunks.back().swap(queue._chunks[i]);
+    }
+
+    _length += queue._length;
+
+    queue.clear();
+  }
+
+  void SendQueue::consume(size_t bytes)
+  {
+    bytes = std::min(bytes, _length);
+
+    drop(bytes);
+
+    while (bytes)
+    {
+      size_t remaining = _messages.front() - _message_offset;
+
+      if (bytes < remaining)
+      {
+        _message_offset += bytes;
+        break;
+      }
+
+      bytes -= remaining;
+
+      _messages.pop_front();
+      _message_offset = 0;
+    }
+  }
+
+  void SendQueue::drop(size_t bytes)
+  {
+    _length -= bytes;
+
+    while (bytes)
+    {
+      size_t available = _chunks.front().size() - _offset;
+
+      if (bytes < available)
+      {
+        _offset += bytes;
+        break;
+      }
+
+      bytes -= available;
+
+      if (_chunks.front().capacity() <= SEND_CHUNK_SIZE)
+        _spare.swap(_chunks.front());
+
+      _chunks.pop_front();
+      _offset = 0;
+    }
+  }
+
+  void SendQueue::drop_partial()
+  {
+    if (!_message_offset)
+      return;
+
+    drop(_messages.front() - _message_offset);
+
+    _messages.pop_front();
+    _message_offset = 0;
+  }
+
+  void SendQueue::take(std::string& data)
+  {
+    data.clear();
+    data.reserve(_length);
+
+    for (size_t i = 0; i < _chunks.size(); ++i)
+    {
+      size_t length;
+      const char* p = chunk(i, length);
+
+      data.append(p, length);
+    }
+
+    clear();
+  }
+
+  void SendQueue::clear()
+  {
+    _chunks.clear();
+    _offset = 0;
+    _length = 0;
+
+    _messages.clear();
+    _message_offset = 0;
+  }
+}
@@ -0,0 +1,156 @@
+#ifndef header_3043a96b_9156_45b2_b3d0_ce7fbc95a1e2
+#define header_3043a96b_9156_45b2_b3d0_ce7fbc95a1e2
+
+#include <stddef.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace Network
+{
+  // Region of buffer memory which may wrap around the end of the ring, in which case
+  // it continues at the beginning of the storage as a second part.
+  template <typename T>
+  struct BufferSpan
+  {
+    T* first;
+    size_t first_length;
+    T* second;
+    size_t second_length;
+
+    size_t length() const
+    {
+      return first_length + second_length;
+    }
+  };
+
+  // Receive buffer organized as a ring, so that consuming data from the front is O(1)
+  // regardless of how much data is still queued behind it.
+  class ReceiveBuffer
+  {
+  public:
+    ReceiveBuffer();
+
+    size_t length() const
+    {
+      return _length;
+    }
+
+    size_t size() const
+    {
+      return _length;
+    }
+
+    bool empty() const
+    {
+      return _length == 0;
+    }
+
+    size_t capacity() const
+    {
+      return _storage.size();
+    }
+
+    char operator[](size_t offset) const
+    {
+      return _storage[(_head + offset) & _mask];
+    }
+
+    // Network byte order readers.
+    unsigned char u8(size_t offset) const;
+    unsigned short u16(size_t offset) const;
+    unsigned int u32(size_t offset) const;
+
+    BufferSpan<const char> span(size_t offset, size_t length) const;
+
+    void copy(size_t offset, size_t length, char* destination) const;
+
+    // Returns pointer to contiguous block of data, rearranging the ring if requested range wraps around.
+    const char* contiguous(size_t offset, size_t length);
+
+    // Free space following queued data, to be filled by receive calls and then committed.
+    BufferSpan<char> writable();
+
+    void commit(size_t bytes);
+
+    void reserve(size_t bytes);
+
+    void append(const char* data, size_t length);
+
+    void consume(size_t bytes);
+
+    void clear();
+
+  private:
+    void grow(size_t capacity);
+
+  private:
+    std::vector<char> _storage;
+
+    size_t _head;
+    size_t _length;
+    size_t _mask;
+  };
+
+  // Outgoing data kept as a list of chunks, so that it can be sent with one gathering call and
+  // partially sent data is dropped from the front without moving the rest. Small messages
+  // written one after another are packed into the same chunk, their lengths are kept apart.
+  class SendQueue
+  {
+  public:
+    SendQueue();
+
+    size_t length() const
+    {
+      return _length;
+    }
+
+    bool empty() const
+    {
+      return _length == 0;
+    }
+
+    // Number of chunks holding queued data, and unsent part of each of them.
+    size_t chunks() const
+    {
+      return _chunks.size();
+    }
+
+    const char* chunk(size_t index, size_t& length) const;
+
+    // Data of each call is one message.
+    void append(const char* data, size_t length);
+
+    // Moves all data queued in other queue to the end of this one.
+    void append(SendQueue& queue);
+
+    void consume(size_t bytes);
+
+    // Drops rest of front message if part of it was already sent, keeping only messages which were never
+    // touched.
+    void drop_partial();
+
+    // Moves all queued data into single contiguous string.
+    void take(std::string& data);
+
+    void clear();
+
+  private:
+    // Removes bytes from the front chunks, regardless of messages.
+    void drop(size_t bytes);
+
+  private:
+    std::deque<std::string> _chunks;
+    std::string _spare;
+
+    size_t _offset;
+    size_t _length;
+
+    // Length of every queued message, and part of the first one already sent.
+    std::deque<size_t> _messages;
+    size_t _message_offset;
+  };
+}
+
+#endif
@@ -0,0 +1,613 @@
+#include "tight_decoder.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define TIGHT_GRADIENT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#	define TIGHT_GRADIENT_NEON
+#endif
+
+namespace Network
+{
+  // Shorter data is sent as it is, without compression and its length.
+#	define TIGHT_MIN_TO_COMPRESS 12
+
+  template <int BPP>
+  static inline unsigned int load_value(const unsigned char* data, bool big_endian)
+  {
+    unsigned int value = 0;
+
+    for (int i = 0; i < BPP; ++i)
+      value |= (unsigned int)data[i] << (big_endian ? (BPP - 1 - i) * 8 : i * 8);
+
+    return value;
+  }
+
+  template <int BPP>
+  static inline void store_value(char* pixel, unsigned int value, bool big_endian)
+  {
+    for (int i = 0; i < BPP; ++i)
+      pixel[i] = (char)(value >> (big_endian ? (BPP - 1 - i) * 8 : i * 8));
+  }
+
+  static inline void tight_pixel(const unsigned char* data, int tpixel, const PixelFormat& format, char* pixel)
+  {
+    if (tpixel == 3)
+      format.store_rgb(pixel, data[0], data[1], data[2]);
+    else
+      memcpy(pixel, data, tpixel);
+  }
+
+  // Red, green and blue bytes of 3 byte Tight pixels, whose format has 8 bit colours in 4 bytes.
+  static void store_rgb_row(const unsigned char* rgb, char* destination, int width, const PixelFormat& format)
+  {
+    int red_shift = format.red_shift;
+    int green_shift = format.green_shift;
+    int blue_shift = format.blue_shift;
+
+    if (format.big_endian)
+    {
+      for (int x = 0; x < width; ++x, rgb += 3, destination += 4)
+        store_value<4>(destination, (rgb[0] << red_shift) | (rgb[1] << green_shift) | (rgb[2] << blue_shift), true);
+    }
+    else
+    {
+      for (int x = 0; x < width; ++x, rgb += 3, destination += 4)
+        store_value<4>(destination, (rgb[0] << red_shift) | (rgb[1] << green_shift) | (rgb[2] << blue_shift), false);
+    }
+  }
+
+  // Every colour is predicted as left + above - above left, clamped to 0..255, and data is added to it modulo
+  // 256. Pixel depends on the one to its left, so colours of a pixel are predicted together in one register.
+  // Input and output rows have a byte past their end, as each pixel is loaded and stored as 4 bytes.
+  static void gradient_rgb_row(const unsigned char* data, const unsigned char* above, unsigned char* row, int width)
+  {
+#if defined(TIGHT_GRADIENT_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i left = zero;
+    __m128i above_left = zero;
+
+    for (int x = 0; x < width; ++x)
+    {
+      int word;
+
+      memcpy(&word, above + x * 3, 4);
+      __m128i up = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero);
+
+      // Packing with unsigned saturation is the clamp.
+      __m128i prediction = _mm_packus_epi16(_mm_sub_epi16(_mm_add_epi16(left, up), above_left), zero);
+
+      memcpy(&word, data + x * 3, 4);
+      __m128i value = _mm_add_epi8(prediction, _mm_cvtsi32_si128(word));
+
+      word = _mm_cvtsi128_si32(value);
+      memcpy(row + x * 3, &word, 4);
+
+      left = _mm_unpacklo_epi8(value, zero);
+      above_left = up;
+    }
+#elif defined(TIGHT_GRADIENT_NEON)
+    int16x8_t left = vdupq_n_s16(0);
+    int16x8_t above_left = left;
+
+    for (int x = 0; x < width; ++x)
+    {
+      uint32_t word;
+
+      memcpy(&word, above + x * 3, 4);
+      int16x8_t up = vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(word))));
+
+      uint8x8_t prediction = vqmovun_s16(vsubq_s16(vaddq_s16(left, up), above_left));
+
+      memcpy(&word, data + x * 3, 4);
+      uint8x8_t value = vadd_u8(prediction, vreinterpret_u8_u32(vdup_n_u32(word)));
+
+      word = vget_lane_u32(vreinterpret_u32_u8(value), 0);
+      memcpy(row + x * 3, &word, 4);
+
+      left = vreinterpretq_s16_u16(vmovl_u8(value));
+      above_left = up;
+    }
+#else
+    for (int x = 0; x < width * 3; ++x)
+    {
+      int left = x >= 3 ? row[x - 3] : 0;
+      int above_left = x >= 3 ? above[x - 3] : 0;
+      int prediction = std::min(std::max(left + above[x] - above_left, 0), 255);
+
+      row[x] = (unsigned char)(prediction + data[x]);
+    }
+#endif
+  }
+
+  // Other formats predict colours within pixel values in the same way, modulo their maximum plus one.
+  template <int BPP>
+  static void gradient_row(const unsigned char* data, const unsigned int* above, unsigned int* row, int width, const PixelFormat& format)
+  {
+    const int shifts[3] = { format.red_shift, format.green_shift, format.blue_shift };
+    const int maxes[3] = { format.red_max, format.green_max, format.blue_max };
+
+    for (int x = 0; x < width; ++x)
+    {
+      unsigned int value = load_value<BPP>(data + x * BPP, format.big_endian);
+      unsigned int pixel = 0;
+
+      for (int c = 0; c < 3; ++c)
+      {
+        int shift = shifts[c];
+        int max = maxes[c];
+
+        int left = x ? (row[x - 1] >> shift) & max : 0;
+        int above_left = x ? (above[x - 1] >> shift) & max : 0;
+        int prediction = std::min(std::max(left + (int)((above[x] >> shift) & max) - above_left, 0), max);
+
+        pixel |= (((value >> shift) + prediction) & max) << shift;
+      }
+
+      row[x] = pixel;
+    }
+  }
+
+  template <int BPP>
+  static void gradient_rows(const unsigned char* data, size_t row_length, unsigned int* rows, const PixelFormat& format,
+    char* destination, size_t stride, int width, int height)
+  {
+    unsigned int* above = rows;
+    unsigned int* row = rows + width;
+
+    memset(above, 0, width * sizeof(unsigned int));
+
+    for (int y = 0; y < height; ++y, data += row_length, destination += stride)
+    {
+      gradient_row<BPP>(data, above, row, width, format);
+
+      for (int x = 0; x < width; ++x)
+        store_value<BPP>(destination + x * BPP, row[x], format.big_endian);
+
+      std::swap(above, row);
+    }
+  }
+
+  // Two colour palette takes a bit per pixel, most significant first, rows start at byte boundary.
+  template <int BPP>
+  static void palette_rows(const unsigned char* data, size_t row_length, const char (*palette)[4], int palette_size,
+    char* destination, size_t stride, int width, int height)
+  {
+    for (int y = 0; y < height; ++y, data += row_length, destination += stride)
+    {
+      if (palette_size == 2)
+      {
+        for (int x = 0; x < width; ++x)
+          memcpy(destination + x * BPP, palette[(data[x >> 3] >> (7 - (x & 7))) & 1], BPP);
+      }
+      else
+      {
+        for (int x = 0; x < width; ++x)
+          memcpy(destination + x * BPP, palette[data[x]], BPP);
+      }
+    }
+  }
+
+  TightDecoder::TightDecoder(bool png)
+  {
+    _tight_png = png;
+    _image = 0;
+    _stage = stage_control;
+    _stream = 0;
+    _filter = filter_copy;
+    _palette_size = 0;
+    _length = 0;
+    _length_bytes = 0;
+    _row_length = 0;
+    _data_length = 0;
+    _remaining = 0;
+    _direct = false;
+  }
+
+  RectDecoder::Result TightDecoder::fail()
+  {
+    _stage = stage_control;
+
+    return decode_failed;
+  }
+
+  void TightDecoder::start_data(const DecodeContext& context, const RectHeader& rect)
+  {
+    int bpp = context.format.bytes_per_pixel();
+    int tpixel = context.format.tight_pixel_size();
+
+    if (_filter == filter_palette)
+      _row_length = _palette_size == 2 ? (rect.width + 7) / 8 : rect.width;
+    else
+      _row_length = (size_t)rect.width * tpixel;
+
+    _data_length = _row_length * rect.height;
+
+    // Pixels as they are on the wire are inflated straight into framebuffer rows, as with Zlib, and so is data
+    // which is dropped anyway.
+    _direct = _data_length >= TIGHT_MIN_TO_COMPRESS && (!context.framebuffer || (_filter == filter_copy && tpixel == bpp));
+
+    if (!_direct)
+      _pixels.resize(_data_length + 1);
+
+    if (_data_length < TIGHT_MIN_TO_COMPRESS)
+    {
+      _stream = -1;
+      _stage = stage_data;
+    }
+    else
+    {
+      _length = 0;
+      _length_bytes = 0;
+      _stage = stage_length;
+    }
+  }
+
+  bool TightDecoder::read_length(ReceiveBuffer& input)
+  {
+    while (!input.empty())
+    {
+      size_t byte = input.u8(0);
+
+      input.consume(1);
+
+      // Seven bits in first two bytes, whose high bit tells that another byte follows, all eight in third one.
+      if (_length_bytes == 2)
+      {
+        _length |= byte << 14;
+
+        return true;
+      }
+
+      _length |= (byte & 0x7f) << (7 * _length_bytes++);
+
+      if (!(byte & 0x80))
+        return true;
+    }
+
+    return false;
+  }
+
+  void TightDecoder::apply_filter(DecodeContext& context, const RectHeader& rect)
+  {
+    if (!context.framebuffer)
+      return;
+
+    int bpp = context.format.bytes_per_pixel();
+    int tpixel = context.format.tight_pixel_size();
+
+    // Only the part within framebuffer is stored, rows and columns past it do not affect it.
+    DirectRead target = framebuffer_rows(context, rect);
+
+    int width = (int)(target.copy_length / bpp);
+    int height = (int)target.stored_rows;
+
+    const unsigned char* data = (const unsigned char*)&_pixels[0];
+
+    if (_filter == filter_palette)
+    {
+      switch (bpp)
+      {
+        case 1:
+          palette_rows<1>(data, _row_length, _palette, _palette_size, target.destination, target.stride, width, height);
+          break;
+        case 2:
+          palette_rows<2>(data, _row_length, _palette, _palette_size, target.destination, target.stride, width, height);
+          break;
+        case 4:
+          palette_rows<4>(data, _row_length, _palette, _palette_size, target.destination, target.stride, width, height);
+          break;
+      }
+    }
+    else if (_filter == filter_gradient && tpixel == 3)
+    {
+      size_t row_size = (size_t)width * 3 + 1;
+
+      _rows.resize(row_size * 2);
+
+      unsigned char* above = &_rows[0];
+      unsigned char* row = above + row_size;
+
+      memset(above, 0, row_size);
+
+      for (int y = 0; y < height; ++y)
+      {
+        gradient_rgb_row(data + y * _row_length, above, row, width);
+        store_rgb_row(row, target.destination + y * target.stride, width, context.format);
+
+        std::swap(above, row);
+      }
+    }
+    else if (_filter == filter_gradient)
+    {
+      _rows.resize((size_t)width * 2 * sizeof(unsigned int));
+
+      unsigned int* rows = (unsigned int*)&_rows[0];
+
+      switch (bpp)
+      {
+        case 1:
+          gradient_rows<1>(data, _row_length, rows, context.format, target.destination, target.stride, width, height);
+          break;
+        case 2:
+          gradient_rows<2>(data, _row_length, rows, context.format, target.destination, target.stride, width, height);
+          break;
+        case 4:
+          gradient_rows<4>(data, _row_length, rows, context.format, target.destination, target.stride, width, height);
+          break;
+      }
+    }
+    else
+    {
+      for (int y = 0; y < height; ++y)
+      {
+        if (tpixel == 3)
+          store_rgb_row(data + y * _row_length, target.destination + y * target.stride, width, context.format);
+        else
+          memcpy(target.destination + y * target.stride, data + y * _row_length, target.copy_length);
+      }
+    }
+  }
+
+  RectDecoder::Result TightDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    int bpp = context.format.bytes_per_pixel();
+    int tpixel = context.format.tight_pixel_size();
+
+    if (bpp != 1 && bpp != 2 && bpp != 4)
+      return decode_failed;
+
+    if (_stage == stage_control)
+    {
+      if (input.empty())
+        return decode_incomplete;
+
+      int control = input.u8(0);
+
+      input.consume(1);
+
+      // Low bits ask for streams to start over.
+      for (int i = 0; i < 4; ++i)
+      {
+        if (control & (1 << i))
+          _streams[i].reset();
+      }
+
+      int compression = control >> 4;
+
+      _image = 0;
+
+      if (compression == compression_fill)
+        _stage = stage_fill;
+      else if (compression == compression_jpeg || (compression == compression_png && _tight_png))
+      {
+        // Image with its length sent first, as with compressed data.
+        _image = compression;
+        _length = 0;
+        _length_bytes = 0;
+        _stage = stage_length;
+      }
+      else if (compression < compression_fill && !_tight_png)
+      {
+        _stream = compression & 3;
+        _filter = filter_copy;
+
+        // Filter is given explicitly, or it is copy.
+        if (compression & 4)
+          _stage = stage_filter;
+        else
+          start_data(context, rect);
+      }
+      else
+        return fail();
+    }
+
+    if (_stage == stage_fill)
+    {
+      if (input.length() < (size_t)tpixel)
+        return decode_incomplete;
+
+      unsigned char data[4];
+      input.copy(0, tpixel, (char*)data);
+
+      char pixel[4];
+      tight_pixel(data, tpixel, context.format, pixel);
+
+      fill(context, rect.x, rect.y, rect.width, rect.height, pixel);
+
+      input.consume(tpixel);
+
+      _stage = stage_control;
+
+      return decode_done;
+    }
+
+    if (_stage == stage_filter)
+    {
+      if (input.empty())
+        return decode_incomplete;
+
+      _filter = input.u8(0);
+
+      input.consume(1);
+
+      if (_filter == filter_palette)
+        _stage = stage_palette;
+      else if (_filter == filter_copy || _filter == filter_gradient)
+        start_data(context, rect);
+      else
+        return fail();
+    }
+
+    if (_stage == stage_palette)
+    {
+      if (input.empty())
+        return decode_incomplete;
+
+      int size = input.u8(0) + 1;
+
+      if (input.length() < 1 + (size_t)size * tpixel)
+        return decode_incomplete;
+
+      const unsigned char* colours = (const unsigned char*)input.contiguous(1, size * tpixel);
+
+      // Indices past palette size pick zeroed entries.
+      memset(_palette, 0, sizeof(_palette));
+
+      for (int i = 0; i < size; ++i)
+        tight_pixel(colours + i * tpixel, tpixel, context.format, _palette[i]);
+
+      _palette_size = size;
+
+      input.consume(1 + size * tpixel);
+
+      start_data(context, rect);
+    }
+
+    if (_stage == stage_length)
+    {
+      if (!read_length(input))
+        return decode_incomplete;
+
+      _remaining = _length;
+      _stage = stage_data;
+
+      if (_image == compression_jpeg)
+      {
+        _pixels.resize(_length + 1);
+        _stage = stage_jpeg;
+      }
+      else if (_image == compression_png)
+      {
+        DirectRead target = framebuffer_rows(context, rect);
+
+        _png.start(rect.width, rect.height, context.format, target.destination, target.stride,
+          (int)(target.copy_length / bpp), (int)target.stored_rows);
+
+        _stage = stage_png;
+      }
+      else if (_direct)
+        _streams[_stream].set_output(framebuffer_rows(context, rect));
+      else
+      {
+        DirectRead rows = { &_pixels[0], _row_length, _row_length, _row_length, (size_t)rect.height, (size_t)rect.height };
+
+        _streams[_stream].set_output(rows);
+      }
+    }
+
+    if (_stage == stage_jpeg)
+    {
+      // Data is collected as it arrives, so that it does not have to fit in receive buffer.
+      size_t length = std::min(_remaining, input.length());
+
+      input.copy(0, length, &_pixels[_length - _remaining]);
+      input.consume(length);
+
+      _remaining -= length;
+
+      if (_remaining > 0)
+        return decode_incomplete;
+
+      _stage = stage_control;
+
+      DirectRead target = framebuffer_rows(context, rect);
+
+      int width = (int)(target.copy_length / bpp);
+      int height = (int)target.stored_rows;
+
+      if (!context.framebuffer || width <= 0 || height <= 0)
+        return decode_done;
+
+      bool valid = _jpeg.decode((const unsigned char*)&_pixels[0], _length, rect.width, rect.height, context.format,
+        target.destination, target.stride, width, height);
+
+      return valid ? decode_done : decode_failed;
+    }
+
+    if (_stage == stage_png)
+    {
+      // Image is decoded as it arrives, a row at a time.
+      while (_remaining > 0 && !input.empty())
+      {
+        BufferSpan<const char> span = input.span(0, std::min(_remaining, input.length()));
+
+        size_t length = span.length();
+
+        bool valid = _png.write((const unsigned char*)span.first, span.first_length) &&
+          (!span.second_length || _png.write((const unsigned char*)span.second, span.second_length));
+
+        input.consume(length);
+
+        _remaining -= length;
+
+        if (!valid)
+          return fail();
+      }
+
+      if (_remaining > 0)
+        return decode_incomplete;
+
+      _stage = stage_control;
+
+      return _png.complete() ? decode_done : decode_failed;
+    }
+
+    if (_stage == stage_data)
+    {
+      if (_stream < 0)
+      {
+        if (input.length() < _data_length)
+          return decode_incomplete;
+
+        input.copy(0, _data_length, &_pixels[0]);
+        input.consume(_data_length);
+      }
+      else
+      {
+        ZlibStream& stream = _streams[_stream];
+
+        // Data is decompressed as it arrives.
+        while (_remaining > 0 && !input.empty())
+        {
+          BufferSpan<const char> span = input.span(0, std::min(_remaining, input.length()));
+
+          size_t length = span.length();
+          bool end = length == _remaining;
+
+          bool valid = stream.inflate(span.first, span.first_length, end && !span.second_length) &&
+            (!span.second_length || stream.inflate(span.second, span.second_length, end));
+
+          input.consume(length);
+
+          _remaining -= length;
+
+          if (!valid)
+            return fail();
+        }
+
+        if (_remaining > 0)
+          return decode_incomplete;
+
+        if (stream.output_length() != _data_length)
+          return fail();
+      }
+
+      if (!_direct)
+        apply_filter(context, rect);
+
+      _stage = stage_control;
+
+      return decode_done;
+    }
+
+    return decode_incomplete;
+  }
+}
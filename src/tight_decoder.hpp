@@ -0,0 +1,104 @@
+#ifndef header_85d4eec9_c16e_411c_b57f_d254dcc87915
+#define header_85d4eec9_c16e_411c_b57f_d254dcc87915
+
+#include "jpeg_decoder.hpp"
+#include "png_decoder.hpp"
+#include "rect_decoder.hpp"
+#include "zlib_stream.hpp"
+
+#include <vector>
+
+namespace Network
+{
+  // Solid fill, JPEG image, or pixels passed through copy, palette or gradient filter and compressed by one of
+  // four zlib streams lasting for whole connection, which server may ask to start over at any rectangle.
+  class TightDecoder: public RectDecoder
+  {
+  public:
+    explicit TightDecoder(bool png = false);
+
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+
+  protected:
+    // Upper bits of compression control byte, lower values are basic compression.
+    enum Compression
+    {
+      compression_fill = 8,
+      compression_jpeg = 9,
+      compression_png = 10
+    };
+
+    enum Filter
+    {
+      filter_copy = 0,
+      filter_palette = 1,
+      filter_gradient = 2
+    };
+
+  private:
+    enum Stage
+    {
+      stage_control = 0,
+      stage_fill = 1,
+      stage_filter = 2,
+      stage_palette = 3,
+      stage_length = 4,
+      stage_data = 5,
+      stage_jpeg = 6,
+      stage_png = 7
+    };
+
+    // Sets up reading of filtered data, which is sent as it is when it is short.
+    void start_data(const DecodeContext& context, const RectHeader& rect);
+
+    // Takes 1 to 3 byte compact length as its bytes arrive. False until it is complete.
+    bool read_length(ReceiveBuffer& input);
+
+    // Filtered data in pixels buffer goes into framebuffer.
+    void apply_filter(DecodeContext& context, const RectHeader& rect);
+
+    Result fail();
+
+  private:
+    ZlibStream _streams[4];
+    JpegDecoder _jpeg;
+    PngDecoder _png;
+
+    // TightPNG sends PNG images in place of filtered data.
+    bool _tight_png;
+
+    // Compression of image sent in place of filtered data, zero for filtered data.
+    int _image;
+
+    int _stage;
+    int _stream;
+    int _filter;
+
+    int _palette_size;
+    char _palette[256][4];
+
+    size_t _length;
+    int _length_bytes;
+
+    size_t _row_length;
+    size_t _data_length;
+    size_t _remaining;
+
+    // Whether pixels are inflated straight into framebuffer, instead of pixels buffer.
+    bool _direct;
+
+    std::vector<char> _pixels;
+    std::vector<unsigned char> _rows;
+  };
+
+  // TightPNG, as offered to web clients: Tight with PNG images in place of zlib compressed filtered data.
+  class TightPngDecoder: public TightDecoder
+  {
+  public:
+    TightPngDecoder(): TightDecoder(true)
+    {
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,541 @@
+#include "tile_decoder.hpp"
+#include "pixel_fill.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace Network
+{
+#	define MAX_TILE_SIZE 64
+#	define BATCH_PIXELS (8 * 64 * 64)
+#	define PARALLEL_PIXELS (16 * 64 * 64)
+#	define MIN_ARENA_SIZE (64 * 1024)
+
+  static const size_t corrupt_tile = (size_t)-1;
+
+  template <int BPP, int CPIXEL>
+  static inline void read_pixel(const unsigned char*& data, char* pixel, int offset)
+  {
+    if (CPIXEL == BPP)
+    {
+      memcpy(pixel, data, BPP);
+    }
+    else
+    {
+      memset(pixel, 0, BPP);
+      memcpy(pixel + offset, data, CPIXEL);
+    }
+
+    data += CPIXEL;
+  }
+
+  // Run length is one plus sum of bytes up to first one below 255.
+  static inline int read_run(const unsigned char*& data)
+  {
+    int run = 1;
+
+    while (*data == 255)
+      run += *data++;
+
+    return run + *data++;
+  }
+
+  template <int BPP>
+  static inline void put_run(char* destination, size_t stride, int width, int& position, int length, const char* pixel)
+  {
+    while (length > 0)
+    {
+      int column = position % width;
+      int count = std::min(length, width - column);
+
+      fill_tile<BPP>(destination + (position / width) * stride + column * BPP, stride, count, 1, pixel);
+
+      position += count;
+      length -= count;
+    }
+  }
+
+  static inline int palette_bits(int size)
+  {
+    return size <= 2 ? 1 : size <= 4 ? 2 : 4;
+  }
+
+  TileDecoder::TileDecoder(int tile_size, bool reuse_palette)
+  {
+    _tile_size = tile_size;
+    _reuse_palette = reuse_palette;
+
+    _arena_size = 0;
+    _limit = 0;
+
+    _batch_tiles = std::max(1, BATCH_PIXELS / (tile_size * tile_size));
+  }
+
+  TileDecoder::~TileDecoder()
+  {
+    // Workers may still be decoding tiles of unfinished rectangle.
+    WorkerPool::instance().wait(_group);
+  }
+
+  void TileDecoder::start(const DecodeContext& context, const RectHeader& rect)
+  {
+    _rect = rect;
+
+    _target.framebuffer = context.framebuffer;
+    _target.stride = context.stride;
+    _target.width = context.width;
+    _target.height = context.height;
+    _target.bpp = context.format.bytes_per_pixel();
+    _target.cpixel = context.format.compact_pixel_size();
+    _target.cpixel_offset = context.format.compact_pixel_offset();
+
+    _scanned = 0;
+    _tile = 0;
+    _tiles = ((rect.width + _tile_size - 1) / _tile_size) * ((rect.height + _tile_size - 1) / _tile_size);
+
+    _palette = 0;
+    _palette_size = 0;
+
+    _parallel = (size_t)rect.width * rect.height >= PARALLEL_PIXELS;
+
+    // Largest data server may send, plain RLE of single pixel runs with palettes. Arena grows up to it
+    // only as data arrives.
+    _limit = (size_t)_tiles * (1 + 127 * _target.cpixel) + (size_t)rect.width * rect.height * (_target.cpixel + 1);
+  }
+
+  bool TileDecoder::reserve(size_t size)
+  {
+    if (size > _limit)
+      return false;
+
+    if (size <= _arena_size)
+      return true;
+
+    size_t grown = std::min(_limit, std::max(size, std::max(2 * _arena_size, (size_t)MIN_ARENA_SIZE)));
+    char* arena = new char[grown];
+
+    // Workers read tiles from arena, so it may move only once they are done.
+    WorkerPool::instance().wait(_group);
+
+    if (_arena_size)
+      memcpy(arena, _arena.get(), _arena_size);
+
+    _arena.reset(arena);
+    _arena_size = grown;
+
+    return true;
+  }
+
+  RectDecoder::Result TileDecoder::finish()
+  {
+    dispatch();
+
+    WorkerPool::instance().wait(_group);
+
+    return decode_done;
+  }
+
+  RectDecoder::Result TileDecoder::fail()
+  {
+    _queued.clear();
+
+    WorkerPool::instance().wait(_group);
+
+    return decode_failed;
+  }
+
+  bool TileDecoder::scan(size_t available)
+  {
+    if (available > _limit)
+      return false;
+
+    int columns = (_rect.width + _tile_size - 1) / _tile_size;
+
+    while (_tile < _tiles)
+    {
+      int left = (_tile % columns) * _tile_size;
+      int top = (_tile / columns) * _tile_size;
+
+      Tile tile = { _scanned, _rect.x + left, _rect.y + top,
+        std::min(_tile_size, _rect.width - left), std::min(_tile_size, _rect.height - top), 0, 0 };
+
+      size_t length = tile_length(_scanned, available, tile);
+      if (length == corrupt_tile)
+        return false;
+
+      if (!length)
+        break;
+
+      if (tile.palette_size)
+      {
+        _palette = tile.palette;
+        _palette_size = tile.palette_size;
+      }
+
+      _scanned += length;
+      ++_tile;
+
+      // Without framebuffer, tiles are only walked through.
+      if (_target.framebuffer)
+        _queued.push_back(tile);
+
+      if (_queued.size() >= _batch_tiles)
+        dispatch();
+    }
+
+    return true;
+  }
+
+  size_t TileDecoder::tile_length(size_t offset, size_t available, Tile& tile) const
+  {
+    const unsigned char* data = (const unsigned char*)_arena.get() + offset;
+    size_t end = available - offset;
+
+    if (end < 1)
+      return 0;
+
+    int subencoding = data[0];
+    size_t cpixel = _target.cpixel;
+    size_t pixels = (size_t)tile.width * tile.height;
+    size_t length = 1;
+
+    if ((subencoding >= 2 && subencoding <= 16) || subencoding >= 130)
+    {
+      tile.palette = offset + 1;
+      tile.palette_size = subencoding >= 130 ? subencoding - 128 : subencoding;
+
+      length += tile.palette_size * cpixel;
+    }
+    else if (subencoding == 127 || subencoding == 129)
+    {
+      // Palette of previous tile, packed palette takes up to 16 colours.
+      if (!_reuse_palette || !_palette_size || (subencoding == 127 && _palette_size > 16))
+        return corrupt_tile;
+
+      tile.palette = _palette;
+      tile.palette_size = _palette_size;
+    }
+
+    if (subencoding == 0)
+    {
+      length += pixels * cpixel;
+    }
+    else if (subencoding == 1)
+    {
+      length += cpixel;
+    }
+    else if (subencoding <= 16 || subencoding == 127)
+    {
+      length += tile.height * ((tile.width * palette_bits(tile.palette_size) + 7) / 8);
+    }
+    else if (subencoding >= 128)
+    {
+      bool palette = subencoding != 128;
+      size_t count = 0;
+
+      while (count < pixels)
+      {
+        bool run = true;
+
+        if (palette)
+        {
+          if (length >= end)
+            return 0;
+
+          run = (data[length++] & 128) != 0;
+        }
+        else
+          length += cpixel;
+
+        size_t run_length = 1;
+
+        while (run)
+        {
+          if (length >= end)
+            return 0;
+
+          run_length += data[length];
+          run = data[length++] == 255;
+        }
+
+        count += run_length;
+      }
+
+      if (count > pixels)
+        return corrupt_tile;
+    }
+    else
+      return corrupt_tile;
+
+    return length <= end ? length : 0;
+  }
+
+  void TileDecoder::dispatch()
+  {
+    if (_queued.empty())
+      return;
+
+    if (!_parallel)
+    {
+      decode_tiles(_queued);
+    }
+    else
+    {
+      std::vector<Tile> tiles(_queued.begin(), _queued.end());
+
+      WorkerPool::instance().submit(_group, [this, tiles]()
+      {
+        decode_tiles(tiles);
+      });
+    }
+
+    _queued.clear();
+  }
+
+  void TileDecoder::decode_tiles(const std::vector<Tile>& tiles) const
+  {
+    char pixels[MAX_TILE_SIZE * MAX_TILE_SIZE * 4];
+
+    int bpp = _target.bpp;
+
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+      const Tile& tile = tiles[i];
+
+      // Tiles reaching past framebuffer are decoded aside, and then clipped.
+      bool inside = tile.x + tile.width <= _target.width && tile.y + tile.height <= _target.height;
+
+      char* destination = inside ? _target.framebuffer + tile.y * _target.stride + tile.x * bpp : pixels;
+      size_t stride = inside ? _target.stride : _tile_size * bpp;
+
+      if (bpp == 4 && _target.cpixel == 3)
+        decode_tile<4, 3>(tile, destination, stride);
+      else if (bpp == 4)
+        decode_tile<4, 4>(tile, destination, stride);
+      else if (bpp == 2)
+        decode_tile<2, 2>(tile, destination, stride);
+      else
+        decode_tile<1, 1>(tile, destination, stride);
+
+      if (!inside)
+      {
+        int width = std::min(tile.width, _target.width - tile.x);
+        int height = std::min(tile.height, _target.height - tile.y);
+
+        for (int row = 0; row < height && width > 0; ++row)
+          memcpy(_target.framebuffer + (tile.y + row) * _target.stride + tile.x * bpp, pixels + row * stride, width * bpp);
+      }
+    }
+  }
+
+  // Tile data was checked by scan(), so it is decoded without bounds checks.
+  template <int BPP, int CPIXEL>
+  void TileDecoder::decode_tile(const Tile& tile, char* destination, size_t stride) const
+  {
+    const unsigned char* data = (const unsigned char*)_arena.get() + tile.offset;
+    int subencoding = *data++;
+
+    int width = tile.width;
+    int height = tile.height;
+    int offset = _target.cpixel_offset;
+
+    char pixel[4];
+    char palette[128][4];
+
+    if (tile.palette_size)
+    {
+      const unsigned char* colours = (const unsigned char*)_arena.get() + tile.palette;
+
+      // Indices past palette size pick zeroed entries instead of reading past it.
+      memset(palette, 0, sizeof(palette[0]) * (subencoding == 127 || subencoding <= 16 ? 16 : 128));
+
+      for (int i = 0; i < tile.palette_size; ++i)
+        read_pixel<BPP, CPIXEL>(colours, palette[i], offset);
+
+      // Own palette precedes pixel data.
+      if (subencoding != 127 && subencoding != 129)
+        data = colours;
+    }
+
+    if (subencoding == 0)
+    {
+      for (int row = 0; row < height; ++row)
+      {
+        char* p = destination + row * stride;
+
+        if (CPIXEL == BPP)
+        {
+          memcpy(p, data, width * BPP);
+          data += width * BPP;
+        }
+        else
+        {
+          for (int x = 0; x < width; ++x)
+            read_pixel<BPP, CPIXEL>(data, p + x * BPP, offset);
+        }
+      }
+    }
+    else if (subencoding == 1)
+    {
+      read_pixel<BPP, CPIXEL>(data, pixel, offset);
+
+      fill_rect(destination, stride, width, height, BPP, pixel);
+    }
+    else if (subencoding <= 16 || subencoding == 127)
+    {
+      int bits = palette_bits(tile.palette_size);
+      int mask = (1 << bits) - 1;
+
+      for (int row = 0; row < height; ++row)
+      {
+        char* p = destination + row * stride;
+
+        for (int x = 0; x < width; ++x)
+        {
+          int bit = x * bits;
+          int index = (data[bit >> 3] >> (8 - bits - (bit & 7))) & mask;
+
+          memcpy(p + x * BPP, palette[index], BPP);
+        }
+
+        data += (width * bits + 7) / 8;
+      }
+    }
+    else if (subencoding == 128)
+    {
+      for (int position = 0; position < width * height; )
+      {
+        read_pixel<BPP, CPIXEL>(data, pixel, offset);
+
+        put_run<BPP>(destination, stride, width, position, read_run(data), pixel);
+      }
+    }
+    else
+    {
+      for (int position = 0; position < width * height; )
+      {
+        int index = *data++;
+
+        put_run<BPP>(destination, stride, width, position, (index & 128) ? read_run(data) : 1, palette[index & 127]);
+      }
+    }
+  }
+
+  ZrleDecoder::ZrleDecoder()
+    : TileDecoder(64, false)
+  {
+    _started = false;
+    _remaining = 0;
+  }
+
+  RectDecoder::Result ZrleDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    int bpp = context.format.bytes_per_pixel();
+    if (bpp != 1 && bpp != 2 && bpp != 4)
+      return decode_failed;
+
+    if (!_started)
+    {
+      if (input.length() < 4)
+        return decode_incomplete;
+
+      _remaining = input.u32(0);
+      _started = true;
+
+      start(context, rect);
+
+      _stream.set_output(this, arena(), arena_size());
+
+      input.consume(4);
+    }
+
+    while (_remaining > 0 && !input.empty())
+    {
+      BufferSpan<const char> span = input.span(0, std::min(_remaining, input.length()));
+
+      size_t length = span.length();
+      bool end = length == _remaining;
+
+      bool valid = _stream.inflate(span.first, span.first_length, end && !span.second_length) &&
+        (!span.second_length || _stream.inflate(span.second, span.second_length, end));
+
+      input.consume(length);
+
+      _remaining -= length;
+
+      if (!valid)
+      {
+        _started = false;
+
+        return fail();
+      }
+    }
+
+    bool valid = scan(_stream.output_length());
+
+    if (valid && _remaining > 0)
+      return decode_incomplete;
+
+    _started = false;
+
+    // All of output has to be used by tiles of the rectangle.
+    if (!valid || !all_scanned() || scanned() != _stream.output_length())
+      return fail();
+
+    return finish();
+  }
+
+  char* ZrleDecoder::grow(size_t& size)
+  {
+    if (!reserve(size))
+      return 0;
+
+    size = arena_size();
+
+    return arena();
+  }
+
+  TrleDecoder::TrleDecoder()
+    : TileDecoder(16, true)
+  {
+    _started = false;
+  }
+
+  RectDecoder::Result TrleDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    int bpp = context.format.bytes_per_pixel();
+    if (bpp != 1 && bpp != 2 && bpp != 4)
+      return decode_failed;
+
+    if (!_started)
+    {
+      start(context, rect);
+
+      _started = true;
+    }
+
+    // Input is copied past tiles found so far, and only bytes of tiles found complete are consumed.
+    size_t before = scanned();
+    size_t length = std::min(input.length(), limit() - before);
+
+    reserve(before + length);
+
+    input.copy(0, length, arena() + before);
+
+    bool valid = scan(before + length);
+
+    input.consume(scanned() - before);
+
+    if (valid && !all_scanned())
+      return decode_incomplete;
+
+    _started = false;
+
+    return valid ? finish() : fail();
+  }
+}
@@ -0,0 +1,159 @@
+#ifndef header_8e1f45b0_77ca_4d9f_84d7_34f94c59dc52
+#define header_8e1f45b0_77ca_4d9f_84d7_34f94c59dc52
+
+#include "rect_decoder.hpp"
+#include "worker_pool.hpp"
+#include "zlib_stream.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace Network
+{
+  // Tiles of raw, solid, packed palette, plain RLE or palette RLE pixels, as sent by ZRLE and TRLE. Encoded
+  // tiles are gathered in tile arena, and those complete in it are decoded on worker pool meanwhile, each
+  // into its own part of framebuffer. Rectangle is done once its last tile is.
+  class TileDecoder: public RectDecoder
+  {
+  protected:
+    // TRLE may reuse palette of previous tile.
+    TileDecoder(int tile_size, bool reuse_palette);
+    virtual ~TileDecoder();
+
+    // Prepares for encoded tiles of the rectangle.
+    void start(const DecodeContext& context, const RectHeader& rect);
+
+    // Grows arena to hold at least given size, false when it is past limit().
+    bool reserve(size_t size);
+
+    char* arena() const
+    {
+      return _arena.get();
+    }
+
+    size_t arena_size() const
+    {
+      return _arena_size;
+    }
+
+    // Largest encoded size of the rectangle.
+    size_t limit() const
+    {
+      return _limit;
+    }
+
+    // Finds tiles complete within given number of arena bytes and queues them for decoding.
+    // False when data is corrupt.
+    bool scan(size_t available);
+
+    // Bytes of arena taken by complete tiles.
+    size_t scanned() const
+    {
+      return _scanned;
+    }
+
+    bool all_scanned() const
+    {
+      return _tile == _tiles;
+    }
+
+    // Waits until all tiles are decoded.
+    Result finish();
+
+    Result fail();
+
+  private:
+    struct Tile
+    {
+      size_t offset;
+      int x;
+      int y;
+      int width;
+      int height;
+
+      // Palette in arena, which may belong to previous tile.
+      size_t palette;
+      int palette_size;
+    };
+
+    // Where tiles of current rectangle are decoded to.
+    struct Target
+    {
+      char* framebuffer;
+      size_t stride;
+      int width;
+      int height;
+      int bpp;
+      int cpixel;
+      int cpixel_offset;
+    };
+
+    // Length of tile data at offset, zero when not all of it is in yet, or -1 when it is corrupt.
+    size_t tile_length(size_t offset, size_t available, Tile& tile) const;
+
+    // Decodes queued tiles right away for small rectangles, or hands them to workers.
+    void dispatch();
+
+    void decode_tiles(const std::vector<Tile>& tiles) const;
+
+    template <int BPP, int CPIXEL>
+    void decode_tile(const Tile& tile, char* destination, size_t stride) const;
+
+  private:
+    int _tile_size;
+    bool _reuse_palette;
+
+    std::unique_ptr<char[]> _arena;
+    size_t _arena_size;
+    size_t _limit;
+
+    RectHeader _rect;
+    Target _target;
+
+    size_t _scanned;
+    int _tile;
+    int _tiles;
+
+    size_t _palette;
+    int _palette_size;
+
+    std::vector<Tile> _queued;
+    size_t _batch_tiles;
+    bool _parallel;
+    WorkerPool::Group _group;
+  };
+
+  // 64 x 64 tiles compressed by single zlib stream for whole connection, inflated into tile arena on the
+  // receiving thread as data arrives.
+  class ZrleDecoder: public TileDecoder, private InflateArea
+  {
+  public:
+    ZrleDecoder();
+
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+
+  private:
+    virtual char* grow(size_t& size);
+
+  private:
+    ZlibStream _stream;
+
+    bool _started;
+    size_t _remaining;
+  };
+
+  // 16 x 16 tiles without compression, and without length of rectangle, so tiles are taken from input one
+  // by one as they are found complete.
+  class TrleDecoder: public TileDecoder
+  {
+  public:
+    TrleDecoder();
+
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+
+  private:
+    bool _started;
+  };
+}
+
+#endif
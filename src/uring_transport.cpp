@@ -0,0 +1,413 @@
+#include "uring_transport.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef IORING_RECV_MULTISHOT
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace Network
+{
+#	define URING_ENTRIES 8
+#	define URING_BUFFERS 16
+#	define URING_BUFFER_SIZE 16384
+#	define URING_COMPLETIONS 64
+
+  UringTransport::UringTransport()
+    : _ring(-1), _socket(-1), _sq(0), _sq_size(0), _cq(0), _cq_size(0), _sqes(0), _sqes_size(0),
+      _sq_head(0), _sq_tail(0), _sq_mask(0), _sq_array(0), _sq_entries(0), _cq_head(0), _cq_tail(0), _cq_mask(0), _cqes(0),
+      _buffer_ring(0), _buffer_ring_size(0), _buffers(0), _buffer_tail(0), _multishot(true), _received(false), _unsubmitted(0), _sent(0)
+  {
+  }
+
+  UringTransport::~UringTransport()
+  {
+    close();
+  }
+
+#ifdef IORING_RECV_MULTISHOT
+
+  bool UringTransport::open(int socket)
+  {
+    close();
+
+    _socket = socket;
+
+    // Completion of every buffer, end of multishot receive, send and connect all fit, so that none of them
+    // overflows into kernel list nobody flushes.
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_COMPLETIONS;
+
+    _ring = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (_ring < 0)
+      return false;
+
+    _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      _sq_size = _cq_size = _sq_size > _cq_size ? _sq_size : _cq_size;
+
+    _sq = mmap(0, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+    if (_sq == MAP_FAILED)
+    {
+      _sq = 0;
+      close();
+      return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      _cq = _sq;
+    else
+    {
+      _cq = mmap(0, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+      if (_cq == MAP_FAILED)
+      {
+        _cq = 0;
+        close();
+        return false;
+      }
+    }
+
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED)
+    {
+      _sqes = 0;
+      close();
+      return false;
+    }
+
+    _sq_head = (unsigned*)((char*)_sq + params.sq_off.head);
+    _sq_tail = (unsigned*)((char*)_sq + params.sq_off.tail);
+    _sq_mask = (unsigned*)((char*)_sq + params.sq_off.ring_mask);
+    _sq_array = (unsigned*)((char*)_sq + params.sq_off.array);
+    _sq_entries = params.sq_entries;
+
+    _cq_head = (unsigned*)((char*)_cq + params.cq_off.head);
+    _cq_tail = (unsigned*)((char*)_cq + params.cq_off.tail);
+    _cq_mask = (unsigned*)((char*)_cq + params.cq_off.ring_mask);
+    _cqes = (char*)_cq + params.cq_off.cqes;
+
+    // Ring of provided buffers, kernel picks one for every received chunk.
+    _buffer_ring_size = (URING_BUFFERS * sizeof(io_uring_buf) + 4095) & ~(size_t)4095;
+    _buffer_ring = mmap(0, _buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_buffer_ring == MAP_FAILED)
+    {
+      _buffer_ring = 0;
+      close();
+      return false;
+    }
+
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (unsigned long long)(size_t)_buffer_ring;
+    registration.ring_entries = URING_BUFFERS;
+    registration.bgid = 0;
+
+    if (syscall(__NR_io_uring_register, _ring, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+      close();
+      return false;
+    }
+
+    _buffers = (char*)malloc(URING_BUFFERS * URING_BUFFER_SIZE);
+    if (!_buffers)
+    {
+      close();
+      return false;
+    }
+
+    for (int i = 0; i < URING_BUFFERS; ++i)
+      provide(i);
+
+    return true;
+  }
+
+  void UringTransport::close()
+  {
+    // Multishot receive may still be armed, so buffers are taken from the kernel and the ring is gone
+    // before their memory is released.
+    if (_ring >= 0 && _buffer_ring)
+    {
+      io_uring_buf_reg registration;
+      memset(&registration, 0, sizeof(registration));
+      registration.bgid = 0;
+
+      syscall(__NR_io_uring_register, _ring, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+    }
+
+    if (_sqes)
+      munmap(_sqes, _sqes_size);
+    if (_cq && _cq != _sq)
+      munmap(_cq, _cq_size);
+    if (_sq)
+      munmap(_sq, _sq_size);
+    if (_ring >= 0)
+      ::close(_ring);
+
+    if (_buffers)
+      free(_buffers);
+    if (_buffer_ring)
+      munmap(_buffer_ring, _buffer_ring_size);
+
+    _buffers = 0;
+    _buffer_ring = 0;
+    _buffer_tail = 0;
+    _multishot = true;
+    _received = false;
+    _sqes = 0;
+    _cq = 0;
+    _sq = 0;
+    _ring = -1;
+    _unsubmitted = 0;
+
+    _sending.clear();
+    _sent = 0;
+  }
+
+  void* UringTransport::acquire()
+  {
+    unsigned tail = *_sq_tail;
+
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+      submit();
+
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+      return 0;
+
+    io_uring_sqe* sqe = (io_uring_sqe*)_sqes + (tail & *_sq_mask);
+    memset(sqe, 0, sizeof(*sqe));
+
+    _sq_array[tail & *_sq_mask] = tail & *_sq_mask;
+
+    return sqe;
+  }
+
+  void UringTransport::commit()
+  {
+    __atomic_store_n(_sq_tail, *_sq_tail + 1, __ATOMIC_RELEASE);
+
+    ++_unsubmitted;
+  }
+
+  void UringTransport::submit()
+  {
+    while (_unsubmitted)
+    {
+      int result = (int)syscall(__NR_io_uring_enter, _ring, _unsubmitted, 0, 0, 0, 0);
+      if (result < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        break;
+      }
+
+      _unsubmitted -= result;
+
+      if (!result)
+        break;
+    }
+  }
+
+  void UringTransport::provide(int buffer)
+  {
+    // Entries are addressed from the start of the ring, in C++ its bufs member lands past an empty struct
+    // of the kernel header, 8 bytes off. Tail overlays reserved field of the first entry.
+    io_uring_buf_ring* ring = (io_uring_buf_ring*)_buffer_ring;
+    io_uring_buf* entry = (io_uring_buf*)_buffer_ring + (_buffer_tail & (URING_BUFFERS - 1));
+
+    entry->addr = (unsigned long long)(size_t)(_buffers + buffer * URING_BUFFER_SIZE);
+    entry->len = URING_BUFFER_SIZE;
+    entry->bid = (unsigned short)buffer;
+
+    ++_buffer_tail;
+
+    __atomic_store_n(&ring->tail, _buffer_tail, __ATOMIC_RELEASE);
+  }
+
+  void UringTransport::watch_connect()
+  {
+    io_uring_sqe* sqe = (io_uring_sqe*)acquire();
+    if (!sqe)
+      return;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = _socket;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = UringCompletion::operation_connect;
+
+    commit();
+    submit();
+  }
+
+  void UringTransport::receive()
+  {
+    io_uring_sqe* sqe = (io_uring_sqe*)acquire();
+    if (!sqe)
+      return;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = _socket;
+
+    if (_multishot)
+    {
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = 0;
+    }
+    else
+    {
+      // Single receive into whole buffer area, armed again after every completion.
+      sqe->addr = (unsigned long long)(size_t)_buffers;
+      sqe->len = URING_BUFFERS * URING_BUFFER_SIZE;
+    }
+
+    sqe->user_data = UringCompletion::operation_receive;
+
+    commit();
+    submit();
+  }
+
+  void UringTransport::send(std::string& data)
+  {
+    // Kernel reads from this buffer until send completes, so it is only replaced when nothing is in flight.
+    if (sending())
+      return;
+
+    _sending.swap(data);
+    _sent = 0;
+
+    sent(0);
+  }
+
+  bool UringTransport::sent(int result)
+  {
+    _sent += result;
+
+    if (!sending())
+    {
+      _sending.clear();
+      _sent = 0;
+
+      return false;
+    }
+
+    io_uring_sqe* sqe = (io_uring_sqe*)acquire();
+    if (!sqe)
+      return true;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = _socket;
+    sqe->addr = (unsigned long long)(size_t)(_sending.data() + _sent);
+    sqe->len = (unsigned)(_sending.size() - _sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UringCompletion::operation_send;
+
+    commit();
+    submit();
+
+    return true;
+  }
+
+  bool UringTransport::next(UringCompletion& completion)
+  {
+    for (;;)
+    {
+      unsigned head = *_cq_head;
+
+      if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+      io_uring_cqe* cqe = (io_uring_cqe*)_cqes + (head & *_cq_mask);
+
+      completion.operation = (int)cqe->user_data;
+      completion.result = cqe->res;
+      completion.more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+      completion.buffer = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+      completion.data = completion.buffer >= 0 ? _buffers + completion.buffer * URING_BUFFER_SIZE : 0;
+
+      // Multishot receive rejected before anything was received is not supported, receives continue one at
+      // a time. Running out of buffers only ends it, it is armed again once they are returned.
+      if (completion.operation == UringCompletion::operation_receive && _multishot && !_received && completion.result == -EINVAL)
+      {
+        _multishot = false;
+
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        receive();
+        continue;
+      }
+
+      if (completion.operation == UringCompletion::operation_receive && !_multishot && completion.result > 0)
+        completion.data = _buffers;
+
+      if (completion.operation == UringCompletion::operation_receive && completion.result >= 0)
+        _received = true;
+
+      return true;
+    }
+  }
+
+  void UringTransport::release(const UringCompletion& completion)
+  {
+    if (completion.buffer >= 0)
+      provide(completion.buffer);
+
+    __atomic_store_n(_cq_head, *_cq_head + 1, __ATOMIC_RELEASE);
+  }
+
+#else
+
+  bool UringTransport::open(int)
+  {
+    return false;
+  }
+
+  void UringTransport::close()
+  {
+  }
+
+  void UringTransport::watch_connect()
+  {
+  }
+
+  void UringTransport::receive()
+  {
+  }
+
+  void UringTransport::send(std::string&)
+  {
+  }
+
+  bool UringTransport::sent(int)
+  {
+    return false;
+  }
+
+  bool UringTransport::next(UringCompletion&)
+  {
+    return false;
+  }
+
+  void UringTransport::release(const UringCompletion&)
+  {
+  }
+
+#endif
+}
@@ -0,0 +1,114 @@
+#ifndef header_2744a4eb_bac3_4c24_9d8c_ebca12edb164
+#define header_2744a4eb_bac3_4c24_9d8c_ebca12edb164
+
+#include <stddef.h>
+
+#include <string>
+
+namespace Network
+{
+  struct UringCompletion
+  {
+    enum Operation
+    {
+      operation_connect = 1,
+      operation_receive = 2,
+      operation_send = 3
+    };
+
+    int operation;
+    int result;
+    bool more;
+
+    const char* data;
+    int buffer;
+  };
+
+  // Linux io_uring backend of RawStream. Data is received by multishot receive into a ring of
+  // buffers provided to the kernel (single receives where that is not supported), and everything
+  // queued for sending goes out in one request.
+  // The ring descriptor becomes readable when completions arrive, so it is waited on instead of socket.
+  class UringTransport
+  {
+  public:
+    UringTransport();
+    ~UringTransport();
+
+    // Returns false when io_uring or required features are not available.
+    bool open(int socket);
+
+    void close();
+
+    int handle() const
+    {
+      return _ring;
+    }
+
+    bool sending() const
+    {
+      return _sent < _sending.size();
+    }
+
+    // Waits for connection to complete before receiving.
+    void watch_connect();
+
+    void receive();
+
+    // Sends data with single request, only when previous send is complete. Data is taken over.
+    void send(std::string& data);
+
+    // Accounts sent bytes, resending the rest. Returns false when everything was sent.
+    bool sent(int result);
+
+    bool next(UringCompletion& completion);
+
+    void release(const UringCompletion& completion);
+
+  private:
+    void* acquire();
+
+    void commit();
+
+    void submit();
+
+    void provide(int buffer);
+
+  private:
+    int _ring;
+    int _socket;
+
+    void* _sq;
+    size_t _sq_size;
+    void* _cq;
+    size_t _cq_size;
+    void* _sqes;
+    size_t _sqes_size;
+
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    unsigned _sq_entries;
+
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    void* _cqes;
+
+    void* _buffer_ring;
+    size_t _buffer_ring_size;
+    char* _buffers;
+    unsigned short _buffer_tail;
+    bool _multishot;
+
+    // Some receive completed, so multishot receive is supported.
+    bool _received;
+
+    unsigned _unsubmitted;
+
+    std::string _sending;
+    size_t _sent;
+  };
+}
+
+#endif
@@ -12,15 +12,36 @@
 
 #include <iostream>
 
+#include <string.h>
+
 namespace Network
 {	
-  VncClient::VncClient(const char* hostname, const char* port)
-    : RawStream(hostname, port), _state(vnc_waiting_for_version), _width(0), _height(0), _bpp(0), _keep_framebuffer(false), _framebuffer_version(0)
+  VncClient::VncClient(const char* hostname, const char* port, Transport transport, const SocketOptions& options)
+    : RawStream(hostname, port, transport, options), _state(vnc_waiting_for_version), _established(false), _choice_sent(false), _init_sent(false), _keep_framebuffer(false),
+      _width(0), _height(0), _bpp(0), _framebuffer_version(0), _update_active(false), _update_rects(0), _rect_active(false), _extended_desktop_size(false)
+  {
+    memset(&_pixel_format, 0, sizeof(_pixel_format));
+
+    _encodings.push_back(encoding_raw);
+
+    // Input sent before session is set up would be taken for handshake by the server.
+    hold_input();
+  }
+
+  VncClient::VncClient(Socket socket, Transport transport, const SocketOptions& options)
+    : RawStream(socket, transport, options), _state(vnc_waiting_for_version), _established(false), _choice_sent(false), _init_sent(false), _keep_framebuffer(false),
+      _width(0), _height(0), _bpp(0), _framebuffer_version(0), _update_active(false), _update_rects(0), _rect_active(false), _extended_desktop_size(false)
   {
+    memset(&_pixel_format, 0, sizeof(_pixel_format));
+
+    _encodings.push_back(encoding_raw);
+
+    hold_input();
   }
 
   VncClient::~VncClient()
   {
+    delete_decoders();
   }
 
   bool VncClient::connected() const
@@ -28,6 +49,11 @@ namespace Network
     return _state == vnc_connected;
   }
 
+  const char* VncClient::desktop_name() const
+  {
+    return _name.c_str();
+  }
+
   const char* VncClient::username() const
   {
     return _username.c_str();
@@ -62,6 +88,109 @@ namespace Network
     _keep_framebuffer = keep;
   }
 
+  void VncClient::set_encodings(const std::vector<int>& encodings)
+  {
+    std::lock_guard<std::mutex> lock(_encodings_lock);
+
+    _encodings.clear();
+
+    for (size_t i = 0; i < encodings.size(); ++i)
+    {
+      int encoding = encodings[i];
+
+      bool level = (encoding >= encoding_quality_level_0 && encoding <= encoding_quality_level_0 + 9) ||
+        (encoding >= encoding_compress_level_0 && encoding <= encoding_compress_level_0 + 9);
+
+      bool pseudo = encoding == encoding_desktop_size || encoding == encoding_extended_desktop_size ||
+        encoding == encoding_last_rect;
+
+      if (level || pseudo || RectDecoder::supported(encoding))
+        _encodings.push_back(encoding);
+    }
+
+    if (_state == vnc_connected)
+    {
+      std::string message;
+      encodings_message(message);
+
+      write_now(message.data(), message.data() + message.size());
+    }
+  }
+
+  std::vector<int> VncClient::encodings()
+  {
+    std::lock_guard<std::mutex> lock(_encodings_lock);
+
+    return _encodings;
+  }
+
+  const PixelFormat& VncClient::pixel_format() const
+  {
+    return _pixel_format;
+  }
+
+  void VncClient::encodings_message(std::string& message)
+  {
+    message.resize(4 + 4 * _encodings.size());
+
+    message[0] = 2;
+    message[1] = 0;
+    message[2] = (char)((_encodings.size() >> 8) & 0xff);
+    message[3] = (char)(_encodings.size() & 0xff);
+
+    for (size_t i = 0; i < _encodings.size(); ++i)
+    {
+      unsigned int encoding = (unsigned int)_encodings[i];
+
+      message[4 + i * 4] = (char)(encoding >> 24);
+      message[5 + i * 4] = (char)((encoding >> 16) & 0xff);
+      message[6 + i * 4] = (char)((encoding >> 8) & 0xff);
+      message[7 + i * 4] = (char)(encoding & 0xff);
+    }
+  }
+
+  RectDecoder* VncClient::decoder(int encoding)
+  {
+    std::map<int, RectDecoder*>::iterator found = _decoders.find(encoding);
+    if (found != _decoders.end())
+      return found->second;
+
+    RectDecoder* decoder = RectDecoder::create(encoding);
+    if (decoder)
+      _decoders[encoding] = decoder;
+
+    return decoder;
+  }
+
+  void VncClient::delete_decoders()
+  {
+    for (std::map<int, RectDecoder*>::iterator i = _decoders.begin(); i != _decoders.end(); ++i)
+      delete i->second;
+
+    _decoders.clear();
+  }
+
+  void VncClient::decode_context(DecodeContext& context)
+  {
+    memset(&context, 0, sizeof(context));
+
+    context.input = &response();
+    context.format = _pixel_format;
+    context.width = _width;
+    context.height = _height;
+    context.stride = _width * _bpp;
+
+    if (_keep_framebuffer && _width > 0 && _height > 0)
+    {
+      size_t size = (size_t)_width * _height * _bpp;
+
+      if (_framebuffer.size() < size)
+        _framebuffer.resize(size);
+
+      context.framebuffer = &_framebuffer[0];
+    }
+  }
+
   int VncClient::framebuffer_width() const
   {
     return _width;
@@ -87,52 +216,67 @@ namespace Network
     return _framebuffer.size() > 0 ? &_framebuffer[0] : nullptr;
   }
 
-  bool VncClient::update(float timeout)
+  std::vector<VncClient::Screen> VncClient::screens()
+  {
+    std::lock_guard<std::mutex> lock(_screens_lock);
+
+    return _screens;
+  }
+
+  void VncClient::resize_framebuffer(int width, int height)
   {
-    if (!RawStream::update(timeout))
+    if (_framebuffer.size() > 0)
+    {
+      size_t old_stride = _width * _bpp;
+      size_t new_stride = width * _bpp;
+      size_t copy = std::min(old_stride, new_stride);
+      size_t rows = std::min(_height, height);
+
+      // Rows move within the buffer, forward when they get shorter and backward when they get longer,
+      // so that none is overwritten before it is moved.
+      if (new_stride <= old_stride)
+      {
+        for (size_t y = 1; y < rows; ++y)
+          memmove(&_framebuffer[y * new_stride], &_framebuffer[y * old_stride], copy);
+
+        _framebuffer.resize(new_stride * height);
+      }
+      else
+      {
+        _framebuffer.resize(new_stride * height);
+
+        for (size_t y = rows; y-- > 0;)
+        {
+          memmove(&_framebuffer[y * new_stride], &_framebuffer[y * old_stride], copy);
+          memset(&_framebuffer[y * new_stride + copy], 0, new_stride - copy);
+        }
+      }
+
+      if (rows * new_stride < _framebuffer.size())
+        memset(&_framebuffer[rows * new_stride], 0, _framebuffer.size() - rows * new_stride);
+    }
+
+    _width = width;
+    _height = height;
+  }
+
+  bool VncClient::dispatch(int poll_status)
+  {
+    if (!RawStream::dispatch(poll_status))
       return false;
 
     if (state() == state_connected)
     {
-      switch (_state)
+      // Handle everything received so far, next update may block waiting for more data.
+      for (;;)
       {
-        case vnc_waiting_for_version:
-          rfb_wait_for_version();
-          break;
-        case vnc_waiting_for_security_server:
-          rfb_wait_for_security_server();
-          break;
-        case vnc_waiting_for_security_handshake:
-          rfb_wait_for_security_handshake();
-          break;
-        case vnc_authenticate:
-          rfb_authenticate();
-          break;
-        case vnc_waiting_for_vnc_challenge:
-          rfb_wait_for_vnc_challenge();
-          break;
-        case vnc_waiting_for_ard_challenge:
-          rfb_wait_for_ard_challenge();
-          break;
-        case vnc_waiting_for_security_result:
-          rfb_wait_for_security_result();
-          break;
-        case vnc_waiting_for_protocol_failure_reason:
-          rfb_wait_for_protocol_failure_reason();
-          break;
-        case vnc_initialize:
-          rfb_initialize();
-          break;
-        case vnc_waiting_for_server_initialization:
-          rfb_wait_for_server_initialization();
-          break;
-        case vnc_setup:
-          rfb_setup();
-          break;
-        case vnc_connected:
-          rfb_connected();
-          break;
-        case vnc_protocol_failure:
+        VncState state = _state;
+        size_t received = response().length();
+        bool direct = direct_read_pending();
+
+        process();
+
+        if (_state == state && response().length() == received && direct_read_pending() == direct)
           break;
       }
     }
@@ -140,9 +284,70 @@ namespace Network
     return true;
   }  
 
+  void VncClient::reconnecting()
+  {
+    // Credentials, protocol version, security type and framebuffer are kept for the new session.
+    _state = vnc_waiting_for_version;
+
+    _update_active = false;
+    _update_rects = 0;
+    _rect_active = false;
+
+    // Decoder state, e.g. compression streams, belongs to the old connection.
+    delete_decoders();
+
+    _choice_sent = false;
+    _init_sent = false;
+  }
+
+  void VncClient::process()
+  {
+    switch (_state)
+    {
+      case vnc_waiting_for_version:
+        rfb_wait_for_version();
+        break;
+      case vnc_waiting_for_security_server:
+        rfb_wait_for_security_server();
+        break;
+      case vnc_waiting_for_security_handshake:
+        rfb_wait_for_security_handshake();
+        break;
+      case vnc_authenticate:
+        rfb_authenticate();
+        break;
+      case vnc_waiting_for_vnc_challenge:
+        rfb_wait_for_vnc_challenge();
+        break;
+      case vnc_waiting_for_ard_challenge:
+        rfb_wait_for_ard_challenge();
+        break;
+      case vnc_waiting_for_security_result:
+        rfb_wait_for_security_result();
+        break;
+      case vnc_waiting_for_protocol_failure_reason:
+        rfb_wait_for_protocol_failure_reason();
+        break;
+      case vnc_initialize:
+        rfb_initialize();
+        break;
+      case vnc_waiting_for_server_initialization:
+        rfb_wait_for_server_initialization();
+        break;
+      case vnc_setup:
+        rfb_setup();
+        break;
+      case vnc_connected:
+        rfb_connected();
+        break;
+      case vnc_protocol_failure:
+        break;
+    }
+  }
+
   void VncClient::rfb_wait_for_version()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.size() >= 12)
     {
@@ -155,11 +360,14 @@ namespace Network
       else
       {
         // Simply respond with the same protocol version as we've got from server.
-        write(&*r.begin(), &*r.begin() + 12);
+        const char* version = r.contiguous(0, 12);
+        write(version, version + 12);
 
         char version_hi[] = { r[4] != '0' ? r[4] : (r[5] != '0' ? r[5] : r[6]), 0 };
         char version_lo[] = { r[8] != '0' ? r[8] : (r[9] != '0' ? r[9] : r[10]), 0 };
 
+        bool resumed = _established && _proto_hi_version == atoi(version_hi) && _proto_lo_version == atoi(version_lo);
+
         _proto_hi_version = atoi(version_hi);
         _proto_lo_version = atoi(version_lo);
 
@@ -169,17 +377,35 @@ namespace Network
           _state = vnc_waiting_for_security_server;
         else
           _state = vnc_waiting_for_security_handshake;
+
+        // Same server offers the same security types again, so previous choice goes out without waiting
+        // for the list, and with no authentication, so does the client initialization.
+        if (resumed && _state == vnc_waiting_for_security_handshake)
+        {
+          char choice = (char)_security_type;
+          write(&choice, &choice + 1);
+
+          _choice_sent = true;
+
+          if (_security_type == 1 /* No authentication */)
+          {
+            char shared[] = { 1 };
+            write(shared, shared + 1);
+
+            _init_sent = true;
+          }
+        }
       }
     }
   }
 
   void VncClient::rfb_wait_for_security_server()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 4)
     {
-      int security_protocol = *(int *)&*r.begin();
+      int security_protocol = (int)r.u32(0);
       if (security_protocol == 0)
       {
         set_error(STREAM_VNC_PROTOCOL_ERROR, "Server refused remote control connection.");
@@ -199,7 +425,7 @@ namespace Network
 
   void VncClient::rfb_wait_for_security_handshake()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() > 0)
     {
@@ -218,8 +444,18 @@ namespace Network
       {
         int choosen_protocol = -1;
 
+        // Type chosen ahead of the list has to be offered by the server.
+        for (int i = 0; i < protocol_count && _choice_sent; ++i)
+        {
+          if (r[i + 1] == _security_type)
+          {
+            choosen_protocol = i + 1;
+            break;
+          }
+        }
+
         // Check for preferred authentication type.
-        for (int i = 0; i < protocol_count; ++i)
+        for (int i = 0; i < protocol_count && !_choice_sent; ++i)
         {
           if (r[i + 1] == 30 /* ARD, Mac authentication */)
           {
@@ -229,7 +465,7 @@ namespace Network
         }
 
         // Check for supported authentication types.
-        if (choosen_protocol < 0) 
+        if (choosen_protocol < 0 && !_choice_sent) 
         {
           for (int i = 0; i < protocol_count; ++i)
           {
@@ -243,7 +479,10 @@ namespace Network
 
         if (choosen_protocol >= 0)
         {
-          write(&*r.begin() + choosen_protocol, &*r.begin() + choosen_protocol + 1);
+          char choice = r[choosen_protocol];
+
+          if (!_choice_sent)
+            write(&choice, &choice + 1);
 
           _security_type = r[choosen_protocol];
 
@@ -305,7 +544,7 @@ namespace Network
 
   void VncClient::rfb_wait_for_ard_challenge()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
     //char r[261] = "\x0\x2\x0\x80\xff\xff\xff\xff\xff\xff\xff\xff\xc9\x0f\xda\xa2\x21\x68\xc2\x34\xc4\xc6\x62\x8b\x80\xdc\x1c\xd1\x29\x02\x4e\x08\x8a\x67\xcc\x74\x02\x0b\xbe\xa6\x3b\x13\x9b\x22\x51\x4a\x08\x79\x8e\x34\x04\xdd\xef\x95\x19\xb3\xcd\x3a\x43\x1b\x30\x2b\x0a\x6d\xf2\x5f\x14\x37\x4f\xe1\x35\x6d\x6d\x51\xc2\x45\xe4\x85\xb5\x76\x62\x5e\x7e\xc6\xf4\x4c\x42\xe9\xa6\x37\xed\x6b\x0b\xff\x5c\xb6\xf4\x06\xb7\xed\xee\x38\x6b\xfb\x5a\x89\x9f\xa5\xae\x9f\x24\x11\x7c\x4b\x1f\xe6\x49\x28\x66\x51\xec\xe6\x53\x81\xff\xff\xff\xff\xff\xff\xff\xff\x1d\xf4\xb4\x2d\x58\x30\x75\x27\xc7\x23\x1a\x1d\x52\x9c\x8c\x4a\x67\x10\xa8\x28\x68\x97\x70\xc4\x4d\xd7\x06\x4c\xc3\xe2\xe3\xcf\x0d\x06\xb7\xb6\xc5\x70\x0a\x88\xd8\xa3\xba\xaf\xaa\x51\x93\x58\x9e\x51\x05\xbb\x88\x0d\xb6\xb2\xf4\xbc\xbe\xee\x61\x14\xfa\x7c\x3e\x61\x9d\xe8\x49\x2f\x1c\xf4\xe0\xf1\x3d\xb8\x15\x66\x99\x5f\xcf\x3c\x54\x27\x0a\xc0\x2e\xe2\x05\x22\xde\x73\xf3\x67\x5c\xe0\xe0\xf0\x25\xbc\xce\x45\x6a\x62\xb0\xc1\x85\x2d\x1f\x72\xba\x0b\xc1\x64\xcc\x24\x05\x68\x93\x08\x8d\xd2\xd1\x7e\xe2\x4d\x18\xf3";
     
     if (_password.length() == 0 || _username.length() == 0)
@@ -316,8 +555,8 @@ namespace Network
 
     if (r.length() >= 4)
     {
-      int generator_value = 256 * (unsigned char)r[0] + (unsigned char)r[1];
-      int key_length = 256 * (unsigned char)r[2] + (unsigned char)r[3];
+      int generator_value = r.u16(0);
+      int key_length = r.u16(2);
 
       if (r.length() >= 4 + key_length + key_length)
       {        
@@ -328,9 +567,11 @@ namespace Network
 		    rng.SetKeyWithIV((byte *)seed.data(), 16, (byte *)seed.data());
 
         // Get parameters from auth message.
+        const unsigned char* parameters = (const unsigned char*)r.contiguous(4, key_length + key_length);
+
         CryptoPP::Integer generator(generator_value);
-        CryptoPP::Integer prime_modulus((unsigned char*)&r[4], key_length);
-        CryptoPP::Integer peer_public_key((unsigned char*)&r[4 + key_length], key_length);
+        CryptoPP::Integer prime_modulus(parameters, key_length);
+        CryptoPP::Integer peer_public_key(parameters + key_length, key_length);
 
         CryptoPP::SecByteBlock remote_public(key_length);
         peer_public_key.Encode(remote_public, key_length);
@@ -414,7 +655,7 @@ namespace Network
 
   void VncClient::rfb_wait_for_vnc_challenge()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 16)
     {
@@ -463,11 +704,11 @@ namespace Network
 
   void VncClient::rfb_wait_for_security_result()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 4)
     {
-      unsigned int security_result = byte_swap(*(unsigned int *)&*r.begin());
+      unsigned int security_result = r.u32(0);
       if (security_result == 0)
       { 
         _state = vnc_initialize;
@@ -500,15 +741,16 @@ namespace Network
     }
     else
     {
-      std::string& r = response();
+      ReceiveBuffer& r = response();
 
       if (r.length() >= 4)
       {
-        unsigned int length = byte_swap(*(unsigned int *)&*r.begin());
+        unsigned int length = r.u32(0);
 
         if (r.length() >= 4 + length)
         {
-          _message.assign(&r[4], &r[4] + length);
+          const char* message = r.contiguous(4, length);
+          _message.assign(message, message + length);
 
           _state = vnc_protocol_failure;
 
@@ -520,29 +762,51 @@ namespace Network
 
   void VncClient::rfb_initialize()
   {
-    // Ask for shared session.
+    // Ask for shared session, unless that was done ahead when reconnecting.
     char shared[] = { 1 };
 
-    write(shared, shared + 1);
+    if (!_init_sent)
+      write(shared, shared + 1);
 
     _state = vnc_waiting_for_server_initialization;
   }
 
   void VncClient::rfb_wait_for_server_initialization()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 24)
     {
-      unsigned int name_length = byte_swap(*(unsigned int *)(&*r.begin() + 20));
+      unsigned int name_length = r.u32(20);
       if (r.length() >= 24 + name_length)
       {
-        _width = (int)(byte_swap(*(unsigned short *)(&*r.begin() + 0)));
-        _height = (int)(byte_swap(*(unsigned short *)(&*r.begin() + 2)));
+        int width = (int)r.u16(0);
+        int height = (int)r.u16(2);
+
+        _pixel_format.parse((const unsigned char*)r.contiguous(4, 16));
+
+        int bpp = _pixel_format.bytes_per_pixel();
 
-        _bpp = (int)(*(unsigned char *)(&*r.begin() + 4)) / 8;
+        // Framebuffer of previous session stays until refreshed, unless the desktop changed meanwhile.
+        if (width != _width || height != _height || bpp != _bpp)
+          _framebuffer.clear();
 
-        _name.assign(r.begin() + 24, r.begin() + 24 + name_length);
+        _width = width;
+        _height = height;
+        _bpp = bpp;
+
+        {
+          // Layout is reported again by the server, if it supports ExtendedDesktopSize.
+          std::lock_guard<std::mutex> lock(_screens_lock);
+
+          Screen screen = { 0, 0, 0, width, height, 0 };
+          _screens.assign(1, screen);
+
+          _extended_desktop_size = false;
+        }
+
+        const char* name = r.contiguous(24, name_length);
+        _name.assign(name, name + name_length);
 
         _state = vnc_setup;
 
@@ -553,17 +817,38 @@ namespace Network
 
   void VncClient::rfb_setup()
   {
-    // Set up raw encoding type. We don't ask for screens anyway.
-    char encoding[] = { 2, 0, 0, 1, 0, 0, 0, 0 };
+    {
+      // Encodings changed from now on are sent by set_encodings().
+      std::lock_guard<std::mutex> lock(_encodings_lock);
+
+      std::string message;
+      encodings_message(message);
 
-    write(encoding, encoding + sizeof(encoding) / sizeof(char));
+      write(message.data(), message.data() + message.size());
 
-    _state = vnc_connected;
+      _state = vnc_connected;
+    }
+
+    // Kept framebuffer missed changes while disconnected, single full update brings it up to date.
+    if (_established && _keep_framebuffer)
+      request_screen(false, 0, 0, _width, _height);
+
+    _established = true;
+    _choice_sent = false;
+    _init_sent = false;
+
+    session_ready();
   }
 
   void VncClient::rfb_connected()
   {
-    std::string& r = response();
+    if (_update_active)
+    {
+      rfb_framebuffer_update();
+      return;
+    }
+
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 1)
     {
@@ -591,85 +876,184 @@ namespace Network
 
   void VncClient::rfb_framebuffer_update()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
-    if (r.length() >= 4)
+    if (!_update_active)
     {
-      int length = (int)byte_swap(*(unsigned short *)(&*r.begin() + 2));
+      if (r.length() < 4)
+        return;
 
-      bool complete = true;
+      _update_rects = (int)r.u16(2);
+      _update_active = true;
 
-      int current = 4;
+      eat(4);
+    }
 
-      for (; length > 0; --length)
+    // Apply rectangles one by one, as soon as their data arrives.
+    while (_update_rects > 0 && !direct_read_pending())
+    {
+      if (!_rect_active)
       {
-        if (r.length() >= current + 12)
-        { 
-          int x = byte_swap(*(unsigned short *)(&*r.begin() + current + 0));
-          int y = byte_swap(*(unsigned short *)(&*r.begin() + current + 2));
-          int width = byte_swap(*(unsigned short *)(&*r.begin() + current + 4));
-          int height = byte_swap(*(unsigned short *)(&*r.begin() + current + 6));
-          int type = byte_swap(*(unsigned int *)(&*r.begin() + current + 8));
-
-          if (type != 0)
-          {
-            set_error(STREAM_VNC_UNSUPPORTED, "Server sent unsupported message.");
+        if (r.length() < 12)
+          break;
 
-            _state = vnc_protocol_failure;
+        _rect.x = r.u16(0);
+        _rect.y = r.u16(2);
+        _rect.width = r.u16(4);
+        _rect.height = r.u16(6);
+        _rect.encoding = (int)r.u32(8);
 
-            complete = false;
-            
-            break;
-          }
-          else
-          {
-            int pixel_length = width * height * _bpp;
-            if (r.length() >= current + 12 + pixel_length)
-            {
-              current += 12 + pixel_length;
+        _rect_active = true;
 
-              // Copy pixel data.
-              if (_keep_framebuffer) 
-              {
-                if (_framebuffer.size() < _width * _height * _bpp)
-                  _framebuffer.resize(_width * _height * _bpp);
+        eat(12);
+      }
 
-                int left = std::min(x, _width);
-                int bytes_per_line = (std::min(x + width, _width) - left) * _bpp;;
+      // Server which does not count rectangles ahead sends 0xFFFF as their count, and ends the update with
+      // LastRect.
+      if (_rect.encoding == encoding_last_rect)
+      {
+        _rect_active = false;
 
-                for (int top = y, last_top = std::min(_height, y + height); top < last_top; ++top)
-                  std::memcpy(&_framebuffer[0] + (top * _width + left) * _bpp, r.data() + (top - y) * width * _bpp, bytes_per_line);                
+        _update_rects = 0;
 
-                ++_framebuffer_version;
-              }              
-            }
-            else
-            {
-              complete = false;
+        break;
+      }
 
-              break;
-            }
-          }
-        }
-        else
-        {
-          complete = false;
+      if (_rect.encoding == encoding_desktop_size || _rect.encoding == encoding_extended_desktop_size)
+      {
+        if (!rfb_desktop_size())
           break;
-        }
+
+        _rect_active = false;
+
+        --_update_rects;
+
+        continue;
+      }
+
+      // Decoders size their buffers by the rectangle, which has to be within framebuffer.
+      if (_rect.x + _rect.width > _width || _rect.y + _rect.height > _height)
+      {
+        set_error(STREAM_VNC_PROTOCOL_ERROR, "Server sent invalid rectangle.");
+
+        _state = vnc_protocol_failure;
+
+        return;
       }
 
-      if (complete)
-        eat(current);
+      RectDecoder* decoder = this->decoder(_rect.encoding);
+      if (!decoder)
+      {
+        set_error(STREAM_VNC_UNSUPPORTED, "Server sent unsupported message.");
+
+        _state = vnc_protocol_failure;
+
+        return;
+      }
+
+      DecodeContext context;
+      decode_context(context);
+
+      RectDecoder::Result result = decoder->decode(context, _rect);
+      if (result == RectDecoder::decode_incomplete)
+        break;
+
+      if (result == RectDecoder::decode_failed)
+      {
+        set_error(STREAM_VNC_PROTOCOL_ERROR, "Server sent invalid rectangle.");
+
+        _state = vnc_protocol_failure;
+
+        return;
+      }
+
+      _rect_active = false;
+
+      --_update_rects;
+
+      // Pixel data goes from the socket straight into framebuffer rows, or is dropped if framebuffer is not kept.
+      if (context.read_direct)
+        read_direct(context.direct);
+    }
+
+    if (_update_rects == 0 && !direct_read_pending())
+    {
+      _update_active = false;
+
+      if (_keep_framebuffer)
+        ++_framebuffer_version;
     }
   }
 
+  bool VncClient::rfb_desktop_size()
+  {
+    bool requested = false;
+    int status = resize_ok;
+
+    std::vector<Screen> screens;
+
+    if (_rect.encoding == encoding_extended_desktop_size)
+    {
+      ReceiveBuffer& r = response();
+
+      if (r.length() < 4)
+        return false;
+
+      int count = (unsigned char)r[0];
+      if (r.length() < (size_t)(4 + 16 * count))
+        return false;
+
+      // Position carries reason and status instead, reason 1 being answer to this client.
+      requested = _rect.x == 1;
+      status = _rect.y;
+
+      for (int i = 0; i < count; ++i)
+      {
+        size_t offset = 4 + 16 * i;
+
+        Screen screen = { r.u32(offset), (int)r.u16(offset + 4), (int)r.u16(offset + 6), (int)r.u16(offset + 8),
+          (int)r.u16(offset + 10), r.u32(offset + 12) };
+        screens.push_back(screen);
+      }
+
+      eat(4 + 16 * count);
+    }
+
+    if (screens.empty())
+    {
+      Screen screen = { 0, 0, 0, _rect.width, _rect.height, 0 };
+      screens.push_back(screen);
+    }
+
+    // Refused request leaves desktop as it was.
+    if (status == resize_ok)
+    {
+      resize_framebuffer(_rect.width, _rect.height);
+
+      std::lock_guard<std::mutex> lock(_screens_lock);
+
+      _screens = screens;
+    }
+
+    if (_rect.encoding == encoding_extended_desktop_size)
+    {
+      std::lock_guard<std::mutex> lock(_screens_lock);
+
+      _extended_desktop_size = true;
+    }
+
+    desktop_resized(requested, status);
+
+    return true;
+  }
+
   void VncClient::rfb_set_color_map()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 6)
     {
-      unsigned short length = byte_swap(*(unsigned short *)(&*r.begin() + 4));
+      unsigned short length = r.u16(4);
 
       if (r.length() >= 6 + length * 6)
       {
@@ -680,9 +1064,9 @@ namespace Network
    
   void VncClient::rfb_bell()
   {    
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
-    if (r.length() >= 8)
+    if (r.length() >= 1)
     {
       eat(1);
     }
@@ -690,11 +1074,11 @@ namespace Network
    
   void VncClient::rfb_set_clipboard()
   {
-    std::string& r = response();
+    ReceiveBuffer& r = response();
 
     if (r.length() >= 8)
     {
-      unsigned int length = byte_swap(*(unsigned int *)(&*r.begin() + 4));
+      unsigned int length = r.u32(4);
       if (r.length() >= 8 + length)
       {
         eat(8 + length);
@@ -712,7 +1096,21 @@ namespace Network
   {    
     char key_event[] = { 4, (char)(down ? 1 : 0), 0, 0, 0, 0, (char)((key & 0xff00) >> 8), (char)(key & 0x00ff) };
 
-    write(key_event, key_event + sizeof(key_event) / sizeof(char));
+    write_now(key_event, key_event + sizeof(key_event) / sizeof(char));
+  }
+
+  void VncClient::send_pointer(int x, int y, int buttons)
+  {
+    char pointer_event[] = {
+      5,
+      (char)(buttons & 0xff),
+      (char)((x & 0xff00) >> 8),
+      (char)(x & 0xff),
+      (char)((y & 0xff00) >> 8),
+      (char)(y & 0xff)
+    };
+
+    write_now(pointer_event, pointer_event + sizeof(pointer_event) / sizeof(char));
   }
 
   void VncClient::request_screen(bool incremental, int x, int y, int width, int height)
@@ -730,22 +1128,56 @@ namespace Network
       (char)(height & 0xff)
     };
 
-    write(frame_event, frame_event + sizeof(frame_event) / sizeof(char));
+    write_now(frame_event, frame_event + sizeof(frame_event) / sizeof(char));
   }
 
-  unsigned int VncClient::byte_swap(unsigned int v)
+  bool VncClient::set_desktop_size(int width, int height)
   {
-    return 
-      ((v & 0x000000ff) << 24) |
-      ((v & 0x0000ff00) << 8) | 
-      ((v & 0x00ff0000) >> 8) |
-      ((v & 0xff000000) >> 24);
+    std::vector<Screen> screens = this->screens();
+
+    Screen screen = { screens.size() > 0 ? screens[0].id : 0, 0, 0, width, height, screens.size() > 0 ? screens[0].flags : 0 };
+
+    return set_desktop_size(width, height, std::vector<Screen>(1, screen));
   }
 
-  unsigned short VncClient::byte_swap(unsigned short v)
+  bool VncClient::set_desktop_size(int width, int height, const std::vector<Screen>& screens)
   {
-    return 
-      ((v & 0x00ff) << 8) |
-      ((v & 0xff00) >> 8);
+    {
+      std::lock_guard<std::mutex> lock(_screens_lock);
+
+      if (!_extended_desktop_size)
+        return false;
+    }
+
+    if (screens.empty() || screens.size() > 255)
+      return false;
+
+    std::string message(8 + 16 * screens.size(), '\0');
+
+    message[0] = (char)251;
+    message[2] = (char)((width & 0xff00) >> 8);
+    message[3] = (char)(width & 0xff);
+    message[4] = (char)((height & 0xff00) >> 8);
+    message[5] = (char)(height & 0xff);
+    message[6] = (char)screens.size();
+
+    for (size_t i = 0; i < screens.size(); ++i)
+    {
+      const Screen& screen = screens[i];
+
+      unsigned int fields[] = { screen.id, (unsigned int)screen.x, (unsigned int)screen.y, (unsigned int)screen.width,
+        (unsigned int)screen.height, screen.flags };
+      int sizes[] = { 4, 2, 2, 2, 2, 4 };
+
+      char* out = &message[8 + i * 16];
+
+      for (int f = 0; f < 6; ++f)
+        for (int b = sizes[f] - 1; b >= 0; --b)
+          *out++ = (char)((fields[f] >> (b * 8)) & 0xff);
+    }
+
+    write_now(message.data(), message.data() + message.size());
+
+    return true;
   }
-}
\ No newline at end of file
+}
@@ -2,6 +2,9 @@
 #define header_92665f2e_2fa1_4d1c_9394_5746d6d04aeb
 
 #include "raw_query.hpp"
+#include "rect_decoder.hpp"
+
+#include <map>
 
 #define STREAM_VNC_PROTOCOL_ERROR (STREAM_TCP_RANGE + 1)
 #define STREAM_VNC_PASSWORD_REQUIRED (STREAM_TCP_RANGE + 2)
@@ -31,12 +34,54 @@ namespace Network
       vnc_protocol_failure
     };
 
+    enum Encoding
+    {
+      encoding_raw = 0,
+      encoding_copy_rect = 1,
+      encoding_rre = 2,
+      encoding_corre = 4,
+      encoding_hextile = 5,
+      encoding_zlib = 6,
+      encoding_tight = 7,
+      encoding_trle = 15,
+      encoding_zrle = 16,
+      encoding_tight_png = -260,
+
+      // Pseudo-encodings, announcing what client understands.
+      encoding_desktop_size = -223,
+      encoding_last_rect = -224,
+      encoding_extended_desktop_size = -308,
+
+      // Hints for server, level from 0 to 9 is added to these.
+      encoding_quality_level_0 = -32,
+      encoding_compress_level_0 = -256
+    };
+
+    // Answer of server to set_desktop_size().
+    enum ResizeStatus
+    {
+      resize_ok = 0,
+      resize_prohibited = 1,
+      resize_out_of_resources = 2,
+      resize_invalid_layout = 3
+    };
+
+    // Monitor within desktop, in framebuffer coordinates.
+    struct Screen
+    {
+      unsigned int id;
+      int x;
+      int y;
+      int width;
+      int height;
+      unsigned int flags;
+    };
+
   public:
-    VncClient(const char* hostname, const char* port);
+    VncClient(const char* hostname, const char* port, Transport transport = transport_poll, const SocketOptions& options = SocketOptions());
+    VncClient(Socket socket, Transport transport = transport_poll, const SocketOptions& options = SocketOptions());
     virtual ~VncClient();
 
-    bool update(float timeout = -1);
-
     const char* password() const;
     const char* username() const;
 
@@ -45,13 +90,26 @@ namespace Network
 
     bool connected() const;
 
+    const char* desktop_name() const;
+
     void pulse_key(unsigned short key);
     void send_key(unsigned short key, bool down);
 
+    // Buttons is a mask, bit 0 being left button.
+    void send_pointer(int x, int y, int buttons);
+
     void request_screen(bool incremental, int x, int y, int width, int height);
 
     void set_keep_framebuffer(bool keep);
 
+    // Encodings in order of preference, pseudo-encodings and levels included. Encodings without decoder
+    // are left out, RAW is always allowed. Sent when session is set up, or right away when it already is.
+    void set_encodings(const std::vector<int>& encodings);
+
+    std::vector<int> encodings();
+
+    const PixelFormat& pixel_format() const;
+
     int framebuffer_width() const;
 
     int framebuffer_height() const;
@@ -62,7 +120,30 @@ namespace Network
 
     const char* framebuffer() const;
 
+    // Screens making up the desktop. Single one covering whole framebuffer, unless server reports layout
+    // with ExtendedDesktopSize.
+    std::vector<Screen> screens();
+
+    // Asks server to change desktop size, with single screen or given layout. False when server did not
+    // announce ExtendedDesktopSize support yet, desktop_resized() tells the outcome.
+    bool set_desktop_size(int width, int height);
+    bool set_desktop_size(int width, int height, const std::vector<Screen>& screens);
+
+  protected:
+    virtual bool dispatch(int poll_status);
+
+    virtual void reconnecting();
+
+    // Called when desktop size or screen layout changed, framebuffer is already resized and keeps its
+    // content where old and new size overlap. Requested is set for answer to set_desktop_size(), which
+    // changed nothing unless status is resize_ok.
+    virtual void desktop_resized(bool /*requested*/, int /*status*/)
+    {
+    }
+
   private:
+    void process();
+
     void rfb_wait_for_version();
     void rfb_wait_for_security_server();
     void rfb_wait_for_security_handshake();
@@ -80,12 +161,20 @@ namespace Network
     void rfb_setup();
     void rfb_connected();
     void rfb_framebuffer_update();
+    bool rfb_desktop_size();
     void rfb_set_color_map();
     void rfb_bell();
     void rfb_set_clipboard();
 
-    unsigned int byte_swap(unsigned int v);
-    unsigned short byte_swap(unsigned short v);
+    RectDecoder* decoder(int encoding);
+
+    void decode_context(DecodeContext& context);
+
+    void encodings_message(std::string& message);
+
+    void delete_decoders();
+
+    void resize_framebuffer(int width, int height);
 
   private:
     VncState _state;
@@ -95,6 +184,12 @@ namespace Network
 
     int _security_type;
 
+    // Session was set up before, so version and security type are known when reconnecting,
+    // and replies which were sent ahead of server messages.
+    bool _established;
+    bool _choice_sent;
+    bool _init_sent;
+
     bool _keep_framebuffer;
 
     int _width;
@@ -102,6 +197,25 @@ namespace Network
     int _bpp;
     int _framebuffer_version;
 
+    // Position within framebuffer update being received, kept between calls as its data arrives.
+    bool _update_active;
+    int _update_rects;
+
+    RectHeader _rect;
+    bool _rect_active;
+
+    PixelFormat _pixel_format;
+
+    std::vector<int> _encodings;
+    std::mutex _encodings_lock;
+
+    std::map<int, RectDecoder*> _decoders;
+
+    // Server accepts SetDesktopSize once it sent ExtendedDesktopSize in this session.
+    std::vector<Screen> _screens;
+    bool _extended_desktop_size;
+    std::mutex _screens_lock;
+
     std::string _name;
 
     std::string _username;
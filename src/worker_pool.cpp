@@ -0,0 +1,106 @@
+#include "worker_pool.hpp"
+
+#include <thread>
+
+namespace Network
+{
+  WorkerPool& WorkerPool::instance()
+  {
+    // Never destroyed, workers may still be waiting for tasks when the process exits.
+    static WorkerPool* pool = new WorkerPool();
+
+    return *pool;
+  }
+
+  WorkerPool::WorkerPool()
+    : _threads(0), _idle_threads(0)
+  {
+    int cores = (int)std::thread::hardware_concurrency();
+
+    _max_threads = cores > 1 ? cores - 1 : 0;
+  }
+
+  void WorkerPool::set_threads(int threads)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _max_threads = threads > 0 ? threads : 0;
+
+    _task_ready.notify_all();
+  }
+
+  int WorkerPool::threads() const
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    return _max_threads;
+  }
+
+  void WorkerPool::submit(Group& group, const Task& task)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    Entry entry = { &group, task };
+    _tasks.push_back(entry);
+
+    ++group.pending;
+
+    if ((int)_tasks.size() > _idle_threads && _threads < _max_threads)
+    {
+      std::thread(&WorkerPool::worker_thread, this).detach();
+      ++_threads;
+    }
+
+    _task_ready.notify_one();
+  }
+
+  void WorkerPool::wait(Group& group)
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+
+    while (group.pending > 0)
+    {
+      if (!_tasks.empty())
+        run_task(lock);
+      else
+        _group_done.wait(lock);
+    }
+  }
+
+  void WorkerPool::run_task(std::unique_lock<std::mutex>& lock)
+  {
+    Entry entry = _tasks.front();
+    _tasks.pop_front();
+
+    lock.unlock();
+
+    entry.task();
+
+    lock.lock();
+
+    if (--entry.group->pending == 0)
+      _group_done.notify_all();
+  }
+
+  void WorkerPool::worker_thread()
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+
+    // Threads above lowered limit end once they are idle.
+    while (_threads <= _max_threads)
+    {
+      if (_tasks.empty())
+      {
+        ++_idle_threads;
+        _task_ready.wait(lock);
+        --_idle_threads;
+
+        continue;
+      }
+
+      run_task(lock);
+    }
+
+    --_threads;
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef header_3bfb5658_4f27_4731_84ed_d0fe248f0b2c
+#define header_3bfb5658_4f27_4731_84ed_d0fe248f0b2c
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace Network
+{
+  // Threads shared by all clients in the process for decoding work which splits into independent parts,
+  // such as tiles of large rectangles. Threads are started on demand, up to one less than number of cores,
+  // since thread waiting for a group helps with its tasks.
+  class WorkerPool
+  {
+  public:
+    typedef std::function<void()> Task;
+
+    // Tasks which are waited for together.
+    struct Group
+    {
+      Group(): pending(0)
+      {
+      }
+
+      int pending;
+    };
+
+    static WorkerPool& instance();
+
+    void submit(Group& group, const Task& task);
+
+    // Returns once all tasks of group are done, running queued tasks on calling thread meanwhile.
+    void wait(Group& group);
+
+    // Upper limit of worker threads, zero runs all tasks on threads waiting for them.
+    void set_threads(int threads);
+
+    int threads() const;
+
+  private:
+    struct Entry
+    {
+      Group* group;
+      Task task;
+    };
+
+    WorkerPool();
+
+    void worker_thread();
+
+    // Runs first queued task with lock released.
+    void run_task(std::unique_lock<std::mutex>& lock);
+
+  private:
+    mutable std::mutex _lock;
+
+    std::condition_variable _task_ready;
+    std::condition_variable _group_done;
+    std::deque<Entry> _tasks;
+
+    int _max_threads;
+    int _threads;
+    int _idle_threads;
+  };
+}
+
+#endif
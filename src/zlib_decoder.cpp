@@ -0,0 +1,61 @@
+#include "zlib_decoder.hpp"
+
+#include <algorithm>
+
+namespace Network
+{
+  ZlibDecoder::ZlibDecoder()
+  {
+    _started = false;
+    _remaining = 0;
+  }
+
+  RectDecoder::Result ZlibDecoder::decode(DecodeContext& context, const RectHeader& rect)
+  {
+    ReceiveBuffer& input = *context.input;
+
+    if (!_started)
+    {
+      if (input.length() < 4)
+        return decode_incomplete;
+
+      _remaining = input.u32(0);
+      _started = true;
+
+      // Decompressed pixels go straight into framebuffer rows.
+      _stream.set_output(framebuffer_rows(context, rect));
+
+      input.consume(4);
+    }
+
+    // Data is decompressed as it arrives.
+    while (_remaining > 0 && !input.empty())
+    {
+      BufferSpan<const char> span = input.span(0, std::min(_remaining, input.length()));
+
+      size_t length = span.length();
+      bool end = length == _remaining;
+
+      bool valid = _stream.inflate(span.first, span.first_length, end && !span.second_length) &&
+        (!span.second_length || _stream.inflate(span.second, span.second_length, end));
+
+      input.consume(length);
+
+      _remaining -= length;
+
+      if (!valid)
+      {
+        _started = false;
+
+        return decode_failed;
+      }
+    }
+
+    if (_remaining > 0)
+      return decode_incomplete;
+
+    _started = false;
+
+    return _stream.output_length() == (size_t)rect.width * rect.height * context.format.bytes_per_pixel() ? decode_done : decode_failed;
+  }
+}
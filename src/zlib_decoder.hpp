@@ -0,0 +1,25 @@
+#ifndef header_d511156d_24af_463c_9c95_db9eb69bbf4f
+#define header_d511156d_24af_463c_9c95_db9eb69bbf4f
+
+#include "rect_decoder.hpp"
+#include "zlib_stream.hpp"
+
+namespace Network
+{
+  // RAW pixel data compressed by single zlib stream for whole connection.
+  class ZlibDecoder: public RectDecoder
+  {
+  public:
+    ZlibDecoder();
+
+    virtual Result decode(DecodeContext& context, const RectHeader& rect);
+
+  private:
+    ZlibStream _stream;
+
+    bool _started;
+    size_t _remaining;
+  };
+}
+
+#endif
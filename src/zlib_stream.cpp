@@ -0,0 +1,147 @@
+#include "zlib_stream.hpp"
+
+#include "cryptoppmin/zinflate.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace Network
+{
+  // Takes output of Inflator straight into framebuffer rows.
+  class InflateSink: public CryptoPP::Bufferless<CryptoPP::Sink>
+  {
+  public:
+    InflateSink()
+    {
+      set_output(DirectRead());
+    }
+
+    void set_output(const DirectRead& rows)
+    {
+      _rows = rows;
+      _area = 0;
+      _offset = 0;
+    }
+
+    void set_output(InflateArea* area, char* destination, size_t size)
+    {
+      DirectRead rows = { destination, 0, size, size, 1, 1 };
+
+      set_output(rows);
+      _area = area;
+    }
+
+    size_t output_length() const
+    {
+      return _offset;
+    }
+
+    size_t Put2(const byte* data, size_t length, int, bool)
+    {
+      // Single row of growing area is all of it.
+      if (_area && _offset + length > _rows.row_length)
+      {
+        size_t size = _offset + length;
+        char* destination = _area->grow(size);
+
+        if (destination)
+        {
+          _rows.destination = destination;
+          _rows.row_length = _rows.copy_length = size;
+        }
+      }
+
+      size_t end = std::min(_offset + length, _rows.row_length * _rows.stored_rows);
+
+      // Parts of rows past copy_length are outside of framebuffer, output past all rows is invalid.
+      for (size_t offset = _offset; offset < end; )
+      {
+        size_t row = offset / _rows.row_length;
+        size_t column = offset % _rows.row_length;
+        size_t chunk = std::min(end - offset, _rows.row_length - column);
+
+        if (column < _rows.copy_length)
+          memcpy(_rows.destination + row * _rows.stride + column, data + (offset - _offset), std::min(chunk, _rows.copy_length - column));
+
+        offset += chunk;
+      }
+
+      _offset += length;
+
+      return 0;
+    }
+
+  private:
+    DirectRead _rows;
+    InflateArea* _area;
+    size_t _offset;
+  };
+
+  ZlibStream::ZlibStream()
+  {
+    _sink = new InflateSink();
+    _inflator = new CryptoPP::Inflator(_sink);
+    _header_length = 0;
+  }
+
+  ZlibStream::~ZlibStream()
+  {
+    // Sink is owned by inflator.
+    delete _inflator;
+  }
+
+  void ZlibStream::reset()
+  {
+    delete _inflator;
+
+    _sink = new InflateSink();
+    _inflator = new CryptoPP::Inflator(_sink);
+    _header_length = 0;
+  }
+
+  void ZlibStream::set_output(const DirectRead& rows)
+  {
+    _sink->set_output(rows);
+  }
+
+  void ZlibStream::set_output(InflateArea* area, char* destination, size_t size)
+  {
+    _sink->set_output(area, destination, size);
+  }
+
+  size_t ZlibStream::output_length() const
+  {
+    return _sink->output_length();
+  }
+
+  bool ZlibStream::inflate(const char* data, size_t length, bool end)
+  {
+    while (_header_length < 2 && length > 0)
+    {
+      _header[_header_length++] = (unsigned char)*data++;
+      --length;
+
+      // Deflate method, no preset dictionary, and check bits.
+      if (_header_length == 2 && ((_header[0] & 0x0f) != 8 || (_header[1] & 0x20) || ((_header[0] << 8) | _header[1]) % 31))
+        return false;
+    }
+
+    // Crypto++ reports corrupt data with exceptions, they are not let out of here.
+    try
+    {
+      if (length > 0)
+        _inflator->Put((const byte*)data, length);
+
+      // Hard flush decodes data held back while waiting for more.
+      if (end)
+        _inflator->Flush(true);
+    }
+    catch (const CryptoPP::Exception&)
+    {
+      return false;
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef header_15446fe4_c280_4e81_b5c9_9b2846d44457
+#define header_15446fe4_c280_4e81_b5c9_9b2846d44457
+
+#include "raw_query.hpp"
+
+namespace CryptoPP
+{
+  class Inflator;
+}
+
+namespace Network
+{
+  class InflateSink;
+
+  // Output area of ZlibStream which grows as output arrives, keeping output written so far.
+  class InflateArea
+  {
+  public:
+    virtual ~InflateArea() {}
+
+    // Returns area of at least given size and sets size to its actual size, or null when it may not grow
+    // that much.
+    virtual char* grow(size_t& size) = 0;
+  };
+
+  // Zlib stream lasting for whole connection, as used by Zlib, ZRLE and Tight encodings. Server flushes it
+  // at the end of every rectangle, so all output of rectangle is there once its compressed data is in.
+  class ZlibStream
+  {
+  public:
+    ZlibStream();
+    ~ZlibStream();
+
+    // Starts new stream, as Tight server may ask for at any rectangle.
+    void reset();
+
+    // Output goes to framebuffer rows, laid out in the same way as with read_direct().
+    void set_output(const DirectRead& rows);
+
+    // Output goes to single area, grown as needed.
+    void set_output(InflateArea* area, char* destination, size_t size);
+
+    // Feeds compressed data as it arrives, end is set with last data of a rectangle.
+    // Returns false when data is corrupt.
+    bool inflate(const char* data, size_t length, bool end);
+
+    // Bytes of output since set_output(), including those past the output area.
+    size_t output_length() const;
+
+  private:
+    CryptoPP::Inflator* _inflator;
+    InflateSink* _sink;
+
+    // Two byte zlib header, checked here since Inflator takes raw deflate data.
+    unsigned char _header[2];
+    int _header_length;
+  };
+}
+
+#endif